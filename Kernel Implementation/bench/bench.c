@@ -0,0 +1,344 @@
+/*
+ * Benchmark suite for the shell's hot paths, run by `make bench`.
+ *
+ * parse_command and spawn_command are measured in-process. Pipelines,
+ * hdiff and mindmap are measured end to end by running the built shell
+ * with -c on inputs generated into a temporary directory. Every figure is
+ * the best of BENCH_RUNS runs.
+ *
+ * Results are written as tab-separated "metric value unit" lines, one
+ * metric per line and always in the same order, after a few '#' header
+ * lines. Compare two outputs with e.g. `join -t $'\t' old new`.
+ *
+ * Usage: bench MISHELL [OUTPUT [VERSION]]
+ */
+#define _GNU_SOURCE // nftw flags
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "launch.h"
+#include "shell.h"
+
+const char *sysname = "mishell";
+
+#define BENCH_RUNS 3
+#define PARSE_LINES 1000000
+#define SPAWNS 1000
+#define PIPE_MB 512
+#define BINARY_MB 64
+#define TEXT_LINES 200000
+#define TREE_FANOUT 20 // dirs per level, two levels
+#define TREE_FILES 50 // files per leaf dir
+
+extern char **environ;
+
+static const char *corpus[] = {
+	"ls -la /tmp",
+	"echo hello world from the benchmark",
+	"cat file1.txt | grep foo | wc -l",
+	"gzip -9 -c build/output/archive.tar >archive.tar.gz",
+	"sha256sum 'some file.bin' other.bin >>checksums.txt",
+	"sort <input.txt -u -k2,2 -t ,",
+	"make -j8 all &",
+	"hdiff -b disk1.img disk2.img",
+	"find . -name *.c -newer Makefile -print",
+	"cd ..",
+};
+
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+#define LINE_MAX_LEN 4096
+
+static const char *mishell;
+static char workdir[] = "/tmp/mishell-bench.XXXXXX";
+static FILE *output;
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what) {
+	perror(what);
+	exit(1);
+}
+
+static void report(const char *metric, double value, const char *unit) {
+	fprintf(output, "%s\t%.1f\t%s\n", metric, value, unit);
+	printf("%-28s %14.1f %s\n", metric, value, unit);
+	fflush(output);
+	fflush(stdout);
+}
+
+static char *work_path(const char *name) {
+	static char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", workdir, name);
+	return path;
+}
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ull;
+
+static unsigned long long next_random() {
+	rng_state ^= rng_state << 13; // xorshift64
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+/**
+ * Two files of BINARY_MB random bytes that differ in one byte per MiB
+ */
+static void make_binary_inputs() {
+	size_t size = (size_t)BINARY_MB << 20;
+	unsigned long long *buf = malloc(size);
+	if (!buf)
+		die("malloc");
+
+	for (size_t i = 0; i < size / sizeof(*buf); i++)
+		buf[i] = next_random();
+
+	FILE *a = fopen(work_path("a.bin"), "wb");
+	if (!a || fwrite(buf, 1, size, a) != size || fclose(a))
+		die("a.bin");
+
+	for (size_t off = 12345; off < size; off += 1 << 20)
+		((unsigned char *)buf)[off] ^= 0x5a;
+
+	FILE *b = fopen(work_path("b.bin"), "wb");
+	if (!b || fwrite(buf, 1, size, b) != size || fclose(b))
+		die("b.bin");
+
+	free(buf);
+}
+
+/**
+ * Two text files of TEXT_LINES lines where every 100th line differs
+ * @return size of the first file in bytes
+ */
+static size_t make_text_inputs() {
+	FILE *a = fopen(work_path("a.txt"), "w");
+	FILE *b = fopen(work_path("b.txt"), "w");
+	if (!a || !b)
+		die("text inputs");
+
+	for (int i = 0; i < TEXT_LINES; i++) {
+		unsigned long long r = next_random();
+		fprintf(a, "line %d value %llu payload %016llx\n", i, r % 1000000, r);
+		fprintf(b, "line %d value %llu payload %016llx\n", i,
+				r % 1000000 + (i % 100 == 0), r);
+	}
+
+	size_t size = ftell(a);
+	if (fclose(a) || fclose(b))
+		die("text inputs");
+	return size;
+}
+
+/**
+ * TREE_FANOUT directories, each with TREE_FANOUT subdirectories holding
+ * TREE_FILES empty files
+ * @return number of entries below the root
+ */
+static long make_tree() {
+	char path[4096];
+	long entries = 0;
+
+	snprintf(path, sizeof(path), "%s/tree", workdir);
+	if (mkdir(path, 0755) == -1)
+		die(path);
+
+	for (int i = 0; i < TREE_FANOUT; i++) {
+		snprintf(path, sizeof(path), "%s/tree/d%02d", workdir, i);
+		if (mkdir(path, 0755) == -1)
+			die(path);
+		entries++;
+
+		for (int j = 0; j < TREE_FANOUT; j++) {
+			snprintf(path, sizeof(path), "%s/tree/d%02d/s%02d", workdir, i, j);
+			if (mkdir(path, 0755) == -1)
+				die(path);
+			entries++;
+
+			for (int k = 0; k < TREE_FILES; k++) {
+				snprintf(path, sizeof(path), "%s/tree/d%02d/s%02d/f%03d",
+						 workdir, i, j, k);
+				int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+				if (fd == -1)
+					die(path);
+				close(fd);
+				entries++;
+			}
+		}
+	}
+
+	return entries;
+}
+
+/**
+ * Run `mishell -c script` with stdout discarded
+ * @param  script   command line for -c
+ * @param  stdin_path file to use as stdin, NULL for /dev/null
+ * @return          wall clock seconds
+ */
+static double run_shell(const char *script, const char *stdin_path) {
+	posix_spawn_file_actions_t actions;
+	char *argv[] = {(char *)mishell, "-c", (char *)script, NULL};
+	int status;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+									 stdin_path ? stdin_path : "/dev/null",
+									 O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+									 O_WRONLY, 0);
+
+	double start = now_sec();
+	errno = posix_spawn(&pid, mishell, &actions, NULL, argv, environ);
+	if (errno)
+		die(mishell);
+	if (waitpid(pid, &status, 0) == -1)
+		die("waitpid");
+	double elapsed = now_sec() - start;
+
+	posix_spawn_file_actions_destroy(&actions);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "bench: `%s` failed\n", script);
+		exit(1);
+	}
+	return elapsed;
+}
+
+static double best_shell_run(const char *script, const char *stdin_path) {
+	double best = 0;
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		double t = run_shell(script, stdin_path);
+		if (i == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+static double bench_parse() {
+	struct arena arena;
+	double best = 0;
+
+	arena_init(&arena, 64 * 1024);
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		double start = now_sec();
+
+		for (long i = 0; i < PARSE_LINES; i++) {
+			struct command_t *command =
+				arena_calloc(&arena, sizeof(struct command_t));
+			char *buf = arena_alloc(&arena, LINE_MAX_LEN);
+			strcpy(buf, corpus[i % CORPUS_SIZE]);
+			parse_command(&arena, buf, command);
+			arena_reset(&arena);
+		}
+
+		double t = now_sec() - start;
+		if (run == 0 || t < best)
+			best = t;
+	}
+	arena_destroy(&arena);
+
+	return PARSE_LINES / best;
+}
+
+static double bench_spawn() {
+	char *args[] = {"/bin/true", NULL};
+	struct command_t command = {
+		.name = args[0],
+		.arg_count = 2,
+		.args = args,
+	};
+	double best = 0;
+
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		double start = now_sec();
+
+		for (int i = 0; i < SPAWNS; i++) {
+			pid_t pid = spawn_command(&command, -1, -1, -1, -1);
+			waitpid(pid, NULL, 0);
+		}
+
+		double t = now_sec() - start;
+		if (run == 0 || t < best)
+			best = t;
+	}
+
+	return best / SPAWNS * 1e6;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+						struct FTW *ftw) {
+	(void)st;
+	(void)flag;
+	(void)ftw;
+	return remove(path);
+}
+
+int main(int argc, char *argv[]) {
+	char script[8192];
+	time_t now = time(NULL);
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: bench MISHELL [OUTPUT [VERSION]]\n");
+		return 1;
+	}
+	mishell = argv[1];
+
+	const char *output_path = argc > 2 ? argv[2] : "bench_output.txt";
+	output = fopen(output_path, "w");
+	if (!output)
+		die(output_path);
+
+	if (!mkdtemp(workdir))
+		die("mkdtemp");
+
+	fprintf(output, "# mishell bench 1\n");
+	fprintf(output, "# version\t%s\n", argc > 3 ? argv[3] : "unknown");
+	fprintf(output, "# date\t%s", ctime(&now));
+	fprintf(output, "# cpus\t%ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	report("parse_lines_per_sec", bench_parse(), "lines/s");
+	report("spawn_latency_us", bench_spawn(), "us");
+
+	snprintf(script, sizeof(script),
+			 "head -c %dM /dev/zero | cat | cat > /dev/null", PIPE_MB);
+	report("pipeline_mb_per_sec", PIPE_MB / best_shell_run(script, NULL),
+		   "MB/s");
+
+	// measure the comparison itself, not the digest cache
+	setenv("MISHELL_DIGEST_CACHE", "", 1);
+
+	make_binary_inputs();
+	snprintf(script, sizeof(script), "hdiff -b %s/a.bin %s/b.bin", workdir,
+			 workdir);
+	report("hdiff_binary_mb_per_sec", BINARY_MB / best_shell_run(script, NULL),
+		   "MB/s");
+
+	double text_mb = make_text_inputs() / (double)(1 << 20);
+	snprintf(script, sizeof(script), "hdiff -a %s/a.txt %s/b.txt", workdir,
+			 workdir);
+	report("hdiff_text_mb_per_sec", text_mb / best_shell_run(script, NULL),
+		   "MB/s");
+
+	long entries = make_tree();
+	snprintf(script, sizeof(script), "mindmap %s/tree", workdir);
+	report("mindmap_entries_per_sec", entries / best_shell_run(script, NULL),
+		   "entries/s");
+
+	nftw(workdir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	fclose(output);
+	printf("results written to %s\n", output_path);
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Spawn latency benchmark: starts /bin/true repeatedly through the old
+ * fork+execvp path and through spawn_command, with the shell's heap grown
+ * to several sizes first, and reports microseconds per spawn+wait.
+ *
+ * Build and run with `make spawn_bench`. Heap sizes in MiB may be given on
+ * the command line.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "launch.h"
+
+const char *sysname = "mishell";
+
+#define SPAWNS 2000
+
+static double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_fork(struct command_t *command) {
+	double start = now_sec();
+
+	for (int i = 0; i < SPAWNS; i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			execvp(command->name, command->args);
+			_exit(127);
+		}
+		waitpid(pid, NULL, 0);
+	}
+
+	return (now_sec() - start) / SPAWNS * 1e6;
+}
+
+static double bench_spawn(struct command_t *command) {
+	double start = now_sec();
+
+	for (int i = 0; i < SPAWNS; i++) {
+		pid_t pid = spawn_command(command, -1, -1, -1, -1);
+		waitpid(pid, NULL, 0);
+	}
+
+	return (now_sec() - start) / SPAWNS * 1e6;
+}
+
+int main(int argc, char *argv[]) {
+	static const long default_sizes[] = {0, 64, 256, 1024};
+	char *args[] = {"/bin/true", NULL};
+	struct command_t command = {
+		.name = args[0],
+		.arg_count = 2,
+		.args = args,
+	};
+	int nsizes = argc > 1 ? argc - 1 : 4;
+
+	printf("%-10s %14s %14s\n", "heap_mib", "fork_us", "spawn_us");
+	for (int i = 0; i < nsizes; i++) {
+		long mib = argc > 1 ? atol(argv[i + 1]) : default_sizes[i];
+		size_t size = (size_t)mib << 20;
+		char *heap = NULL;
+
+		if (size) {
+			// touch every page so it is really part of the RSS
+			heap = malloc(size);
+			if (!heap) {
+				perror("malloc");
+				return 1;
+			}
+			memset(heap, 1, size);
+		}
+
+		double fork_us = bench_fork(&command);
+		double spawn_us = bench_spawn(&command);
+		printf("%-10ld %14.1f %14.1f\n", mib, fork_us, spawn_us);
+		free(heap);
+	}
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+static size_t align_up(size_t n) {
+	return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static void *xmalloc(struct arena *arena, size_t size) {
+	void *p = malloc(size);
+	if (!p) {
+		perror("arena");
+		exit(EXIT_FAILURE);
+	}
+	arena->heap_allocs++;
+	return p;
+}
+
+/**
+ * Initialize an arena with an initial backing buffer
+ * @param arena [description]
+ * @param cap   initial capacity in bytes
+ */
+void arena_init(struct arena *arena, size_t cap) {
+	memset(arena, 0, sizeof(*arena));
+	arena->cap = align_up(cap ? cap : ARENA_ALIGN);
+	arena->buf = xmalloc(arena, arena->cap);
+}
+
+/**
+ * Allocate size bytes from the arena. The memory stays valid until the next
+ * arena_reset(). Requests that do not fit the backing buffer are served from
+ * spill blocks, and the buffer is grown on reset so the next line fits.
+ * @param  arena [description]
+ * @param  size  [description]
+ * @return       aligned pointer, never NULL
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+	size = align_up(size ? size : 1);
+
+	if (arena->cap - arena->used >= size) {
+		void *p = arena->buf + arena->used;
+		arena->used += size;
+		return p;
+	}
+
+	struct arena_block *block =
+		xmalloc(arena, sizeof(struct arena_block) + size);
+	block->size = size;
+	block->next = arena->spill;
+	arena->spill = block;
+	arena->spilled += size;
+	return block->data;
+}
+
+void *arena_calloc(struct arena *arena, size_t size) {
+	void *p = arena_alloc(arena, size);
+	memset(p, 0, size);
+	return p;
+}
+
+char *arena_strdup(struct arena *arena, const char *s) {
+	size_t len = strlen(s) + 1;
+	return memcpy(arena_alloc(arena, len), s, len);
+}
+
+/**
+ * Release everything allocated since the last reset in O(1) for the common
+ * case. If spill blocks were needed, they are freed and the backing buffer
+ * is enlarged to cover the peak usage.
+ * @param arena [description]
+ */
+void arena_reset(struct arena *arena) {
+	if (arena->spill) {
+		size_t want = arena->cap + arena->spilled;
+
+		while (arena->spill) {
+			struct arena_block *next = arena->spill->next;
+			free(arena->spill);
+			arena->spill = next;
+		}
+
+		free(arena->buf);
+		arena->cap = align_up(want);
+		arena->buf = xmalloc(arena, arena->cap);
+		arena->spilled = 0;
+	}
+	arena->used = 0;
+}
+
+void arena_destroy(struct arena *arena) {
+	while (arena->spill) {
+		struct arena_block *next = arena->spill->next;
+		free(arena->spill);
+		arena->spill = next;
+	}
+	free(arena->buf);
+	arena->buf = NULL;
+	arena->spilled = 0;
+	arena->used = 0;
+	arena->cap = 0;
+}
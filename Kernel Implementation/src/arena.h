@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for per-line data. Everything the parser produces for a
+ * prompt line lives in one arena and is released with a single
+ * arena_reset() instead of walking the command tree.
+ */
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	char data[];
+};
+
+struct arena {
+	char *buf;
+	size_t cap;
+	size_t used;
+	struct arena_block *spill; // blocks taken when buf was exhausted
+	size_t spilled; // bytes served from spill blocks since last reset
+	unsigned long heap_allocs; // malloc/realloc calls made by the arena
+};
+
+void arena_init(struct arena *arena, size_t cap);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_calloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *s);
+void arena_reset(struct arena *arena);
+void arena_destroy(struct arena *arena);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bytecmp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BYTECMP_X86 1
+#endif
+
+static size_t scalar_first_diff(const unsigned char *a, const unsigned char *b,
+								size_t n) {
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		if (x != y) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return i + __builtin_ctzll(x ^ y) / 8;
+#else
+			break;
+#endif
+		}
+	}
+
+	for (; i < n; i++) {
+		if (a[i] != b[i])
+			return i;
+	}
+	return n;
+}
+
+static uint64_t scalar_count_diff(const unsigned char *a, const unsigned char *b,
+								  size_t n) {
+	uint64_t count = 0;
+
+	for (size_t i = 0; i < n; i++)
+		count += a[i] != b[i];
+	return count;
+}
+
+#ifdef BYTECMP_X86
+
+/*
+ * Counting works on equal bytes: cmpeq gives 0xff (-1) per equal byte, so
+ * subtracting it from a byte accumulator adds one. The byte lanes are
+ * folded into 64-bit sums with sad before they can wrap at 255.
+ */
+
+__attribute__((target("sse2"))) static size_t
+sse2_first_diff(const unsigned char *a, const unsigned char *b, size_t n) {
+	size_t i = 0;
+
+	for (; i + 64 <= n; i += 64) {
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+									_mm_loadu_si128((const __m128i *)(b + i)));
+		__m128i e1 =
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+						   _mm_loadu_si128((const __m128i *)(b + i + 16)));
+		__m128i e2 =
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+						   _mm_loadu_si128((const __m128i *)(b + i + 32)));
+		__m128i e3 =
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+						   _mm_loadu_si128((const __m128i *)(b + i + 48)));
+		__m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+
+		if (_mm_movemask_epi8(all) != 0xffff)
+			break; // located below
+	}
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+									_mm_loadu_si128((const __m128i *)(b + i)));
+		unsigned int mask = ~_mm_movemask_epi8(eq) & 0xffff;
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + scalar_first_diff(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2"))) static uint64_t
+sse2_count_diff(const unsigned char *a, const unsigned char *b, size_t n) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sums = zero;
+	size_t i = 0;
+
+	while (i + 16 <= n) {
+		__m128i acc = zero;
+		size_t end = i + 255 * 16 < n ? i + 255 * 16 : n;
+
+		for (; i + 16 <= end; i += 16) {
+			__m128i eq =
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+							   _mm_loadu_si128((const __m128i *)(b + i)));
+			acc = _mm_sub_epi8(acc, eq);
+		}
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(acc, zero));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i *)lanes, sums);
+	return i - (lanes[0] + lanes[1]) + scalar_count_diff(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+avx2_first_diff(const unsigned char *a, const unsigned char *b, size_t n) {
+	size_t i = 0;
+
+	for (; i + 128 <= n; i += 128) {
+		__m256i e0 =
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)),
+							  _mm256_loadu_si256((const __m256i *)(b + i)));
+		__m256i e1 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+			_mm256_loadu_si256((const __m256i *)(b + i + 32)));
+		__m256i e2 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(a + i + 64)),
+			_mm256_loadu_si256((const __m256i *)(b + i + 64)));
+		__m256i e3 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *)(a + i + 96)),
+			_mm256_loadu_si256((const __m256i *)(b + i + 96)));
+		__m256i all =
+			_mm256_and_si256(_mm256_and_si256(e0, e1), _mm256_and_si256(e2, e3));
+
+		if ((unsigned int)_mm256_movemask_epi8(all) != 0xffffffffu)
+			break; // located below
+	}
+
+	for (; i + 32 <= n; i += 32) {
+		__m256i eq =
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)),
+							  _mm256_loadu_si256((const __m256i *)(b + i)));
+		unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(eq);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + scalar_first_diff(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static uint64_t
+avx2_count_diff(const unsigned char *a, const unsigned char *b, size_t n) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i sums = zero;
+	size_t i = 0;
+
+	while (i + 64 <= n) {
+		__m256i acc0 = zero, acc1 = zero;
+		size_t end = i + 255 * 64 < n ? i + 255 * 64 : n;
+
+		for (; i + 64 <= end; i += 64) {
+			__m256i eq0 = _mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *)(a + i)),
+				_mm256_loadu_si256((const __m256i *)(b + i)));
+			__m256i eq1 = _mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+				_mm256_loadu_si256((const __m256i *)(b + i + 32)));
+			acc0 = _mm256_sub_epi8(acc0, eq0);
+			acc1 = _mm256_sub_epi8(acc1, eq1);
+		}
+		sums = _mm256_add_epi64(sums, _mm256_sad_epu8(acc0, zero));
+		sums = _mm256_add_epi64(sums, _mm256_sad_epu8(acc1, zero));
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i *)lanes, sums);
+	return i - (lanes[0] + lanes[1] + lanes[2] + lanes[3]) +
+		   sse2_count_diff(a + i, b + i, n - i);
+}
+
+#endif // BYTECMP_X86
+
+static const struct bytecmp_engine engines[] = {
+#ifdef BYTECMP_X86
+	{"avx2", avx2_first_diff, avx2_count_diff},
+	{"sse2", sse2_first_diff, sse2_count_diff},
+#endif
+	{"scalar", scalar_first_diff, scalar_count_diff},
+};
+
+#define NENGINES (sizeof(engines) / sizeof(engines[0]))
+
+static bool engine_supported(const struct bytecmp_engine *engine) {
+#ifdef BYTECMP_X86
+	if (engine->first_diff == avx2_first_diff)
+		return __builtin_cpu_supports("avx2");
+	if (engine->first_diff == sse2_first_diff)
+		return __builtin_cpu_supports("sse2");
+#endif
+	(void)engine;
+	return true;
+}
+
+/**
+ * The engine to compare with, chosen once
+ * @return [description]
+ */
+const struct bytecmp_engine *bytecmp_engine() {
+	static const struct bytecmp_engine *chosen;
+
+	if (chosen)
+		return chosen;
+
+	const char *forced = getenv("MISHELL_SIMD");
+	for (size_t i = 0; i < NENGINES && !chosen; i++) {
+		if (forced && strcmp(forced, engines[i].name) != 0)
+			continue;
+		if (engine_supported(&engines[i]))
+			chosen = &engines[i];
+	}
+
+	if (!chosen) // unknown or unsupported override
+		chosen = &engines[NENGINES - 1];
+	return chosen;
+}
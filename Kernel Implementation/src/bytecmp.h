@@ -0,0 +1,24 @@
+#ifndef BYTECMP_H
+#define BYTECMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Vectorized comparison of two equally long byte ranges. The widest
+ * implementation the CPU supports (AVX2, then SSE2, then plain C) is picked
+ * on first use; MISHELL_SIMD=avx2|sse2|scalar overrides the choice.
+ */
+struct bytecmp_engine {
+	const char *name;
+	// offset of the first differing byte, n when the ranges are equal
+	size_t (*first_diff)(const unsigned char *a, const unsigned char *b,
+						 size_t n);
+	// number of differing bytes
+	uint64_t (*count_diff)(const unsigned char *a, const unsigned char *b,
+						   size_t n);
+};
+
+const struct bytecmp_engine *bytecmp_engine();
+
+#endif
@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bytecmp.h"
+#include "chunkcmp.h"
+
+// a multiple of the page size; small enough to balance, large enough that
+// the per-chunk overhead does not show
+#define CHUNK_SIZE (8UL << 20)
+
+/*
+ * A worker's share of chunks is the range [lo, hi) packed into one word,
+ * lo in the low half, so the owner taking from the front and a thief
+ * cutting off the back agree through a single compare-and-swap. Chunk
+ * numbers are never handed out twice, so a range can't reappear (no ABA).
+ */
+struct worker {
+	_Alignas(64) _Atomic uint64_t range;
+	struct compare_state *state;
+	int index;
+	pthread_t thread;
+};
+
+struct compare_state {
+	const unsigned char *a, *b;
+	size_t size;
+	const struct bytecmp_engine *engine;
+	bool quick;
+	atomic_bool cancel; // quick mode found a difference
+	_Atomic uint64_t diffs;
+	_Atomic uint64_t first;
+	_Atomic uint64_t compared;
+	struct worker *workers;
+	int nworkers;
+};
+
+static uint64_t pack(uint64_t lo, uint64_t hi) {
+	return lo | hi << 32;
+}
+
+static long take_own(struct worker *w) {
+	uint64_t r = atomic_load(&w->range);
+
+	for (;;) {
+		uint64_t lo = r & 0xffffffff, hi = r >> 32;
+		if (lo >= hi)
+			return -1;
+		if (atomic_compare_exchange_weak(&w->range, &r, pack(lo + 1, hi)))
+			return lo;
+	}
+}
+
+/**
+ * Take the back half of the first non-empty share after our own. The
+ * first stolen chunk is returned, the rest becomes our share.
+ * @param  self [description]
+ * @return      chunk number, -1 when there is no work left anywhere
+ */
+static long steal(struct worker *self) {
+	struct compare_state *state = self->state;
+
+	for (int k = 1; k < state->nworkers; k++) {
+		struct worker *victim =
+			&state->workers[(self->index + k) % state->nworkers];
+		uint64_t r = atomic_load(&victim->range);
+
+		for (;;) {
+			uint64_t lo = r & 0xffffffff, hi = r >> 32;
+			if (lo >= hi)
+				break;
+
+			uint64_t mid = lo + (hi - lo) / 2;
+			if (atomic_compare_exchange_weak(&victim->range, &r,
+											 pack(lo, mid))) {
+				atomic_store(&self->range, pack(mid + 1, hi));
+				return mid;
+			}
+		}
+	}
+	return -1;
+}
+
+static void atomic_min(_Atomic uint64_t *target, uint64_t value) {
+	uint64_t cur = atomic_load(target);
+	while (value < cur && !atomic_compare_exchange_weak(target, &cur, value))
+		;
+}
+
+static void compare_chunk(struct compare_state *state, size_t chunk) {
+	size_t off = chunk * CHUNK_SIZE;
+	size_t n = state->size - off < CHUNK_SIZE ? state->size - off : CHUNK_SIZE;
+	const unsigned char *a = state->a + off, *b = state->b + off;
+
+	// start reading both sides before the first fault blocks on one
+	madvise((void *)a, n, MADV_WILLNEED);
+	madvise((void *)b, n, MADV_WILLNEED);
+
+	size_t i = state->engine->first_diff(a, b, n);
+	if (i == n) {
+		atomic_fetch_add(&state->compared, n);
+		return;
+	}
+
+	atomic_min(&state->first, off + i);
+	if (state->quick) {
+		atomic_fetch_add(&state->compared, i + 1);
+		atomic_fetch_add(&state->diffs, 1);
+		atomic_store(&state->cancel, true);
+		return;
+	}
+	atomic_fetch_add(&state->diffs,
+					 state->engine->count_diff(a + i, b + i, n - i));
+	atomic_fetch_add(&state->compared, n);
+}
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	struct compare_state *state = w->state;
+
+	while (!atomic_load_explicit(&state->cancel, memory_order_relaxed)) {
+		long chunk = take_own(w);
+		if (chunk < 0 && (chunk = steal(w)) < 0)
+			break;
+		compare_chunk(state, chunk);
+	}
+	return NULL;
+}
+
+/**
+ * Compare a and b over size bytes with nthreads threads
+ * @param a        [description]
+ * @param b        [description]
+ * @param size     [description]
+ * @param nthreads [description]
+ * @param quick    stop everything at the first difference any thread sees
+ * @param result   [description]
+ */
+void chunkcmp_run(const unsigned char *a, const unsigned char *b, size_t size,
+				  int nthreads, bool quick, struct chunkcmp_result *result) {
+	struct compare_state state;
+	size_t nchunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	if ((size_t)nthreads > nchunks)
+		nthreads = nchunks ? nchunks : 1;
+
+	memset(&state, 0, sizeof(state));
+	state.a = a;
+	state.b = b;
+	state.size = size;
+	state.engine = bytecmp_engine();
+	state.quick = quick;
+	atomic_init(&state.cancel, false);
+	atomic_init(&state.diffs, 0);
+	atomic_init(&state.first, UINT64_MAX);
+	atomic_init(&state.compared, 0);
+	state.nworkers = nthreads;
+	state.workers = aligned_alloc(64, nthreads * sizeof(struct worker));
+	if (!state.workers) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < nthreads; i++) {
+		struct worker *w = &state.workers[i];
+		atomic_init(&w->range, pack(nchunks * i / nthreads,
+									nchunks * (i + 1) / nthreads));
+		w->state = &state;
+		w->index = i;
+	}
+
+	// the calling thread is worker 0
+	int started = 1;
+	for (; started < nthreads; started++) {
+		struct worker *w = &state.workers[started];
+		if (pthread_create(&w->thread, NULL, worker_main, w) != 0)
+			break; // the others steal its share
+	}
+	worker_main(&state.workers[0]);
+	for (int i = 1; i < started; i++)
+		pthread_join(state.workers[i].thread, NULL);
+
+	result->diffs = atomic_load(&state.diffs);
+	result->first = atomic_load(&state.first);
+	result->compared = atomic_load(&state.compared);
+	free(state.workers);
+}
@@ -0,0 +1,24 @@
+#ifndef CHUNKCMP_H
+#define CHUNKCMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Multi-threaded comparison of two mapped byte ranges for hdiff -b -j.
+ * The range is cut into page-aligned chunks and every worker starts with
+ * an equal contiguous share. A worker that runs out steals the back half
+ * of another worker's remaining share, so a slow chunk (cold pages, a busy
+ * disk) never leaves the other threads idle.
+ */
+struct chunkcmp_result {
+	uint64_t diffs; // differing bytes, only a lower bound with quick
+	uint64_t first; // lowest differing offset found, UINT64_MAX if none
+	uint64_t compared; // bytes of each side read, less than all with quick
+};
+
+void chunkcmp_run(const unsigned char *a, const unsigned char *b, size_t size,
+				  int nthreads, bool quick, struct chunkcmp_result *result);
+
+#endif
@@ -0,0 +1,555 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "delta.h"
+#include "digest.h"
+#include "stream.h"
+#include "util.h"
+
+#define DELTA_MAGIC "HDL1"
+
+enum { OP_END, OP_COPY, OP_INSERT };
+
+// blocks are about a quarter of the square root of old's size, the way
+// rsync balances index size against the granularity of matches
+#define MIN_BLOCK 512
+#define MAX_BLOCK (64UL << 10)
+
+struct block_sig {
+	uint32_t weak;
+	uint32_t next; // next block in the bucket, plus one
+	uint64_t strong;
+};
+
+struct block_index {
+	const unsigned char *old;
+	size_t old_size;
+	size_t block;
+	size_t nblocks;
+	struct block_sig *sigs;
+	uint32_t *heads; // first block of each bucket, plus one
+	unsigned bits;
+	struct digest digest; // of the whole of old
+};
+
+struct delta_writer {
+	FILE *out;
+	uint64_t copy_off, copy_len; // pending copy, merged with the next one
+	uint64_t copied, inserted;
+	size_t ops;
+};
+
+static void write_varint(FILE *out, uint64_t v) {
+	unsigned char buf[VARINT_MAX];
+
+	fwrite(buf, 1, put_varint(buf, v), out);
+}
+
+static bool get_varint(FILE *in, uint64_t *v) {
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = getc(in);
+		if (c == EOF)
+			return false;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static void rolling_init(const unsigned char *p, size_t n, uint32_t *a,
+						 uint32_t *b) {
+	*a = *b = 0;
+	for (size_t i = 0; i < n; i++) {
+		*a += p[i];
+		*b += (uint32_t)(n - i) * p[i];
+	}
+}
+
+static uint32_t weak_sum(uint32_t a, uint32_t b) {
+	return (a & 0xffff) | b << 16;
+}
+
+static uint64_t strong_sum(const unsigned char *p, size_t n) {
+	struct digest_state state;
+	struct digest d;
+
+	digest_init(&state);
+	digest_update(&state, p, n);
+	digest_final(&state, &d);
+	return d.lo;
+}
+
+static uint32_t bucket(const struct block_index *index, uint32_t weak) {
+	return (weak * 0x9e3779b1U) >> (32 - index->bits);
+}
+
+/**
+ * Index every full block of old and digest all of it
+ * @param index [description]
+ */
+static void index_old(struct block_index *index) {
+	struct digest_state whole;
+
+	index->block = MIN_BLOCK;
+	while (index->block < MAX_BLOCK &&
+		   16 * index->block * index->block < index->old_size)
+		index->block *= 2;
+	index->nblocks = index->old_size / index->block;
+
+	index->bits = 1;
+	while ((1UL << index->bits) < 2 * index->nblocks)
+		index->bits++;
+
+	index->sigs = malloc((index->nblocks + 1) * sizeof(*index->sigs));
+	index->heads = calloc(1UL << index->bits, sizeof(*index->heads));
+	if (!index->sigs || !index->heads) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+
+	digest_init(&whole);
+	// walk backwards so that each bucket lists its blocks in file order
+	for (size_t k = index->nblocks; k-- > 0;) {
+		const unsigned char *p = index->old + k * index->block;
+		struct block_sig *sig = &index->sigs[k];
+		uint32_t a, b;
+
+		rolling_init(p, index->block, &a, &b);
+		sig->weak = weak_sum(a, b);
+		sig->strong = strong_sum(p, index->block);
+
+		uint32_t *head = &index->heads[bucket(index, sig->weak)];
+		sig->next = *head;
+		*head = k + 1;
+	}
+	digest_update(&whole, index->old, index->old_size);
+	digest_final(&whole, &index->digest);
+}
+
+/**
+ * A block of old with the window's checksums, preferring the one that
+ * continues the last copy
+ * @param  index  [description]
+ * @param  w      [description]
+ * @param  window [description]
+ * @param  weak   [description]
+ * @return        block number, -1 if none matches
+ */
+static long find_block(const struct block_index *index,
+					   const struct delta_writer *w,
+					   const unsigned char *window, uint32_t weak) {
+	uint64_t strong = 0;
+	bool have_strong = false;
+	long found = -1;
+
+	for (uint32_t k = index->heads[bucket(index, weak)]; k;
+		 k = index->sigs[k - 1].next) {
+		const struct block_sig *sig = &index->sigs[k - 1];
+
+		if (sig->weak != weak)
+			continue;
+		if (!have_strong) {
+			strong = strong_sum(window, index->block);
+			have_strong = true;
+		}
+		if (sig->strong != strong)
+			continue;
+
+		found = k - 1;
+		if (w->copy_len && (k - 1) * index->block == w->copy_off + w->copy_len)
+			break;
+	}
+	return found;
+}
+
+static void flush_copy(struct delta_writer *w) {
+	if (w->copy_len == 0)
+		return;
+	putc(OP_COPY, w->out);
+	write_varint(w->out, w->copy_off);
+	write_varint(w->out, w->copy_len);
+	w->copied += w->copy_len;
+	w->copy_len = 0;
+	w->ops++;
+}
+
+static void emit_copy(struct delta_writer *w, uint64_t off, uint64_t len) {
+	if (w->copy_len && w->copy_off + w->copy_len == off) {
+		w->copy_len += len;
+		return;
+	}
+	flush_copy(w);
+	w->copy_off = off;
+	w->copy_len = len;
+}
+
+static void emit_insert(struct delta_writer *w, const unsigned char *data,
+						size_t len) {
+	if (len == 0)
+		return;
+	flush_copy(w);
+	putc(OP_INSERT, w->out);
+	write_varint(w->out, len);
+	fwrite(data, 1, len, w->out);
+	w->inserted += len;
+	w->ops++;
+}
+
+/**
+ * Slide the window over new and write the operations. The buffer holds
+ * the pending insert, the window and one block of new read ahead, and
+ * the insert is written out whenever the buffer is refilled.
+ * @param index [description]
+ * @param in    [description]
+ * @param w     [description]
+ * @param size  set to the size of new
+ * @param digest set to the digest of new
+ */
+static void scan_new(const struct block_index *index, struct stream *in,
+					 struct delta_writer *w, uint64_t *size,
+					 struct digest *digest) {
+	size_t block = index->block, cap = block + STREAM_BLOCK;
+	unsigned char *buf = malloc(cap);
+	const unsigned char *chunk = NULL;
+	size_t chunk_len = 0, chunk_pos = 0;
+	size_t len = 0, pos = 0, lit = 0; // lit: start of the pending insert
+	bool eof = false, have_weak = false;
+	struct digest_state whole;
+	uint32_t a = 0, b = 0;
+
+	if (!buf) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+
+	digest_init(&whole);
+	*size = 0;
+	for (;;) {
+		if (len - pos < block + 1 && !eof) {
+			emit_insert(w, buf + lit, pos - lit);
+			memmove(buf, buf + pos, len - pos);
+			len -= pos;
+			lit = pos = 0;
+
+			if (chunk_pos == chunk_len) {
+				chunk_len = stream_next(in, &chunk);
+				chunk_pos = 0;
+				digest_update(&whole, chunk, chunk_len);
+				*size += chunk_len;
+				eof = chunk_len == 0;
+			}
+			size_t n = chunk_len - chunk_pos < cap - len ? chunk_len - chunk_pos
+														 : cap - len;
+			memcpy(buf + len, chunk + chunk_pos, n);
+			len += n;
+			chunk_pos += n;
+			continue;
+		}
+		if (len - pos < block || index->nblocks == 0)
+			break;
+
+		if (!have_weak) {
+			rolling_init(buf + pos, block, &a, &b);
+			have_weak = true;
+		}
+
+		long k = find_block(index, w, buf + pos, weak_sum(a, b));
+		if (k >= 0) {
+			emit_insert(w, buf + lit, pos - lit);
+			emit_copy(w, (uint64_t)k * block, block);
+			pos += block;
+			lit = pos;
+			have_weak = false;
+		} else if (pos + block < len) {
+			unsigned char out = buf[pos], next = buf[pos + block];
+			a += next - out;
+			b += a - (uint32_t)block * out;
+			pos++;
+		} else {
+			break;
+		}
+	}
+
+	// the end of new, or nothing to match: the rest is inserted as read
+	emit_insert(w, buf + lit, len - lit);
+	if (chunk)
+		emit_insert(w, chunk + chunk_pos, chunk_len - chunk_pos);
+	while (!eof) {
+		chunk_len = stream_next(in, &chunk);
+		digest_update(&whole, chunk, chunk_len);
+		*size += chunk_len;
+		eof = chunk_len == 0;
+		emit_insert(w, chunk, chunk_len);
+	}
+	flush_copy(w);
+
+	digest_final(&whole, digest);
+	free(buf);
+}
+
+// stdout carries the delta or the patched file, so errors go to stderr
+static const unsigned char *map_old(const char *path, size_t *size,
+									const char *who) {
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "-%s: %s: %s: %s\n", sysname, who, path,
+				strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return NULL;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		fprintf(stderr, "-%s: %s: %s: the old file must be a regular file\n",
+				sysname, who, path);
+		close(fd);
+		return NULL;
+	}
+
+	*size = st.st_size;
+	void *data = *size ? mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0)
+					   : (void *)"";
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "-%s: %s: %s: %s\n", sysname, who, path,
+				strerror(errno));
+		return NULL;
+	}
+	if (*size)
+		madvise(data, *size, MADV_WILLNEED);
+	return data;
+}
+
+static void unmap_old(const unsigned char *data, size_t size) {
+	if (size)
+		munmap((void *)data, size);
+}
+
+/**
+ * Write the delta from old to new on stdout, with a summary on stderr
+ * @param  old_path a regular file
+ * @param  new_path any file, "-" for stdin
+ * @return          [description]
+ */
+int delta_write(const char *old_path, const char *new_path) {
+	struct block_index index = {0};
+	struct delta_writer w = {.out = stdout};
+	struct digest new_digest;
+	uint64_t new_size;
+
+	if (isatty(STDOUT_FILENO)) {
+		printf("-%s: hdiff: not writing a binary delta to a terminal\n",
+			   sysname);
+		return SUCCESS;
+	}
+
+	index.old = map_old(old_path, &index.old_size, "hdiff");
+	if (!index.old)
+		return SUCCESS;
+
+	struct stream *in = stream_open(new_path);
+	if (!in) {
+		unmap_old(index.old, index.old_size);
+		return SUCCESS;
+	}
+
+	index_old(&index);
+
+	fwrite(DELTA_MAGIC, 1, 4, stdout);
+	write_varint(stdout, index.block);
+	write_varint(stdout, index.old_size);
+	fwrite(&index.digest, 1, sizeof(index.digest), stdout);
+
+	scan_new(&index, in, &w, &new_size, &new_digest);
+
+	putc(OP_END, stdout);
+	write_varint(stdout, new_size);
+	fwrite(&new_digest, 1, sizeof(new_digest), stdout);
+	fflush(stdout);
+
+	if (in->error)
+		fprintf(stderr, "-%s: hdiff: %s: %s\n", sysname, new_path,
+				strerror(in->error));
+	else
+		fprintf(stderr,
+				"delta: %" PRIu64 " bytes copied, %" PRIu64
+				" bytes inserted, %zu operations, %zu-byte blocks\n",
+				w.copied, w.inserted, w.ops, index.block);
+
+	stream_close(in);
+	free(index.sigs);
+	free(index.heads);
+	unmap_old(index.old, index.old_size);
+	return SUCCESS;
+}
+
+/**
+ * Apply a delta to the mapped old file
+ * @param  old   [description]
+ * @param  size  [description]
+ * @param  delta [description]
+ * @param  out   [description]
+ * @return       NULL, or what is wrong
+ */
+static const char *apply_delta(const unsigned char *old, size_t size,
+							   FILE *delta, FILE *out) {
+	char magic[4];
+	uint64_t block, old_size, new_size, written = 0;
+	struct digest expect, got;
+	struct digest_state state;
+	unsigned char buf[64 << 10];
+
+	if (fread(magic, 1, 4, delta) != 4 || memcmp(magic, DELTA_MAGIC, 4) != 0 ||
+		!get_varint(delta, &block) || !get_varint(delta, &old_size) ||
+		fread(&expect, 1, sizeof(expect), delta) != sizeof(expect))
+		return "not an hdiff delta";
+
+	digest_init(&state);
+	digest_update(&state, old, size);
+	digest_final(&state, &got);
+	if (old_size != size || memcmp(&got, &expect, sizeof(got)) != 0)
+		return "the delta was made from a different old file";
+
+	digest_init(&state);
+	for (;;) {
+		int op = getc(delta);
+		uint64_t off, len;
+
+		if (op == OP_END)
+			break;
+		if (op == OP_COPY) {
+			if (!get_varint(delta, &off) || !get_varint(delta, &len) ||
+				off > size || len > size - off)
+				return "corrupt delta";
+			fwrite(old + off, 1, len, out);
+			digest_update(&state, old + off, len);
+			written += len;
+		} else if (op == OP_INSERT) {
+			if (!get_varint(delta, &len))
+				return "corrupt delta";
+			while (len > 0) {
+				size_t n = len < sizeof(buf) ? len : sizeof(buf);
+				if (fread(buf, 1, n, delta) != n)
+					return "truncated delta";
+				fwrite(buf, 1, n, out);
+				digest_update(&state, buf, n);
+				written += n;
+				len -= n;
+			}
+		} else {
+			return op == EOF ? "truncated delta" : "corrupt delta";
+		}
+	}
+
+	digest_final(&state, &got);
+	if (!get_varint(delta, &new_size) ||
+		fread(&expect, 1, sizeof(expect), delta) != sizeof(expect))
+		return "truncated delta";
+	if (new_size != written || memcmp(&got, &expect, sizeof(got)) != 0)
+		return "the result does not match the delta";
+	if (fflush(out) == EOF || ferror(out))
+		return strerror(errno);
+	return NULL;
+}
+
+/**
+ * Open a temporary file in the directory of path, to be renamed over it
+ * @param  path [description]
+ * @param  mode of the file to be, used when path doesn't exist yet
+ * @param  tmp  set to its name, to be freed
+ * @return      the file, NULL with errno set
+ */
+static FILE *open_replacement(const char *path, mode_t mode, char **tmp) {
+	struct stat st;
+	int fd;
+
+	*tmp = malloc(strlen(path) + sizeof(".hpatch.XXXXXX"));
+	if (!*tmp)
+		return NULL;
+	sprintf(*tmp, "%s.hpatch.XXXXXX", path);
+	if ((fd = mkstemp(*tmp)) == -1) {
+		free(*tmp);
+		*tmp = NULL;
+		return NULL;
+	}
+
+	// the result keeps the permissions of the file it replaces
+	if (stat(path, &st) == 0)
+		mode = st.st_mode;
+	fchmod(fd, mode & 07777);
+
+	FILE *out = fdopen(fd, "wb");
+	if (!out) {
+		int error = errno;
+		close(fd);
+		unlink(*tmp);
+		free(*tmp);
+		*tmp = NULL;
+		errno = error;
+	}
+	return out;
+}
+
+int hpatch_builtin(struct command_t *command) {
+	if (command->arg_count < 4 || command->arg_count > 5) {
+		printf("Usage: hpatch old delta [new]\n");
+		return SUCCESS;
+	}
+
+	const char *old_path = command->args[1], *delta_path = command->args[2];
+	const char *new_path = command->args[3];
+	char *tmp_path = NULL;
+	struct stat old_st;
+	size_t size;
+
+	const unsigned char *old = map_old(old_path, &size, "hpatch");
+	if (!old)
+		return SUCCESS;
+
+	// old stays mapped while new is written, so new never truncates it
+	mode_t mode = stat(old_path, &old_st) == 0 ? old_st.st_mode : 0644;
+	FILE *delta =
+		strcmp(delta_path, "-") == 0 ? stdin : fopen(delta_path, "rb");
+	FILE *out = !delta    ? NULL
+				: new_path ? open_replacement(new_path, mode, &tmp_path)
+						   : stdout;
+	bool done = false;
+	if (!delta || !out) {
+		fprintf(stderr, "-%s: hpatch: %s: %s\n", sysname,
+				!delta ? delta_path : new_path, strerror(errno));
+	} else {
+		const char *problem = apply_delta(old, size, delta, out);
+		if (problem)
+			fprintf(stderr, "-%s: hpatch: %s\n", sysname, problem);
+		done = !problem;
+	}
+
+	if (delta && delta != stdin)
+		fclose(delta);
+	if (out && out != stdout) {
+		if (fclose(out) == EOF && done) {
+			fprintf(stderr, "-%s: hpatch: %s: %s\n", sysname, new_path,
+					strerror(errno));
+			done = false;
+		}
+		if (done && rename(tmp_path, new_path) == -1) {
+			fprintf(stderr, "-%s: hpatch: %s: %s\n", sysname, new_path,
+					strerror(errno));
+			done = false;
+		}
+		if (!done)
+			unlink(tmp_path);
+	}
+	free(tmp_path);
+	unmap_old(old, size);
+	return SUCCESS;
+}
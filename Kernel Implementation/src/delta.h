@@ -0,0 +1,29 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "shell.h"
+
+/*
+ * Binary deltas for hdiff -d and hpatch, in the manner of rsync. old is
+ * cut into blocks, each indexed by a weak checksum and a strong hash from
+ * digest.h. new is read once as a stream: a window of one block slides
+ * over it, its weak checksum rolled along a byte at a time, and a window
+ * whose checksums match a block of old becomes a copy. The bytes in
+ * between become inserts.
+ *
+ * A delta starts with "HDL1", the block size, the size and digest of old,
+ * followed by operations, all integers in LEB128:
+ *
+ *   1 offset length  copy length bytes of old from offset
+ *   2 length bytes   insert the bytes
+ *   0                end, followed by the size and digest of new
+ *
+ * hpatch old delta [new] checks old against the delta, rebuilds new (on
+ * stdout without a file name) and checks the result. new is written to a
+ * temporary file next to it and renamed into place once it checks out, so
+ * a failed patch leaves it alone and new can be old itself.
+ */
+int delta_write(const char *old_path, const char *new_path);
+int hpatch_builtin(struct command_t *command);
+
+#endif
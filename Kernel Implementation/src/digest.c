@@ -0,0 +1,129 @@
+#include <string.h>
+#include "digest.h"
+
+#define STRIPE 64
+#define STRIPES_PER_BLOCK 16
+
+#define PRIME32_1 0x9e3779b1U
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+
+// stripe s of a block is keyed with words s..s+7, the scramble with 16..23
+static const uint64_t secret[24] = {
+	0x2cb0f69f4abea221, 0x9417034723148989, 0xdd555950609dfe03,
+	0xdbafb150deb12800, 0x7e789b2e6c442cb6, 0xf41e5636c7e4f8c4,
+	0x0959d150f8fba7e4, 0xa97316f13cdb9eea, 0x74cd8258f9520068,
+	0x55c74a62e116868b, 0xd2f4c799a2023cbd, 0xdf98cb79a37b51b9,
+	0x396f5885524f3905, 0xaf1d56386ca3b276, 0xa9ffbe6b5104e85a,
+	0x6bd0c51b9fd533b3, 0x980ce91c50ab4b56, 0x28ac395780fe62c5,
+	0x768912e3a6bcedc7, 0x50b3e8c9332c7c88, 0xce3bbfe520bd47da,
+	0xcba6c8e8e0bb7c4f, 0xbf194db8434a346d, 0x7d8f2a7b60416d7f,
+};
+
+static uint64_t read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static void accumulate(uint64_t acc[8], const unsigned char *p,
+					   const uint64_t *key) {
+	for (int i = 0; i < 8; i++) {
+		uint64_t v = read64(p + 8 * i);
+		uint64_t k = v ^ key[i];
+		acc[i ^ 1] += v;
+		acc[i] += (k & 0xffffffff) * (k >> 32);
+	}
+}
+
+static void scramble(uint64_t acc[8]) {
+	for (int i = 0; i < 8; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= secret[16 + i];
+		acc[i] *= PRIME32_1;
+	}
+}
+
+static void consume(struct digest_state *state, const unsigned char *p,
+					size_t nstripes) {
+	for (size_t s = 0; s < nstripes; s++, p += STRIPE) {
+		accumulate(state->acc, p, secret + state->stripes);
+		if (++state->stripes == STRIPES_PER_BLOCK) {
+			scramble(state->acc);
+			state->stripes = 0;
+		}
+	}
+}
+
+static uint64_t fold64(uint64_t a, uint64_t b) {
+	__uint128_t product = (__uint128_t)a * b;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static uint64_t avalanche(uint64_t h) {
+	h ^= h >> 37;
+	h *= 0x165667919e3779f9ULL;
+	return h ^ h >> 32;
+}
+
+static uint64_t merge(const uint64_t acc[8], const uint64_t *key,
+					  uint64_t start) {
+	uint64_t h = start;
+
+	for (int i = 0; i < 8; i += 2)
+		h += fold64(acc[i] ^ key[i], acc[i + 1] ^ key[i + 1]);
+	return avalanche(h);
+}
+
+void digest_init(struct digest_state *state) {
+	static const uint64_t init[8] = {
+		PRIME32_1, PRIME64_1, PRIME64_2, 0x165667b19e3779f9ULL,
+		0x27d4eb2f165667c5ULL, 0x85ebca77c2b2ae63ULL, 0xc2b2ae3d27d4eb4fULL,
+		0x9e3779b1U,
+	};
+
+	memcpy(state->acc, init, sizeof(init));
+	state->length = 0;
+	state->stripes = 0;
+	state->buffered = 0;
+}
+
+void digest_update(struct digest_state *state, const void *data, size_t size) {
+	const unsigned char *p = data;
+
+	state->length += size;
+	if (state->buffered) {
+		size_t n = STRIPE - state->buffered < size ? STRIPE - state->buffered
+												   : size;
+		memcpy(state->buffer + state->buffered, p, n);
+		state->buffered += n;
+		p += n;
+		size -= n;
+		if (state->buffered < STRIPE)
+			return;
+		consume(state, state->buffer, 1);
+		state->buffered = 0;
+	}
+
+	consume(state, p, size / STRIPE);
+	p += size / STRIPE * STRIPE;
+	size %= STRIPE;
+
+	memcpy(state->buffer, p, size);
+	state->buffered = size;
+}
+
+void digest_final(struct digest_state *state, struct digest *out) {
+	uint64_t acc[8];
+
+	memcpy(acc, state->acc, sizeof(acc));
+	if (state->buffered) {
+		// zero padding is unambiguous because the length is mixed in below
+		unsigned char last[STRIPE] = {0};
+		memcpy(last, state->buffer, state->buffered);
+		accumulate(acc, last, secret + state->stripes);
+	}
+
+	out->lo = merge(acc, secret + 3, state->length * PRIME64_1);
+	out->hi = merge(acc, secret + 11, ~(state->length * PRIME64_2));
+}
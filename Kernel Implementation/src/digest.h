@@ -0,0 +1,31 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 128-bit non-cryptographic content digest for the hdiff cache. The long
+ * input loop follows XXH3: eight 64-bit lanes, each stripe of 64 bytes
+ * adds a 32x32 multiply of the keyed input to one lane and the raw input
+ * to its neighbour, and the lanes are scrambled every 16 stripes. It is
+ * not bit-compatible with XXH3, only built the same way, so it runs at
+ * memory speed and can be fed in pieces.
+ */
+struct digest {
+	uint64_t lo, hi;
+};
+
+struct digest_state {
+	uint64_t acc[8];
+	uint64_t length;
+	size_t stripes; // stripes since the last scramble
+	size_t buffered;
+	unsigned char buffer[64];
+};
+
+void digest_init(struct digest_state *state);
+void digest_update(struct digest_state *state, const void *data, size_t size);
+void digest_final(struct digest_state *state, struct digest *out);
+
+#endif
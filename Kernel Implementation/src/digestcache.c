@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "digestcache.h"
+
+#define CACHE_MAGIC 0x31534749445348ULL // "HSDIGS1"
+#define FILE_SLOTS 16384
+#define RESULT_SLOTS 4096
+#define PROBES 8
+
+// smaller files are compared directly, they would only push the large
+// artifacts out of the cache
+#define DIGEST_MIN_SIZE (1L << 20)
+
+struct cache_header {
+	uint64_t magic;
+	uint32_t file_slots;
+	uint32_t result_slots;
+	unsigned char pad[48];
+};
+
+struct file_entry {
+	uint64_t dev, ino, size, mtime_ns;
+	struct digest digest;
+};
+
+struct result_entry {
+	struct digest a, b; // a <= b, the result does not depend on the order
+	struct binary_result result;
+};
+
+// a slot is free while its sequence number is 0, and being written while
+// it is odd
+struct file_slot {
+	_Atomic uint64_t seq;
+	struct file_entry entry;
+	uint64_t pad;
+};
+
+struct result_slot {
+	_Atomic uint64_t seq;
+	struct result_entry entry;
+	uint64_t pad;
+};
+
+_Static_assert(sizeof(struct file_slot) == 64, "one cache line per slot");
+_Static_assert(sizeof(struct result_slot) == 64, "one cache line per slot");
+
+#define CACHE_SIZE                                                         \
+	(sizeof(struct cache_header) + FILE_SLOTS * sizeof(struct file_slot) + \
+	 RESULT_SLOTS * sizeof(struct result_slot))
+
+static struct {
+	bool opened; // tried to open, successfully or not
+	int fd;
+	struct file_slot *files;
+	struct result_slot *results;
+} cache = {.fd = -1};
+
+/**
+ * Find the cache file, creating the directories on the default path
+ * @param  path [description]
+ * @param  size [description]
+ * @return      false if the cache is turned off or there is no home
+ */
+static bool cache_path(char *path, size_t size) {
+	const char *env = getenv("MISHELL_DIGEST_CACHE");
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	if (env)
+		return *env && snprintf(path, size, "%s", env) < (int)size;
+
+	if (base && *base)
+		snprintf(path, size, "%s", base);
+	else if (home && *home)
+		snprintf(path, size, "%s/.cache", home);
+	else
+		return false;
+	mkdir(path, 0700);
+
+	size_t len = strlen(path);
+	if (snprintf(path + len, size - len, "/mishell") >= (int)(size - len))
+		return false;
+	mkdir(path, 0700);
+
+	len = strlen(path);
+	return snprintf(path + len, size - len, "/digests") < (int)(size - len);
+}
+
+/**
+ * Map the cache, creating or resetting the file when it is not one of ours
+ * @return [description]
+ */
+static bool cache_open() {
+	char path[PATH_MAX];
+	struct cache_header header;
+	struct stat st;
+
+	if (cache.opened)
+		return cache.fd != -1;
+	cache.opened = true;
+
+	if (!cache_path(path, sizeof(path)))
+		return false;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return false;
+
+	flock(fd, LOCK_EX);
+	if (fstat(fd, &st) == -1 || st.st_size != (off_t)CACHE_SIZE ||
+		pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+		header.magic != CACHE_MAGIC || header.file_slots != FILE_SLOTS ||
+		header.result_slots != RESULT_SLOTS) {
+		memset(&header, 0, sizeof(header));
+		header.magic = CACHE_MAGIC;
+		header.file_slots = FILE_SLOTS;
+		header.result_slots = RESULT_SLOTS;
+		if (ftruncate(fd, 0) == -1 || ftruncate(fd, CACHE_SIZE) == -1 ||
+			pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+			flock(fd, LOCK_UN);
+			close(fd);
+			return false;
+		}
+	}
+	flock(fd, LOCK_UN);
+
+	char *map = mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	cache.fd = fd;
+	cache.files = (struct file_slot *)(map + sizeof(struct cache_header));
+	cache.results = (struct result_slot *)(map + sizeof(struct cache_header) +
+										   FILE_SLOTS * sizeof(struct file_slot));
+	return true;
+}
+
+/**
+ * Copy a slot's entry out without taking the lock
+ * @param  seq   [description]
+ * @param  entry [description]
+ * @param  out   [description]
+ * @param  size  [description]
+ * @return       false if the slot is free or keeps being rewritten
+ */
+static bool slot_read(_Atomic uint64_t *seq, const void *entry, void *out,
+					  size_t size) {
+	for (int tries = 0; tries < 64; tries++) {
+		uint64_t before = atomic_load_explicit(seq, memory_order_acquire);
+		if (before == 0)
+			return false;
+		if (before & 1)
+			continue;
+
+		memcpy(out, entry, size);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(seq, memory_order_relaxed) == before)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Overwrite a slot's entry; the caller holds the lock. A slot left odd by
+ * a writer that died is simply written again.
+ * @param seq   [description]
+ * @param entry [description]
+ * @param in    [description]
+ * @param size  [description]
+ */
+static void slot_write(_Atomic uint64_t *seq, void *entry, const void *in,
+					   size_t size) {
+	uint64_t odd = atomic_load_explicit(seq, memory_order_relaxed) | 1;
+
+	atomic_store_explicit(seq, odd, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(entry, in, size);
+	atomic_store_explicit(seq, odd + 1, memory_order_release);
+}
+
+static size_t mix(uint64_t a, uint64_t b) {
+	uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ULL));
+	return h ^ h >> 29;
+}
+
+static bool file_lookup(const struct file_entry *key, struct digest *out) {
+	size_t home = mix(key->dev, key->ino);
+
+	for (size_t i = 0; i < PROBES; i++) {
+		struct file_slot *slot = &cache.files[(home + i) % FILE_SLOTS];
+		struct file_entry entry;
+
+		if (slot_read(&slot->seq, &slot->entry, &entry, sizeof(entry)) &&
+			entry.dev == key->dev && entry.ino == key->ino &&
+			entry.size == key->size && entry.mtime_ns == key->mtime_ns) {
+			*out = entry.digest;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Store an entry in the slot of the same file, else in a free slot, else
+ * over the file's home slot
+ * @param entry [description]
+ */
+static void file_store(const struct file_entry *entry) {
+	size_t home = mix(entry->dev, entry->ino);
+	struct file_slot *target = NULL;
+
+	flock(cache.fd, LOCK_EX);
+	for (size_t i = 0; i < PROBES; i++) {
+		struct file_slot *slot = &cache.files[(home + i) % FILE_SLOTS];
+
+		if (atomic_load(&slot->seq) != 0 && slot->entry.dev == entry->dev &&
+			slot->entry.ino == entry->ino) {
+			target = slot;
+			break;
+		}
+		if (!target && atomic_load(&slot->seq) == 0)
+			target = slot;
+	}
+	if (!target)
+		target = &cache.files[home % FILE_SLOTS];
+
+	slot_write(&target->seq, &target->entry, entry, sizeof(*entry));
+	flock(cache.fd, LOCK_UN);
+}
+
+/**
+ * Whether the cache is on and takes this file
+ * @param  st the file's current stat
+ * @return    [description]
+ */
+bool digestcache_takes(const struct stat *st) {
+	struct timespec now;
+
+	if (!S_ISREG(st->st_mode) || st->st_size < DIGEST_MIN_SIZE)
+		return false;
+
+	// a write in the same clock tick as the last one keeps the mtime, so
+	// files changed within the last second are not trusted to the key
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (st->st_mtim.tv_sec >= now.tv_sec - 1)
+		return false;
+
+	return cache_open();
+}
+
+static void file_key(const struct stat *st, struct file_entry *entry) {
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime_ns = st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+/**
+ * The digest of a file from the cache, without reading the file
+ * @param  st  the file's current stat
+ * @param  out [description]
+ * @return     false if the cache is off, doesn't take the file or doesn't
+ *             have it
+ */
+bool digestcache_lookup(const struct stat *st, struct digest *out) {
+	struct file_entry entry;
+
+	if (!digestcache_takes(st))
+		return false;
+	file_key(st, &entry);
+	return file_lookup(&entry, out);
+}
+
+/**
+ * Remember the digest of a file that was read in full, unless it changed
+ * since st was taken
+ * @param fd     [description]
+ * @param st     its stat from before it was read
+ * @param digest [description]
+ */
+void digestcache_store_file(int fd, const struct stat *st,
+							const struct digest *digest) {
+	struct file_entry entry;
+	struct stat after;
+
+	if (!digestcache_takes(st) || fstat(fd, &after) == -1 ||
+		after.st_size != st->st_size ||
+		after.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+		after.st_mtim.tv_nsec != st->st_mtim.tv_nsec)
+		return;
+
+	file_key(st, &entry);
+	entry.digest = *digest;
+	file_store(&entry);
+}
+
+static void result_key(const struct digest *a, const struct digest *b,
+					   struct result_entry *entry) {
+	bool swap = a->hi > b->hi || (a->hi == b->hi && a->lo > b->lo);
+
+	entry->a = swap ? *b : *a;
+	entry->b = swap ? *a : *b;
+}
+
+static struct result_slot *result_slot(const struct result_entry *key) {
+	return &cache.results[mix(key->a.lo, key->b.lo) % RESULT_SLOTS];
+}
+
+/**
+ * Look up the hdiff -b result of two digests
+ * @param  a   [description]
+ * @param  b   [description]
+ * @param  out [description]
+ * @return     [description]
+ */
+bool digestcache_result(const struct digest *a, const struct digest *b,
+						struct binary_result *out) {
+	struct result_entry key, entry;
+
+	if (!cache_open())
+		return false;
+
+	result_key(a, b, &key);
+	struct result_slot *slot = result_slot(&key);
+	if (!slot_read(&slot->seq, &slot->entry, &entry, sizeof(entry)) ||
+		memcmp(&entry.a, &key.a, sizeof(key.a)) != 0 ||
+		memcmp(&entry.b, &key.b, sizeof(key.b)) != 0)
+		return false;
+
+	*out = entry.result;
+	return true;
+}
+
+void digestcache_store_result(const struct digest *a, const struct digest *b,
+							  const struct binary_result *result) {
+	struct result_entry entry;
+
+	if (!cache_open())
+		return;
+
+	result_key(a, b, &entry);
+	entry.result = *result;
+
+	struct result_slot *slot = result_slot(&entry);
+	flock(cache.fd, LOCK_EX);
+	slot_write(&slot->seq, &slot->entry, &entry, sizeof(entry));
+	flock(cache.fd, LOCK_UN);
+}
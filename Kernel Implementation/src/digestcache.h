@@ -0,0 +1,38 @@
+#ifndef DIGESTCACHE_H
+#define DIGESTCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "digest.h"
+
+/*
+ * On-disk cache for hdiff, shared by every shell of the user. It maps a
+ * file, identified by (dev, inode, size, mtime in ns), to its digest, and
+ * a pair of digests to the result of hdiff -b on them, so comparing the
+ * same unchanged artifacts again reads none of their data. Files are never
+ * read for the cache alone: hdiff looks them up before comparing, and
+ * stores the digests it took while reading both files in full.
+ *
+ * The cache is one fixed-size file mapped MAP_SHARED, by default
+ * $XDG_CACHE_HOME/mishell/digests or ~/.cache/mishell/digests. The path can
+ * be set with MISHELL_DIGEST_CACHE; an empty value turns the cache off.
+ * Writers serialize on flock(2). Readers take no lock: every slot carries
+ * a sequence number that is odd while the slot is being written, and a
+ * reader that sees it change retries.
+ */
+struct binary_result {
+	uint64_t diffs;
+	uint64_t first;
+};
+
+bool digestcache_takes(const struct stat *st);
+bool digestcache_lookup(const struct stat *st, struct digest *out);
+void digestcache_store_file(int fd, const struct stat *st,
+							const struct digest *digest);
+bool digestcache_result(const struct digest *a, const struct digest *b,
+						struct binary_result *out);
+void digestcache_store_result(const struct digest *a, const struct digest *b,
+							  const struct binary_result *result);
+
+#endif
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "du.h"
+#include "pwalk.h"
+#include "shell.h"
+#include "util.h"
+
+// a directory whose walk hasn't finished yet
+struct du_dir {
+	size_t len; // of its path
+	long long bytes;
+	long files;
+};
+
+struct du_item {
+	long long bytes;
+	long files;
+	char *path;
+};
+
+struct inode {
+	dev_t dev;
+	ino_t ino; // 0 for a free slot
+};
+
+struct du {
+	struct pwalker walker;
+	char *path; // of the innermost open directory
+	size_t path_cap;
+	struct du_dir *dirs; // dirs[level] holds the entries of that level
+	int depth, cap;
+	struct inode *seen; // hard linked files counted so far
+	size_t nseen, seen_cap;
+	struct du_item *heap; // the largest directories, smallest first
+	int nheap, heap_cap, top;
+	int max_depth; // below the root, of the directories reported
+};
+
+static size_t inode_hash(dev_t dev, ino_t ino) {
+	uint64_t h = (uint64_t)dev * 0x9e3779b97f4a7c15ULL ^ (uint64_t)ino;
+	h *= 0xff51afd7ed558ccdULL;
+	return h ^ (h >> 32);
+}
+
+/**
+ * Add a file to the set of hard linked files seen
+ * @param  du  [description]
+ * @param  dev [description]
+ * @param  ino [description]
+ * @return     whether it was there already
+ */
+static bool seen_before(struct du *du, dev_t dev, ino_t ino) {
+	if (2 * (du->nseen + 1) > du->seen_cap) {
+		size_t cap = du->seen_cap ? 2 * du->seen_cap : 1024;
+		struct inode *seen = calloc(cap, sizeof(*seen));
+
+		if (!seen) {
+			perror("mindmap");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < du->seen_cap; i++) {
+			struct inode *in = &du->seen[i];
+			if (!in->ino)
+				continue;
+
+			size_t h = inode_hash(in->dev, in->ino) & (cap - 1);
+			while (seen[h].ino)
+				h = (h + 1) & (cap - 1);
+			seen[h] = *in;
+		}
+		free(du->seen);
+		du->seen = seen;
+		du->seen_cap = cap;
+	}
+
+	size_t h = inode_hash(dev, ino) & (du->seen_cap - 1);
+	for (; du->seen[h].ino; h = (h + 1) & (du->seen_cap - 1)) {
+		if (du->seen[h].dev == dev && du->seen[h].ino == ino)
+			return true;
+	}
+	du->seen[h] = (struct inode){dev, ino};
+	du->nseen++;
+	return false;
+}
+
+// bytes the way du -h shows them
+static void format_size(char *buf, size_t size, long long bytes) {
+	static const char units[] = "BKMGTPE";
+	double value = bytes;
+	int unit = 0;
+
+	while (value >= 1024 && units[unit + 1]) {
+		value /= 1024;
+		unit++;
+	}
+	if (unit == 0)
+		snprintf(buf, size, "%lld", bytes);
+	else
+		snprintf(buf, size, value < 9.95 ? "%.1f%c" : "%.0f%c", value,
+				 units[unit]);
+}
+
+static void print_dir(long long bytes, long files, const char *path) {
+	char size[16];
+
+	format_size(size, sizeof(size), bytes);
+	printf("%7s %9ld  %s\n", size, files, path);
+}
+
+static void heap_swap(struct du_item *a, struct du_item *b) {
+	struct du_item t = *a;
+	*a = *b;
+	*b = t;
+}
+
+/**
+ * Keep a finished directory if it's among the top largest so far
+ * @param du [description]
+ * @param d  [description]
+ */
+static void heap_offer(struct du *du, const struct du_dir *d) {
+	struct du_item *heap = du->heap;
+	int i;
+
+	if (du->nheap < du->top) {
+		if (du->nheap == du->heap_cap) {
+			du->heap_cap = du->heap_cap ? 2 * du->heap_cap : 64;
+			du->heap = xrealloc(du->heap, du->heap_cap * sizeof(*heap));
+			heap = du->heap;
+		}
+		i = du->nheap++;
+		heap[i] = (struct du_item){d->bytes, d->files, strdup(du->path)};
+		for (; i > 0 && heap[(i - 1) / 2].bytes > heap[i].bytes;
+			 i = (i - 1) / 2)
+			heap_swap(&heap[i], &heap[(i - 1) / 2]);
+		return;
+	}
+	if (d->bytes <= heap[0].bytes)
+		return;
+
+	free(heap[0].path);
+	heap[0] = (struct du_item){d->bytes, d->files, strdup(du->path)};
+	for (i = 0;;) {
+		int least = i, l = 2 * i + 1, r = l + 1;
+		if (l < du->nheap && heap[l].bytes < heap[least].bytes)
+			least = l;
+		if (r < du->nheap && heap[r].bytes < heap[least].bytes)
+			least = r;
+		if (least == i)
+			break;
+		heap_swap(&heap[i], &heap[least]);
+		i = least;
+	}
+}
+
+// the innermost open directory is done: report it and add it to its parent
+static void close_dir(struct du *du) {
+	struct du_dir *d = &du->dirs[--du->depth];
+
+	du->path[d->len] = '\0';
+	if (du->max_depth && du->depth > du->max_depth) {
+		// only added up
+	} else if (du->top) {
+		heap_offer(du, d);
+	} else {
+		print_dir(d->bytes, d->files, du->path);
+	}
+
+	if (du->depth > 0) {
+		du->dirs[du->depth - 1].bytes += d->bytes;
+		du->dirs[du->depth - 1].files += d->files;
+	}
+}
+
+static void du_visit(struct pwalker *walker, const struct pwalk_entry *entry) {
+	struct du *du = walker->arg;
+
+	while (du->depth > entry->level + 1)
+		close_dir(du);
+
+	const struct pwalk_stat *st = entry->st;
+	long long bytes = st->blocks * 512LL;
+	if (!entry->dir) {
+		if (st->nlink > 1 && seen_before(du, st->dev, st->ino))
+			return;
+		du->dirs[entry->level].bytes += bytes;
+		du->dirs[entry->level].files++;
+		return;
+	}
+
+	size_t len = du->dirs[entry->level].len;
+	size_t name_len = strlen(entry->name);
+	if (len + name_len + 2 > du->path_cap) {
+		du->path_cap = 2 * (len + name_len + 2);
+		du->path = xrealloc(du->path, du->path_cap);
+	}
+	if (len == 0 || du->path[len - 1] != '/')
+		du->path[len++] = '/';
+	memcpy(du->path + len, entry->name, name_len + 1);
+
+	if (du->depth == du->cap) {
+		du->cap *= 2;
+		du->dirs = xrealloc(du->dirs, du->cap * sizeof(*du->dirs));
+	}
+	du->dirs[du->depth++] = (struct du_dir){len + name_len, bytes, 0};
+}
+
+static void du_error(struct pwalker *walker, const struct pwalk_entry *entry,
+					 const char *what) {
+	struct du *du = walker->arg;
+	int error = errno;
+
+	(void)what;
+	if (entry->level == -1) {
+		printf("-%s: mindmap: %s: %s\n", sysname, entry->name,
+			   strerror(error));
+		return;
+	}
+
+	// the entry's directory is still open, its path a prefix of du->path
+	size_t len = du->dirs[entry->level].len;
+	const char *sep = len && du->path[len - 1] == '/' ? "" : "/";
+	printf("-%s: mindmap: %.*s%s%s: %s\n", sysname, (int)len, du->path, sep,
+		   entry->name, strerror(error));
+}
+
+static int item_cmp(const void *a, const void *b) {
+	long long x = ((const struct du_item *)a)->bytes;
+	long long y = ((const struct du_item *)b)->bytes;
+	return (x < y) - (x > y);
+}
+
+long du_tree(const char *root, int top, int depth) {
+	struct du du = {
+		.walker = {.need_stat = true, .visit = du_visit, .error = du_error},
+		.cap = 64,
+		.top = top,
+		.max_depth = depth,
+	};
+	size_t len = strlen(root);
+	struct stat st;
+
+	du.walker.arg = &du;
+	du.path_cap = len + 256;
+	du.path = xrealloc(NULL, du.path_cap);
+	memcpy(du.path, root, len + 1);
+	du.dirs = xrealloc(NULL, du.cap * sizeof(*du.dirs));
+	du.dirs[du.depth++] = (struct du_dir){
+		len,
+		stat(root, &st) == 0 ? st.st_blocks * 512LL : 0,
+		0,
+	};
+
+	long count = pwalk_tree(&du.walker, root);
+	while (du.depth > 0)
+		close_dir(&du);
+
+	if (du.nheap)
+		qsort(du.heap, du.nheap, sizeof(*du.heap), item_cmp);
+	for (int i = 0; i < du.nheap; i++) {
+		print_dir(du.heap[i].bytes, du.heap[i].files, du.heap[i].path);
+		free(du.heap[i].path);
+	}
+	free(du.heap);
+	free(du.seen);
+	free(du.dirs);
+	free(du.path);
+	return count;
+}
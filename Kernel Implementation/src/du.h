@@ -0,0 +1,24 @@
+#ifndef DU_H
+#define DU_H
+
+/*
+ * mindmap --du: where the space went. One walk with pwalk.h adds up the
+ * allocated bytes and the files below every directory, bottom-up as each
+ * directory's walk finishes. Links aren't followed, and a file with several
+ * hard links counts once, found through a set of (dev, ino). Every
+ * directory is printed as it's done, like du, or with top only the top
+ * largest, kept in a heap of that size while walking and printed largest
+ * first at the end.
+ */
+
+/**
+ * Add up the tree below root
+ * @param  root  [description]
+ * @param  top   how many directories to print, 0 for all
+ * @param  depth how far below root to print directories, 0 for all; the
+ *               ones further down still count towards their parents
+ * @return       the number of entries walked
+ */
+long du_tree(const char *root, int top, int depth);
+
+#endif
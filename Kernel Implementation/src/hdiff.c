@@ -0,0 +1,945 @@
+#define _GNU_SOURCE // memrchr
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "bytecmp.h"
+#include "chunkcmp.h"
+#include "delta.h"
+#include "digestcache.h"
+#include "hdiff.h"
+#include "linediff.h"
+#include "stream.h"
+#include "treediff.h"
+#include "timing.h"
+
+// binary files are compared in windows of this size, with read-ahead
+// requested for the next window while the current one is scanned
+#define HDIFF_WINDOW (64UL << 20)
+// the pieces a window is compared in when the files are digested as well,
+// small enough to be digested while still in cache
+#define DIGEST_PIECE (256UL << 10)
+
+// unchanged lines shown around each change by hdiff -a
+#define CONTEXT_LINES 3
+
+// a streamed text diff looks this far ahead on each side for the lines to
+// line up again. A hunk that grows past HUNK_LIMIT is printed before its
+// trailing context is known; patch(1) then takes it to be at the end of the
+// file, but nothing short of whole inputs that differ everywhere gets there.
+#define TEXT_WINDOW (4UL << 20)
+#define HUNK_LIMIT (64UL << 20)
+
+#define NO_NEWLINE "\n\\ No newline at end of file\n"
+
+struct hdiff_options {
+	char mode; // 'a', 'b', 'd' or 'r'
+	bool list_all;
+	bool trust_mtime; // -r: equal size and mtime means equal
+	bool quick; // stop at the first difference
+	int jobs; // threads for -b, 0 when -j was not given
+	const char *paths[2];
+};
+
+struct mapped_file {
+	const char *path;
+	int fd;
+	size_t size;
+	struct timespec mtime;
+	struct stat st;
+	const unsigned char *data; // NULL for an empty file
+};
+
+/**
+ * Map a whole file read-only
+ * @param  file [description]
+ * @param  path [description]
+ * @return      0, or -1 after printing an error
+ */
+static int map_file(struct mapped_file *file, const char *path) {
+	struct stat st;
+
+	file->path = path;
+	file->data = NULL;
+	file->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (file->fd == -1 || fstat(file->fd, &st) == -1) {
+		printf("-%s: hdiff: %s: %s\n", sysname, path, strerror(errno));
+		if (file->fd != -1)
+			close(file->fd);
+		return -1;
+	}
+
+	file->st = st;
+	file->size = st.st_size;
+	file->mtime = st.st_mtim;
+	if (file->size == 0)
+		return 0;
+
+	void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+	if (data == MAP_FAILED) {
+		printf("-%s: hdiff: %s: %s\n", sysname, path, strerror(errno));
+		close(file->fd);
+		return -1;
+	}
+
+	madvise(data, file->size, MADV_SEQUENTIAL);
+	file->data = data;
+	return 0;
+}
+
+static void unmap_file(struct mapped_file *file) {
+	if (file->data)
+		munmap((void *)file->data, file->size);
+	close(file->fd);
+}
+
+static void prefetch_window(struct mapped_file *file, size_t offset) {
+	if (offset >= file->size)
+		return;
+
+	size_t len = file->size - offset < HDIFF_WINDOW ? file->size - offset
+													: HDIFF_WINDOW;
+	madvise((void *)(file->data + offset), len, MADV_WILLNEED);
+}
+
+/**
+ * Print every differing offset in [0, n) with both bytes
+ * @param  engine [description]
+ * @param  a      [description]
+ * @param  b      [description]
+ * @param  n      [description]
+ * @param  base   offset of a and b in the files
+ * @param  first  set to the first differing offset if not yet set
+ * @return        number of differing bytes
+ */
+static uint64_t list_diffs(const struct bytecmp_engine *engine,
+						   const unsigned char *a, const unsigned char *b,
+						   size_t n, uint64_t base, uint64_t *first) {
+	uint64_t count = 0;
+	size_t i = 0;
+
+	while ((i += engine->first_diff(a + i, b + i, n - i)) < n) {
+		if (*first == UINT64_MAX)
+			*first = base + i;
+		printf("%" PRIu64 ": %02x %02x\n", base + i, a[i], b[i]);
+		count++;
+		i++;
+	}
+	return count;
+}
+
+/**
+ * Compare the common part of two mapped files in one thread, window by
+ * window, listing differences on the way if asked to
+ * @param f1      [description]
+ * @param f2      [description]
+ * @param size    bytes both files have
+ * @param options [description]
+ * @param digests digest states fed both files piece by piece while still
+ *                in cache, NULL for none
+ * @param result  [description]
+ */
+static void compare_windows(struct mapped_file *f1, struct mapped_file *f2,
+							size_t size, struct hdiff_options *options,
+							struct digest_state *digests,
+							struct chunkcmp_result *result) {
+	const struct bytecmp_engine *engine = bytecmp_engine();
+	uint64_t diffs = 0, first = UINT64_MAX, compared = size;
+
+	for (size_t off = 0; off < size; off += HDIFF_WINDOW) {
+		size_t n = size - off < HDIFF_WINDOW ? size - off : HDIFF_WINDOW;
+		const unsigned char *a = f1->data + off, *b = f2->data + off;
+
+		prefetch_window(f1, off + HDIFF_WINDOW);
+		prefetch_window(f2, off + HDIFF_WINDOW);
+
+		if (options->list_all) {
+			diffs += list_diffs(engine, a, b, n, off, &first);
+			continue;
+		}
+		for (size_t p = 0; p < n; p += DIGEST_PIECE) {
+			size_t len = n - p < DIGEST_PIECE ? n - p : DIGEST_PIECE;
+
+			if (first == UINT64_MAX) {
+				size_t i = engine->first_diff(a + p, b + p, len);
+				if (i < len) {
+					first = off + p + i;
+					if (options->quick) {
+						diffs = 1;
+						compared = first + 1;
+						goto done;
+					}
+					diffs += engine->count_diff(a + p + i, b + p + i, len - i);
+				}
+			} else {
+				diffs += engine->count_diff(a + p, b + p, len);
+			}
+			if (digests) {
+				digest_update(&digests[0], a + p, len);
+				digest_update(&digests[1], b + p, len);
+			}
+		}
+	}
+
+done:
+	result->diffs = diffs;
+	result->first = first;
+	result->compared = compared;
+}
+
+/**
+ * Print the verdict of a byte comparison
+ * @param options [description]
+ * @param result  [description]
+ */
+static void report_binary(struct hdiff_options *options,
+						  const struct chunkcmp_result *result) {
+	if (result->diffs == 0) {
+		printf("The two files are identical\n");
+	} else if (options->quick) {
+		// with several threads this need not be the lowest offset
+		printf("The two files are different\n");
+		printf("Difference at offset %" PRIu64 " (0x%" PRIx64 ")\n",
+			   result->first, result->first);
+	} else {
+		printf("The two files are different in %" PRIu64 " bytes\n",
+			   result->diffs);
+		printf("First difference at offset %" PRIu64 " (0x%" PRIx64 ")\n",
+			   result->first, result->first);
+	}
+}
+
+/**
+ * Compare two mapped files byte by byte and print the report. The result
+ * comes from the cache when it has both digests and the pair. Otherwise,
+ * when one thread reads both files in full, the digests the cache lacks
+ * are taken on the way, and stored with the result.
+ * @param f1      [description]
+ * @param f2      [description]
+ * @param options [description]
+ * @param digests digests of f1 and f2 as far as known, NULL when the cache
+ *                is skipped
+ * @param known   which of digests the cache had
+ */
+static void compare_binary(struct mapped_file *f1, struct mapped_file *f2,
+						   struct hdiff_options *options,
+						   struct digest *digests, const bool *known) {
+	size_t common = f1->size < f2->size ? f1->size : f2->size;
+	bool both = digests && known[0] && known[1];
+	struct binary_result cached;
+	struct chunkcmp_result result;
+	double elapsed = -1;
+
+	if (both && digestcache_result(&digests[0], &digests[1], &cached)) {
+		result.diffs = cached.diffs;
+		result.first = cached.first;
+	} else {
+		struct digest_state states[2];
+		bool digesting = digests && !both && f1->size == f2->size &&
+						 options->jobs <= 1 && digestcache_takes(&f1->st) &&
+						 digestcache_takes(&f2->st);
+		double start = timing_now();
+
+		if (digesting) {
+			digest_init(&states[0]);
+			digest_init(&states[1]);
+		}
+
+		// listing keeps file order, so it stays on one thread
+		if (options->jobs > 1 && !options->list_all)
+			chunkcmp_run(f1->data, f2->data, common, options->jobs,
+						 options->quick, &result);
+		else
+			compare_windows(f1, f2, common, options,
+							digesting ? states : NULL, &result);
+
+		if (digesting) {
+			digest_final(&states[0], &digests[0]);
+			digest_final(&states[1], &digests[1]);
+			if (!known[0])
+				digestcache_store_file(f1->fd, &f1->st, &digests[0]);
+			if (!known[1])
+				digestcache_store_file(f2->fd, &f2->st, &digests[1]);
+			both = true;
+		}
+		elapsed = timing_now() - start;
+
+		if (f1->size != f2->size) {
+			if (result.first == UINT64_MAX)
+				result.first = common;
+			result.diffs += f1->size > f2->size ? f1->size - f2->size
+												: f2->size - f1->size;
+		}
+
+		if (both) {
+			cached.diffs = result.diffs;
+			cached.first = result.first;
+			digestcache_store_result(&digests[0], &digests[1], &cached);
+		}
+	}
+
+	if (f1->size != f2->size)
+		printf("%s is %zu bytes, %s is %zu bytes\n", f1->path, f1->size,
+			   f2->path, f2->size);
+	report_binary(options, &result);
+
+	// a quick run counts only what it read before stopping
+	if (options->jobs > 0 && elapsed >= 0) {
+		double mb = 2 * result.compared / 1e6;
+
+		printf("Compared %.1f MB in %.3f s with %d threads: %.1f MB/s\n", mb,
+			   elapsed, options->jobs, elapsed > 0 ? mb / elapsed : 0.0);
+	}
+}
+
+static bool stream_failed(struct stream *stream) {
+	if (stream->error)
+		printf("-%s: hdiff: %s: %s\n", sysname, stream->path,
+			   strerror(stream->error));
+	return stream->error != 0;
+}
+
+/**
+ * Compare two streams block by block. Streams are never cached or split
+ * between threads, and a quick run that stops early doesn't know the
+ * sizes.
+ * @param s1      [description]
+ * @param s2      [description]
+ * @param options [description]
+ */
+static void compare_binary_stream(struct stream *s1, struct stream *s2,
+								  struct hdiff_options *options) {
+	const struct bytecmp_engine *engine = bytecmp_engine();
+	struct chunkcmp_result result = {0, UINT64_MAX, 0};
+	uint64_t size1 = 0, size2 = 0;
+	bool stopped = false;
+
+	for (;;) {
+		const unsigned char *a, *b;
+		size_t na = stream_next(s1, &a), nb = stream_next(s2, &b);
+		size_t n = na < nb ? na : nb;
+
+		if (na == 0 && nb == 0)
+			break;
+
+		// both streams are at the same offset until one of them ends
+		if (options->list_all) {
+			result.diffs += list_diffs(engine, a, b, n, size1, &result.first);
+		} else if (n > 0) {
+			size_t i = engine->first_diff(a, b, n);
+			if (i < n) {
+				if (result.first == UINT64_MAX)
+					result.first = size1 + i;
+				if (options->quick) {
+					result.diffs = 1;
+					stopped = true;
+					break;
+				}
+				result.diffs += engine->count_diff(a + i, b + i, n - i);
+			}
+		}
+		size1 += na;
+		size2 += nb;
+
+		if (options->quick && na != nb) {
+			result.first = size1 < size2 ? size1 : size2;
+			result.diffs = 1;
+			stopped = true;
+			break;
+		}
+	}
+
+	if (stream_failed(s1) || stream_failed(s2))
+		return;
+
+	if (!stopped && size1 != size2) {
+		if (result.first == UINT64_MAX)
+			result.first = size1 < size2 ? size1 : size2;
+		result.diffs += size1 > size2 ? size1 - size2 : size2 - size1;
+		printf("%s is %" PRIu64 " bytes, %s is %" PRIu64 " bytes\n", s1->path,
+			   size1, s2->path, size2);
+	}
+	report_binary(options, &result);
+}
+
+static void print_file_header(const char *mark, const char *path,
+							  struct timespec mtime) {
+	char when[64], zone[8];
+	struct tm tm;
+
+	localtime_r(&mtime.tv_sec, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+	strftime(zone, sizeof(zone), "%z", &tm);
+	printf("%s %s\t%s.%09ld %s\n", mark, path, when, mtime.tv_nsec, zone);
+}
+
+/**
+ * Line range of a hunk header: "start,count", just "start" for one line,
+ * and the line before the range with a count of 0 for an empty one
+ * @param start first line, 0-based
+ * @param count [description]
+ */
+static void print_range(size_t start, size_t count) {
+	if (count == 1)
+		printf("%zu", start + 1);
+	else
+		printf("%zu,%zu", count ? start + 1 : start, count);
+}
+
+static void print_lines(char prefix, const struct line_file *file,
+						size_t from, size_t to) {
+	for (size_t i = from; i < to; i++) {
+		size_t len = file->lines[i + 1] - file->lines[i];
+
+		putchar(prefix);
+		fwrite(file->lines[i], 1, len, stdout);
+		if (len == 0 || file->lines[i][len - 1] != '\n')
+			printf(NO_NEWLINE);
+	}
+}
+
+/**
+ * Print the changes as unified diff hunks. Changes closer than twice the
+ * context share a hunk.
+ * @param a        [description]
+ * @param b        [description]
+ * @param changes  [description]
+ * @param nchanges [description]
+ */
+static void print_hunks(const struct line_file *a, const struct line_file *b,
+						const struct line_change *changes, size_t nchanges) {
+	size_t k = 0;
+
+	while (k < nchanges) {
+		size_t last = k;
+		while (last + 1 < nchanges &&
+			   changes[last + 1].x - (changes[last].x + changes[last].nx) <=
+				   2 * CONTEXT_LINES)
+			last++;
+
+		const struct line_change *first = &changes[k], *end = &changes[last];
+		size_t before = first->x < CONTEXT_LINES ? first->x : CONTEXT_LINES;
+		size_t x_end = end->x + end->nx, after = a->nlines - x_end;
+		if (after > CONTEXT_LINES)
+			after = CONTEXT_LINES;
+
+		size_t x0 = first->x - before, y0 = first->y - before;
+		size_t x1 = x_end + after, y1 = end->y + end->ny + after;
+
+		printf("@@ -");
+		print_range(x0, x1 - x0);
+		printf(" +");
+		print_range(y0, y1 - y0);
+		printf(" @@\n");
+
+		print_lines(' ', a, x0, first->x);
+		for (size_t i = k; i <= last; i++) {
+			const struct line_change *c = &changes[i];
+
+			print_lines('-', a, c->x, c->x + c->nx);
+			print_lines('+', b, c->y, c->y + c->ny);
+			print_lines(' ', a, c->x + c->nx,
+						i < last ? changes[i + 1].x : x1);
+		}
+
+		k = last + 1;
+	}
+}
+
+/**
+ * Diff two mapped text files and print unified hunks
+ * @param f1 [description]
+ * @param f2 [description]
+ */
+static void compare_text(struct mapped_file *f1, struct mapped_file *f2) {
+	struct line_file a, b;
+	struct line_change *changes;
+
+	line_file_split(&a, (const char *)f1->data, f1->size);
+	line_file_split(&b, (const char *)f2->data, f2->size);
+
+	size_t nchanges = line_diff(&a, &b, &changes);
+	if (nchanges == 0) {
+		printf("The two text files are identical\n");
+	} else {
+		print_file_header("---", f1->path, f1->mtime);
+		print_file_header("+++", f2->path, f2->mtime);
+		print_hunks(&a, &b, changes, nchanges);
+	}
+
+	free(changes);
+	line_file_free(&a);
+	line_file_free(&b);
+}
+
+/*
+ * A streamed text diff never holds more than a window of each input. Equal
+ * lines are passed one at a time. At a difference both windows are filled
+ * and diffed with line_diff, and the changes are printed up to the last
+ * one that is followed by equal lines inside both windows: past that
+ * point the inputs are known to line up, so the diff restarts there. If no
+ * change qualifies, the two windows are printed as one change. Hunks
+ * are built in memory until enough equal lines follow to close them.
+ */
+
+// one side of a streamed text diff: the lines not diffed yet, starting at
+// a line boundary
+struct line_window {
+	struct stream *in;
+	char *buf; // TEXT_WINDOW bytes
+	size_t start, len;
+	const unsigned char *block; // rest of the last block from the stream
+	size_t block_pos, block_len;
+	bool eof; // the rest of the input is in buf
+};
+
+struct context_line {
+	char *text;
+	size_t len, cap;
+};
+
+struct hunk_writer {
+	struct stream *files[2];
+	bool started; // file headers printed
+	size_t x, y; // lines of each file passed so far
+
+	bool open;
+	size_t x0, y0, nx, ny;
+	char *body;
+	size_t size, cap;
+	size_t trailing; // unchanged lines at the end of the body
+	size_t keep; // body size up to CONTEXT_LINES of them
+
+	// the last unchanged lines, context for the next hunk
+	struct context_line context[CONTEXT_LINES];
+	size_t ncontext, next_context;
+};
+
+static void window_fill(struct line_window *w) {
+	if (w->start > 0) {
+		memmove(w->buf, w->buf + w->start, w->len - w->start);
+		w->len -= w->start;
+		w->start = 0;
+	}
+
+	while (w->len < TEXT_WINDOW && !w->eof) {
+		if (w->block_pos == w->block_len) {
+			w->block_len = stream_next(w->in, &w->block);
+			w->block_pos = 0;
+			if (w->block_len == 0) {
+				w->eof = true;
+				break;
+			}
+		}
+
+		size_t n = w->block_len - w->block_pos;
+		if (n > TEXT_WINDOW - w->len)
+			n = TEXT_WINDOW - w->len;
+		memcpy(w->buf + w->len, w->block + w->block_pos, n);
+		w->len += n;
+		w->block_pos += n;
+	}
+}
+
+/**
+ * The next line of a window, reading more of the input if needed. A line
+ * longer than the window is cut at the window size.
+ * @param  w   [description]
+ * @param  len [description]
+ * @return     NULL at the end of the input
+ */
+static const char *window_line(struct line_window *w, size_t *len) {
+	char *line = w->buf + w->start;
+	char *nl = memchr(line, '\n', w->len - w->start);
+
+	if (!nl && !w->eof) {
+		window_fill(w);
+		line = w->buf;
+		nl = memchr(line, '\n', w->len);
+	}
+	if (w->start == w->len)
+		return NULL;
+
+	*len = nl ? (size_t)(nl + 1 - line) : w->len - w->start;
+	return line;
+}
+
+// end of the last complete line in a window
+static size_t window_cut(struct line_window *w) {
+	if (w->eof)
+		return w->len;
+
+	char *nl = memrchr(w->buf + w->start, '\n', w->len - w->start);
+	return nl ? (size_t)(nl + 1 - w->buf) : w->len;
+}
+
+static void body_line(struct hunk_writer *h, char prefix, const char *line,
+					  size_t len) {
+	size_t need = h->size + 1 + len + sizeof(NO_NEWLINE);
+
+	if (need > h->cap) {
+		h->cap = need > 2 * h->cap ? need : 2 * h->cap;
+		h->body = realloc(h->body, h->cap);
+		if (!h->body) {
+			perror("hdiff");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	h->body[h->size++] = prefix;
+	memcpy(h->body + h->size, line, len);
+	h->size += len;
+	if (len == 0 || line[len - 1] != '\n') {
+		memcpy(h->body + h->size, NO_NEWLINE, sizeof(NO_NEWLINE) - 1);
+		h->size += sizeof(NO_NEWLINE) - 1;
+	}
+}
+
+static void hunk_close(struct hunk_writer *h) {
+	if (!h->open)
+		return;
+
+	if (h->trailing > CONTEXT_LINES) {
+		h->size = h->keep;
+		h->nx -= h->trailing - CONTEXT_LINES;
+		h->ny -= h->trailing - CONTEXT_LINES;
+	}
+
+	if (!h->started) {
+		print_file_header("---", h->files[0]->path, h->files[0]->st.st_mtim);
+		print_file_header("+++", h->files[1]->path, h->files[1]->st.st_mtim);
+		h->started = true;
+	}
+	printf("@@ -");
+	print_range(h->x0, h->nx);
+	printf(" +");
+	print_range(h->y0, h->ny);
+	printf(" @@\n");
+	fwrite(h->body, 1, h->size, stdout);
+
+	h->open = false;
+	h->size = 0;
+}
+
+static void hunk_unchanged(struct hunk_writer *h, const char *line,
+						   size_t len) {
+	if (h->open) {
+		body_line(h, ' ', line, len);
+		h->nx++;
+		h->ny++;
+		if (++h->trailing == CONTEXT_LINES)
+			h->keep = h->size;
+		else if (h->trailing > 2 * CONTEXT_LINES)
+			hunk_close(h);
+	}
+
+	struct context_line *c = &h->context[h->next_context];
+	if (len > c->cap) {
+		c->cap = len;
+		c->text = realloc(c->text, len);
+		if (!c->text) {
+			perror("hdiff");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(c->text, line, len);
+	c->len = len;
+	h->next_context = (h->next_context + 1) % CONTEXT_LINES;
+	if (h->ncontext < CONTEXT_LINES)
+		h->ncontext++;
+
+	h->x++;
+	h->y++;
+}
+
+/**
+ * Add a removed ('-') or added ('+') line, opening a hunk with the
+ * remembered context if none is open
+ * @param h      [description]
+ * @param prefix [description]
+ * @param line   [description]
+ * @param len    [description]
+ */
+static void hunk_changed(struct hunk_writer *h, char prefix, const char *line,
+						 size_t len) {
+	if (!h->open) {
+		h->open = true;
+		h->x0 = h->x - h->ncontext;
+		h->y0 = h->y - h->ncontext;
+		h->nx = h->ny = h->ncontext;
+		for (size_t i = 0; i < h->ncontext; i++) {
+			size_t k = (h->next_context + CONTEXT_LINES - h->ncontext + i) %
+					   CONTEXT_LINES;
+			body_line(h, ' ', h->context[k].text, h->context[k].len);
+		}
+	}
+	h->ncontext = 0;
+	h->trailing = 0;
+
+	body_line(h, prefix, line, len);
+	if (prefix == '-') {
+		h->nx++;
+		h->x++;
+	} else {
+		h->ny++;
+		h->y++;
+	}
+
+	// a hunk may end without context, so a huge one is printed in parts
+	if (h->size > HUNK_LIMIT)
+		hunk_close(h);
+}
+
+static void hunk_lines(struct hunk_writer *h, char prefix,
+					   const struct line_file *file, size_t from, size_t to) {
+	for (size_t i = from; i < to; i++) {
+		size_t len = file->lines[i + 1] - file->lines[i];
+
+		if (prefix == ' ')
+			hunk_unchanged(h, file->lines[i], len);
+		else
+			hunk_changed(h, prefix, file->lines[i], len);
+	}
+}
+
+/**
+ * Diff what the two windows hold and pass the result to the hunks up to
+ * the last point where the inputs line up, dropping it from the windows
+ * @param w [description]
+ * @param h [description]
+ */
+static void diff_windows(struct line_window w[2], struct hunk_writer *h) {
+	struct line_file files[2];
+	struct line_change *changes, all;
+	bool at_end = true;
+
+	for (int i = 0; i < 2; i++) {
+		window_fill(&w[i]);
+		at_end = at_end && w[i].eof;
+		line_file_split(&files[i], w[i].buf, window_cut(&w[i]));
+	}
+
+	struct line_file *a = &files[0], *b = &files[1];
+	size_t nchanges = line_diff(a, b, &changes);
+	size_t x_end = a->nlines, y_end = b->nlines;
+	const struct line_change *list = changes;
+
+	if (!at_end) {
+		// a change that reaches the end of a window may go on past it
+		while (nchanges > 0 &&
+			   (changes[nchanges - 1].x + changes[nchanges - 1].nx ==
+					a->nlines ||
+				changes[nchanges - 1].y + changes[nchanges - 1].ny ==
+					b->nlines))
+			nchanges--;
+
+		if (nchanges > 0) {
+			x_end = changes[nchanges - 1].x + changes[nchanges - 1].nx;
+			y_end = changes[nchanges - 1].y + changes[nchanges - 1].ny;
+		} else {
+			all = (struct line_change){0, a->nlines, 0, b->nlines};
+			list = &all;
+			nchanges = 1;
+		}
+	}
+
+	size_t x = 0;
+	for (size_t k = 0; k < nchanges; k++) {
+		hunk_lines(h, ' ', a, x, list[k].x);
+		hunk_lines(h, '-', a, list[k].x, list[k].x + list[k].nx);
+		hunk_lines(h, '+', b, list[k].y, list[k].y + list[k].ny);
+		x = list[k].x + list[k].nx;
+	}
+	hunk_lines(h, ' ', a, x, x_end);
+
+	w[0].start += a->lines[x_end] - a->lines[0];
+	w[1].start += b->lines[y_end] - b->lines[0];
+
+	free(changes);
+	line_file_free(&files[0]);
+	line_file_free(&files[1]);
+}
+
+/**
+ * Diff two text streams and print unified hunks, in memory bounded by the
+ * window and hunk sizes
+ * @param s1 [description]
+ * @param s2 [description]
+ */
+static void compare_text_stream(struct stream *s1, struct stream *s2) {
+	struct line_window w[2] = {{.in = s1}, {.in = s2}};
+	struct hunk_writer h = {.files = {s1, s2}};
+
+	for (int i = 0; i < 2; i++) {
+		w[i].buf = malloc(TEXT_WINDOW);
+		if (!w[i].buf) {
+			perror("hdiff");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (;;) {
+		size_t la = 0, lb = 0;
+		const char *a = window_line(&w[0], &la);
+		const char *b = window_line(&w[1], &lb);
+
+		if (!a && !b)
+			break;
+		if (a && b && la == lb && memcmp(a, b, la) == 0) {
+			hunk_unchanged(&h, a, la);
+			w[0].start += la;
+			w[1].start += lb;
+		} else {
+			diff_windows(w, &h);
+		}
+	}
+	hunk_close(&h);
+
+	if (!stream_failed(s1) && !stream_failed(s2) && !h.started)
+		printf("The two text files are identical\n");
+
+	for (int i = 0; i < 2; i++)
+		free(w[i].buf);
+	for (int i = 0; i < CONTEXT_LINES; i++)
+		free(h.context[i].text);
+	free(h.body);
+}
+
+/**
+ * Parse the mode flag, options and the two file names
+ * @param  command [description]
+ * @param  options [description]
+ * @return         false after printing the usage
+ */
+static bool parse_options(struct command_t *command,
+						  struct hdiff_options *options) {
+	int npaths = 0;
+
+	memset(options, 0, sizeof(*options));
+	for (int i = 1; command->args[i]; i++) {
+		const char *arg = command->args[i];
+
+		if (strcmp(arg, "-a") == 0 || strcmp(arg, "-b") == 0 ||
+			strcmp(arg, "-d") == 0 || strcmp(arg, "-r") == 0) {
+			options->mode = arg[1];
+		} else if (strcmp(arg, "-m") == 0) {
+			options->trust_mtime = true;
+		} else if (strcmp(arg, "-l") == 0) {
+			options->list_all = true;
+		} else if (strcmp(arg, "-q") == 0) {
+			options->quick = true;
+		} else if (strncmp(arg, "-j", 2) == 0) {
+			const char *value = arg[2] ? arg + 2 : command->args[++i];
+			char *end;
+
+			if (value)
+				options->jobs = strtol(value, &end, 10);
+			if (!value || *end != '\0' || options->jobs <= 0) {
+				printf("-%s: hdiff: -j: expected a positive number\n", sysname);
+				return false;
+			}
+		} else if (arg[0] == '-' && arg[1] != '\0') {
+			printf("Invalid option: %s\n", arg);
+			return false;
+		} else if (npaths < 2) {
+			options->paths[npaths++] = arg;
+		} else {
+			npaths++;
+		}
+	}
+
+	if (options->mode == 0 || npaths != 2) {
+		printf("Usage: hdiff [-a | -b [-l] [-q] [-j N]] file1 file2\n"
+			   "       hdiff -d old new > delta\n"
+			   "       hdiff -r [-m] [-j N] dir1 dir2\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * hdiff with stdin or a pipe on either side. Regular files on the other
+ * side are streamed too, so both advance block by block together.
+ * @param  options [description]
+ * @return         [description]
+ */
+static int hdiff_streams(struct hdiff_options *options) {
+	struct stream *s1, *s2;
+
+	if (strcmp(options->paths[0], "-") == 0 &&
+		strcmp(options->paths[1], "-") == 0) {
+		printf("-%s: hdiff: only one input can be stdin\n", sysname);
+		return SUCCESS;
+	}
+
+	if (!(s1 = stream_open(options->paths[0])))
+		return SUCCESS;
+	if (!(s2 = stream_open(options->paths[1]))) {
+		stream_close(s1);
+		return SUCCESS;
+	}
+
+	if (options->mode == 'a')
+		compare_text_stream(s1, s2);
+	else
+		compare_binary_stream(s1, s2, options);
+
+	stream_close(s1);
+	stream_close(s2);
+	return SUCCESS;
+}
+
+int hdiff_builtin(struct command_t *command) {
+	struct hdiff_options options;
+	struct mapped_file f1, f2;
+	struct digest digests[2];
+
+	if (!parse_options(command, &options))
+		return SUCCESS;
+
+	if (options.mode == 'd')
+		return delta_write(options.paths[0], options.paths[1]);
+
+	if (options.mode == 'r') {
+		treediff(options.paths[0], options.paths[1], options.trust_mtime,
+				 options.jobs);
+		return SUCCESS;
+	}
+
+	if (stream_wanted(options.paths[0]) || stream_wanted(options.paths[1]))
+		return hdiff_streams(&options);
+
+	if (map_file(&f1, options.paths[0]) == -1)
+		return SUCCESS;
+	if (map_file(&f2, options.paths[1]) == -1) {
+		unmap_file(&f1);
+		return SUCCESS;
+	}
+
+	// -l has to read everything anyway, and -q is only after the first
+	// difference, so both skip the cache
+	bool use_cache = !options.list_all && !options.quick;
+	bool known[2] = {
+		use_cache && digestcache_lookup(&f1.st, &digests[0]),
+		use_cache && digestcache_lookup(&f2.st, &digests[1]),
+	};
+
+	if (known[0] && known[1] &&
+		memcmp(&digests[0], &digests[1], sizeof(digests[0])) == 0)
+		printf(options.mode == 'a' ? "The two text files are identical\n"
+								   : "The two files are identical\n");
+	else if (options.mode == 'a')
+		compare_text(&f1, &f2);
+	else
+		compare_binary(&f1, &f2, &options, use_cache ? digests : NULL, known);
+
+	unmap_file(&f1);
+	unmap_file(&f2);
+	return SUCCESS;
+}
@@ -0,0 +1,39 @@
+#ifndef HDIFF_H
+#define HDIFF_H
+
+#include "shell.h"
+
+/*
+ * hdiff -a file1 file2                   compare text files line by line
+ * hdiff -b [-l] [-q] [-j N] file1 file2  compare binary files byte by byte
+ * hdiff -d old new > delta               write a binary delta for hpatch
+ * hdiff -r [-m] [-j N] dir1 dir2         compare directory trees
+ *
+ * Text files are diffed with linediff.h and printed as unified hunks with
+ * three lines of context.
+ *
+ * Binary files are memory-mapped and compared with the vectorized engine
+ * from bytecmp.h. The report gives the number of differing bytes (bytes
+ * past the end of the shorter file count as different) and the offset of
+ * the first one; -l lists every differing offset with both byte values.
+ * -q stops at the first difference. -j N compares with N threads through
+ * chunkcmp.h and reports the aggregate throughput.
+ *
+ * Digests of large files and the results of comparing them are kept in
+ * the cache from digestcache.h, so asking again about the same unchanged
+ * files reads none of their data.
+ *
+ * A file name of "-" reads stdin. When either input is stdin, a pipe or
+ * another file that can't be mapped, both are read as streams through
+ * stream.h in fixed-size blocks, and memory stays bounded whatever the
+ * input size: -b compares block by block, -a diffs lookahead windows
+ * (see compare_text_stream).
+ *
+ * -d writes a copy/insert delta from old to new, see delta.h.
+ *
+ * -r lists the files added, removed and changed between two trees, see
+ * treediff.h; -m trusts equal sizes and mtimes, -j sets the threads.
+ */
+int hdiff_builtin(struct command_t *command);
+
+#endif
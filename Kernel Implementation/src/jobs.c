@@ -0,0 +1,631 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "jobs.h"
+#include "launch.h"
+#include "timing.h"
+#include "util.h"
+
+#define PID_TABLE_INITIAL 64
+
+int shell_terminal = -1;
+static pid_t shell_pgid;
+
+// job id -> job, ids start at 1
+static struct job **jobs;
+static int jobs_capacity;
+static int max_id;
+
+// pid -> process, open addressing with linear probing
+static struct process **pids;
+static size_t pids_capacity;
+static size_t pids_used; // live entries plus tombstones
+static size_t pids_live;
+static struct process tombstone;
+
+// background jobs that finished and have not been reported yet
+static struct job *done_jobs;
+static volatile int running_procs;
+
+static sigset_t launch_mask; // signal mask from before job_create()
+static volatile sig_atomic_t wait_interrupted; // ^C during the wait builtin
+
+static size_t pid_slot(pid_t pid) {
+	return ((size_t)pid * 2654435761u) & (pids_capacity - 1);
+}
+
+static struct process *pid_find(pid_t pid) {
+	for (size_t i = pid_slot(pid);; i = (i + 1) & (pids_capacity - 1)) {
+		if (pids[i] == NULL)
+			return NULL;
+		if (pids[i] != &tombstone && pids[i]->pid == pid)
+			return pids[i];
+	}
+}
+
+static void pid_insert(struct process *p);
+
+static void pid_rehash(size_t capacity) {
+	struct process **old = pids;
+	size_t old_capacity = pids_capacity;
+
+	pids = xcalloc(capacity, sizeof(struct process *));
+	pids_capacity = capacity;
+	pids_used = pids_live = 0;
+
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old[i] && old[i] != &tombstone)
+			pid_insert(old[i]);
+	}
+	free(old);
+}
+
+static void pid_insert(struct process *p) {
+	// mostly tombstones: rehash in place instead of growing
+	if ((pids_used + 1) * 2 > pids_capacity)
+		pid_rehash((pids_live + 1) * 4 > pids_capacity ? pids_capacity * 2
+														: pids_capacity);
+
+	size_t i = pid_slot(p->pid);
+	while (pids[i] && pids[i] != &tombstone)
+		i = (i + 1) & (pids_capacity - 1);
+	if (pids[i] == NULL)
+		pids_used++;
+	pids_live++;
+	pids[i] = p;
+}
+
+static void pid_remove(struct process *p) {
+	for (size_t i = pid_slot(p->pid); pids[i];
+		 i = (i + 1) & (pids_capacity - 1)) {
+		if (pids[i] == p) {
+			pids[i] = &tombstone;
+			pids_live--;
+			return;
+		}
+	}
+}
+
+bool job_finished(struct job *job) {
+	return job->count[PROC_RUNNING] == 0 && job->count[PROC_STOPPED] == 0;
+}
+
+static void set_state(struct process *p, enum proc_state state) {
+	struct job *job = p->job;
+
+	if (p->state == state)
+		return;
+
+	running_procs += (state == PROC_RUNNING) - (p->state == PROC_RUNNING);
+	job->count[p->state]--;
+	job->count[state]++;
+	p->state = state;
+
+	if (job->background && job_finished(job)) {
+		job->next_done = done_jobs;
+		done_jobs = job;
+	}
+}
+
+/**
+ * Reap every child that changed state and record it in the table. Only
+ * async-signal-safe calls and table lookups happen here; the main program
+ * changes the table with SIGCHLD blocked.
+ * @param sig [description]
+ */
+static void sigchld_handler(int sig) {
+	int saved_errno = errno, status;
+	struct rusage usage;
+	pid_t pid;
+
+	(void)sig;
+	while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED,
+						&usage)) > 0) {
+		struct process *p = pid_find(pid);
+		if (!p)
+			continue;
+
+		if (WIFCONTINUED(status)) {
+			set_state(p, PROC_RUNNING);
+		} else if (WIFSTOPPED(status)) {
+			p->status = status;
+			set_state(p, PROC_STOPPED);
+		} else {
+			p->status = status;
+			p->usage = usage;
+			p->ended = timing_now();
+			set_state(p, PROC_DONE);
+		}
+	}
+
+	errno = saved_errno;
+}
+
+/**
+ * Install the SIGCHLD handler. An interactive shell also leads its own
+ * process group, owns the terminal, and ignores the job control signals
+ * meant for foreground jobs. Without job control, pipelines stay in the
+ * shell's process group so that a ^C from the terminal still reaches them
+ * when running a script.
+ * @param interactive [description]
+ */
+void jobs_init(bool interactive) {
+	struct sigaction sa;
+
+	pids_capacity = PID_TABLE_INITIAL;
+	pids = xcalloc(pids_capacity, sizeof(struct process *));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld_handler;
+	sa.sa_flags = SA_RESTART;
+	if (!interactive)
+		sa.sa_flags |= SA_NOCLDSTOP; // nothing can be stopped from a tty
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	if (!interactive)
+		return;
+
+	launch_ignore_signals();
+
+	shell_pgid = getpid();
+	if (getpgrp() != shell_pgid && setpgid(0, shell_pgid) == -1)
+		shell_pgid = getpgrp(); // session leader, already leads a group
+
+	if (tcsetpgrp(STDIN_FILENO, shell_pgid) == 0)
+		shell_terminal = STDIN_FILENO;
+}
+
+/**
+ * Give a forked builtin a job table of its own. The copy of the shell's
+ * jobs it inherits aren't its children, while the jobs it starts itself
+ * (parallel's) have to be reaped by its own SIGCHLD handler. It has no
+ * job control.
+ */
+void jobs_init_child() {
+	if (jobs)
+		memset(jobs, 0, jobs_capacity * sizeof(struct job *));
+	max_id = 0;
+	done_jobs = NULL;
+	running_procs = 0;
+	shell_terminal = -1;
+	free(pids);
+	jobs_init(false);
+}
+
+static void block_sigchld(sigset_t *old) {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, old);
+}
+
+/**
+ * Text shown by jobs/fg/bg: the stages' arguments joined back together
+ * @param  command [description]
+ * @param  starts  set to the offset of each stage in the text
+ * @return         malloc'ed string
+ */
+static char *command_text(struct command_t *command, int *starts) {
+	size_t len = 1;
+	for (struct command_t *c = command; c; c = c->next) {
+		for (int i = 0; c->args[i]; i++)
+			len += strlen(c->args[i]) + 1;
+		len += 2;
+	}
+
+	char *text = xcalloc(len, 1), *p = text;
+	for (struct command_t *c = command; c; c = c->next) {
+		*starts++ = p - text;
+		for (int i = 0; c->args[i]; i++)
+			p += sprintf(p, "%s%s", i ? " " : "", c->args[i]);
+		if (c->next)
+			p += sprintf(p, " | ");
+	}
+	return text;
+}
+
+/**
+ * Create the job for a pipeline about to be started. Blocks SIGCHLD until
+ * job_launched(), so no child can be reaped before it is in the table.
+ * @param  command first stage of the pipeline
+ * @return         new job, with an id but no processes yet
+ */
+struct job *job_create(struct command_t *command) {
+	int nstages = 0;
+	for (struct command_t *c = command; c; c = c->next)
+		nstages++;
+
+	block_sigchld(&launch_mask);
+
+	struct job *job = xcalloc(1, sizeof(struct job));
+	job->id = max_id + 1;
+	job->pgid = shell_terminal != -1 ? 0 : -1;
+	job->background = command->background;
+	job->timed = command->timed;
+	job->nstages = nstages;
+	job->stage_starts = xcalloc(nstages, sizeof(int));
+	job->command = command_text(command, job->stage_starts);
+	job->procs = xcalloc(nstages, sizeof(struct process));
+
+	if (job->id >= jobs_capacity) {
+		int capacity = jobs_capacity ? jobs_capacity * 2 : 16;
+		struct job **table = realloc(jobs, capacity * sizeof(struct job *));
+		if (!table) {
+			perror("jobs");
+			exit(EXIT_FAILURE);
+		}
+		memset(table + jobs_capacity, 0,
+			   (capacity - jobs_capacity) * sizeof(struct job *));
+		jobs = table;
+		jobs_capacity = capacity;
+	}
+	jobs[job->id] = job;
+	max_id = job->id;
+
+	return job;
+}
+
+/**
+ * Record a started child. The first one becomes the process group leader
+ * when the shell does job control.
+ * @param job   [description]
+ * @param stage index of the pipeline stage the child runs
+ * @param pid   [description]
+ */
+void job_add_process(struct job *job, int stage, pid_t pid) {
+	struct process *p = &job->procs[job->nprocs++];
+
+	p->pid = pid;
+	p->stage = stage;
+	p->started = timing_now();
+	p->state = PROC_RUNNING;
+	p->job = job;
+	job->count[PROC_RUNNING]++;
+	running_procs++;
+	pid_insert(p);
+
+	if (job->pgid == 0) {
+		job->pgid = pid;
+		setpgid(pid, pid); // also done by the child, avoids a race
+	}
+}
+
+void job_release(struct job *job) {
+	for (int i = 0; i < job->nprocs; i++) {
+		pid_remove(&job->procs[i]);
+		if (job->procs[i].state == PROC_RUNNING)
+			running_procs--;
+	}
+
+	jobs[job->id] = NULL;
+	while (max_id > 0 && jobs[max_id] == NULL)
+		max_id--;
+
+	free(job->procs);
+	free(job->stage_starts);
+	free(job->command);
+	free(job);
+}
+
+static const char *state_text(struct job *job, char *buf, size_t size) {
+	if (job->count[PROC_RUNNING])
+		return "Running";
+	if (job->count[PROC_STOPPED])
+		return "Stopped";
+
+	// a pipeline's status is the status of its last stage
+	int status = job->procs[job->nprocs - 1].status;
+	if (WIFSIGNALED(status))
+		return strsignal(WTERMSIG(status));
+	if (WEXITSTATUS(status) == 0)
+		return "Done";
+	snprintf(buf, size, "Exit %d", WEXITSTATUS(status));
+	return buf;
+}
+
+static void print_job(struct job *job, bool with_pids) {
+	char buf[32];
+
+	printf("[%d]%c  ", job->id, job->id == max_id ? '+' : ' ');
+	if (with_pids) {
+		for (int i = 0; i < job->nprocs; i++)
+			printf("%d ", job->procs[i].pid);
+	}
+	printf("%-24s%s\n", state_text(job, buf, sizeof(buf)), job->command);
+}
+
+/**
+ * Report of the time prefix: a row per stage, and the whole pipeline's
+ * wall clock and summed usage when there is more than one
+ * @param job finished job
+ */
+static void print_times(struct job *job) {
+	struct rusage total;
+	double first = 0, last = 0;
+	char label[16];
+
+	memset(&total, 0, sizeof(total));
+	timing_header();
+
+	for (int i = 0; i < job->nprocs; i++) {
+		struct process *p = &job->procs[i];
+		int start = job->stage_starts[p->stage];
+		int end = p->stage + 1 < job->nstages
+					  ? job->stage_starts[p->stage + 1] - 3 // " | "
+					  : (int)strlen(job->command);
+
+		snprintf(label, sizeof(label), "%d", p->stage + 1);
+		timing_row(label, p->ended - p->started, &p->usage, p->status,
+				   job->command + start, end - start);
+
+		timing_add(&total, &p->usage);
+		if (i == 0 || p->started < first)
+			first = p->started;
+		if (p->ended > last)
+			last = p->ended;
+	}
+
+	if (job->nprocs > 1)
+		timing_row("total", last - first, &total,
+				   job->procs[job->nprocs - 1].status, job->command, 0);
+}
+
+/**
+ * Wait until the job is no longer running. Called with SIGCHLD blocked;
+ * sigsuspend lets the handler run and wakes up on each state change.
+ * @param job [description]
+ */
+static void wait_running(struct job *job) {
+	sigset_t wait_mask = launch_mask;
+	sigdelset(&wait_mask, SIGCHLD);
+
+	while (job->count[PROC_RUNNING] > 0 && !wait_interrupted)
+		sigsuspend(&wait_mask);
+}
+
+/**
+ * Run a job in the foreground until it finishes or is stopped
+ * @param job [description]
+ */
+static void wait_foreground(struct job *job) {
+	job->background = false;
+	wait_running(job);
+
+	if (shell_terminal != -1)
+		tcsetpgrp(shell_terminal, shell_pgid);
+
+	if (job->count[PROC_STOPPED] > 0) {
+		job->background = true;
+		printf("\n");
+		print_job(job, false);
+		return;
+	}
+
+	int status = job->procs[job->nprocs - 1].status;
+	if (WIFSIGNALED(status) && WTERMSIG(status) != SIGINT &&
+		WTERMSIG(status) != SIGPIPE)
+		printf("%s\n", strsignal(WTERMSIG(status)));
+
+	if (job->timed) {
+		fflush(stdout);
+		print_times(job);
+	}
+	job_release(job);
+}
+
+/**
+ * Finish starting a job: wait for it if it runs in the foreground, or
+ * announce it if it was started with &. Unblocks SIGCHLD.
+ * @param  job [description]
+ * @return     SUCCESS
+ */
+int job_launched(struct job *job) {
+	if (job->nprocs == 0) {
+		job_release(job);
+	} else if (job->background) {
+		if (shell_terminal != -1)
+			printf("[%d] %d\n", job->id, job->procs[job->nprocs - 1].pid);
+	} else {
+		wait_foreground(job);
+	}
+
+	sigprocmask(SIG_SETMASK, &launch_mask, NULL);
+	return SUCCESS;
+}
+
+/**
+ * Drop finished background jobs from the table, printing them first when
+ * report is set (before an interactive prompt)
+ * @param report [description]
+ */
+void jobs_notify(bool report) {
+	sigset_t old;
+	block_sigchld(&old);
+
+	while (done_jobs) {
+		struct job *job = done_jobs;
+		done_jobs = job->next_done;
+		if (report)
+			print_job(job, false);
+		if (job->timed) {
+			fflush(stdout);
+			print_times(job);
+		}
+		job_release(job);
+	}
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * Resolve a job spec: %N or N for a job id, %% or %+ or nothing for the
+ * most recent job
+ * @param  spec [description]
+ * @param  name builtin name for messages
+ * @return      the job, or NULL after printing an error
+ */
+static struct job *find_job(const char *spec, const char *name) {
+	int id = max_id;
+
+	if (spec && strcmp(spec, "%%") != 0 && strcmp(spec, "%+") != 0) {
+		char *end;
+		id = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+		if (*end != '\0')
+			id = 0;
+	}
+
+	if (id <= 0 || id > max_id || jobs[id] == NULL) {
+		printf("-%s: %s: %s: no such job\n", sysname, name,
+			   spec ? spec : "current");
+		return NULL;
+	}
+	return jobs[id];
+}
+
+static void continue_job(struct job *job) {
+	if (job->pgid > 0) {
+		kill(-job->pgid, SIGCONT);
+	} else {
+		for (int i = 0; i < job->nprocs; i++)
+			if (job->procs[i].state == PROC_STOPPED)
+				kill(job->procs[i].pid, SIGCONT);
+	}
+
+	for (int i = 0; i < job->nprocs; i++) {
+		if (job->procs[i].state == PROC_STOPPED)
+			set_state(&job->procs[i], PROC_RUNNING);
+	}
+}
+
+/**
+ * jobs [-l]: list jobs, with process ids for -l
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int jobs_builtin(struct command_t *command) {
+	bool with_pids = command->args[1] && strcmp(command->args[1], "-l") == 0;
+	sigset_t old;
+
+	block_sigchld(&old);
+	for (int id = 1; id <= max_id; id++) {
+		if (jobs[id] && jobs[id]->background)
+			print_job(jobs[id], with_pids);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	jobs_notify(false); // the Done ones were just shown
+	return SUCCESS;
+}
+
+/**
+ * fg [job]: continue a job in the foreground and wait for it
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int fg_builtin(struct command_t *command) {
+	block_sigchld(&launch_mask);
+
+	struct job *job = find_job(command->args[1], "fg");
+	if (job && job_finished(job)) {
+		printf("-%s: fg: job has terminated\n", sysname);
+		job = NULL;
+	}
+
+	if (job) {
+		printf("%s\n", job->command);
+		fflush(stdout);
+		if (shell_terminal != -1 && job->pgid > 0)
+			tcsetpgrp(shell_terminal, job->pgid);
+		continue_job(job);
+		wait_foreground(job);
+	}
+
+	sigprocmask(SIG_SETMASK, &launch_mask, NULL);
+	return SUCCESS;
+}
+
+/**
+ * bg [job]: continue a stopped job in the background
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int bg_builtin(struct command_t *command) {
+	sigset_t old;
+	block_sigchld(&old);
+
+	struct job *job = find_job(command->args[1], "bg");
+	if (job) {
+		job->background = true;
+		continue_job(job);
+		printf("[%d]+ %s &\n", job->id, job->command);
+	}
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	return SUCCESS;
+}
+
+/**
+ * wait [job | pid]...: wait for the given jobs or processes, or for all
+ * running background jobs
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+static void wait_sigint_handler(int sig) {
+	(void)sig;
+	wait_interrupted = 1;
+}
+
+int wait_builtin(struct command_t *command) {
+	struct sigaction sa, old_sa;
+
+	// the shell ignores ^C, but a wait should still be cancellable by it
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = wait_sigint_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, &old_sa);
+	wait_interrupted = 0;
+
+	block_sigchld(&launch_mask);
+
+	sigset_t wait_mask = launch_mask;
+	sigdelset(&wait_mask, SIGCHLD);
+	sigdelset(&wait_mask, SIGINT);
+
+	if (command->args[1] == NULL) {
+		while (running_procs > 0 && !wait_interrupted)
+			sigsuspend(&wait_mask);
+	}
+
+	for (int i = 1; command->args[i] && !wait_interrupted; i++) {
+		const char *spec = command->args[i];
+
+		if (spec[0] == '%') {
+			struct job *job = find_job(spec, "wait");
+			if (job)
+				wait_running(job);
+			continue;
+		}
+
+		struct process *p = pid_find(atoi(spec));
+		if (!p) {
+			printf("-%s: wait: pid %s is not a child of this shell\n",
+				   sysname, spec);
+			continue;
+		}
+		while (p->state == PROC_RUNNING && !wait_interrupted)
+			sigsuspend(&wait_mask);
+	}
+
+	sigprocmask(SIG_SETMASK, &launch_mask, NULL);
+	sigaction(SIGINT, &old_sa, NULL);
+	if (wait_interrupted)
+		printf("\n");
+	wait_interrupted = 0;
+	return SUCCESS;
+}
@@ -0,0 +1,68 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include "shell.h"
+
+/*
+ * Job table. Every pipeline the shell starts is a job; children are reaped
+ * by the SIGCHLD handler as soon as they change state, so there are no
+ * zombies and no blocking wait() that could pick up an unrelated child.
+ * Jobs are found by id through a direct index and processes by pid
+ * through a hash table, so the cost of reaping and of waiting for the
+ * foreground job does not depend on how many jobs are in the background.
+ *
+ * The table is only modified with SIGCHLD blocked: job_create() blocks it
+ * and job_launched() unblocks it again. Callers that run jobs themselves
+ * keep it blocked, poll job_finished() after each signal and drop the job
+ * with job_release().
+ */
+enum proc_state {
+	PROC_RUNNING,
+	PROC_STOPPED,
+	PROC_DONE,
+};
+
+struct process {
+	pid_t pid;
+	int status; // from wait4, valid once the state is not running
+	enum proc_state state;
+	int stage; // index in the pipeline
+	double started, ended; // timing_now() at spawn and at reaping
+	struct rusage usage; // from wait4, valid once done
+	struct job *job;
+};
+
+struct job {
+	int id;
+	pid_t pgid; // 0 until the first process starts, -1 without job control
+	char *command; // text for jobs/fg/bg
+	bool background;
+	bool timed; // started with the time prefix
+	int count[3]; // processes per proc_state
+	int nprocs; // started so far, at most one per pipeline stage
+	int nstages;
+	int *stage_starts; // offset of each stage's text in command
+	struct process *procs;
+	struct job *next_done; // on the list of finished background jobs
+};
+
+// controlling terminal when the shell does job control, -1 otherwise
+extern int shell_terminal;
+
+void jobs_init(bool interactive);
+void jobs_init_child();
+struct job *job_create(struct command_t *command);
+void job_add_process(struct job *job, int stage, pid_t pid);
+int job_launched(struct job *job);
+bool job_finished(struct job *job);
+void job_release(struct job *job);
+void jobs_notify(bool report);
+
+int jobs_builtin(struct command_t *command);
+int fg_builtin(struct command_t *command);
+int bg_builtin(struct command_t *command);
+int wait_builtin(struct command_t *command);
+
+#endif
@@ -0,0 +1,278 @@
+#define _GNU_SOURCE // posix_spawn_file_actions_addtcsetpgrp_np
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <string.h>
+#include <unistd.h>
+#include "launch.h"
+#include "pathcache.h"
+
+extern char **environ;
+
+static const int redirect_flags[3] = {
+	O_RDONLY, // <
+	O_WRONLY | O_CREAT | O_TRUNC, // >
+	O_WRONLY | O_CREAT | O_APPEND, // >>
+};
+
+/**
+ * Open the command's redirection targets. The descriptors are
+ * close-on-exec; children get them through dup2 onto 0 and 1, so data goes
+ * straight between the program and the file. If both > and >> are given
+ * the later one in redirects[] wins, after both files have been opened.
+ * @param  command [description]
+ * @param  in_fd   set to the < target, or -1
+ * @param  out_fd  set to the > or >> target, or -1
+ * @return         0, or -1 after reporting the target that failed
+ */
+int open_redirects(struct command_t *command, int *in_fd, int *out_fd) {
+	*in_fd = *out_fd = -1;
+
+	for (int i = 0; i < 3; i++) {
+		const char *target = command->redirects[i];
+		if (!target)
+			continue;
+
+		int fd = -1;
+		if (target[0] == '\0')
+			printf("-%s: syntax error near unexpected token `newline'\n",
+				   sysname);
+		else if ((fd = open(target, redirect_flags[i] | O_CLOEXEC, 0666)) ==
+				 -1)
+			printf("-%s: %s: %s\n", sysname, target, strerror(errno));
+
+		if (fd == -1) {
+			close_redirects(*in_fd, *out_fd);
+			*in_fd = *out_fd = -1;
+			return -1;
+		}
+
+		int *slot = i == 0 ? in_fd : out_fd;
+		if (*slot != -1)
+			close(*slot);
+		*slot = fd;
+	}
+
+	return 0;
+}
+
+void close_redirects(int in_fd, int out_fd) {
+	if (in_fd != -1)
+		close(in_fd);
+	if (out_fd != -1)
+		close(out_fd);
+}
+
+/**
+ * Apply a builtin's redirections to the shell itself for the duration of
+ * the builtin, so it runs without a fork. The original descriptors are
+ * parked above 10 and put back by restore_builtin_fds().
+ * @param  command [description]
+ * @param  saved   original stdin/stdout, -1 where not redirected
+ * @return         0, or -1 if a target could not be opened
+ */
+int redirect_builtin(struct command_t *command, int saved[2]) {
+	int fds[2];
+
+	saved[0] = saved[1] = -1;
+	if (open_redirects(command, &fds[0], &fds[1]) == -1)
+		return -1;
+
+	fflush(stdout);
+	for (int i = 0; i < 2; i++) {
+		if (fds[i] == -1)
+			continue;
+		saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+		dup2(fds[i], i);
+		close(fds[i]);
+	}
+	return 0;
+}
+
+void restore_builtin_fds(int saved[2]) {
+	fflush(stdout);
+	for (int i = 0; i < 2; i++) {
+		if (saved[i] == -1)
+			continue;
+		dup2(saved[i], i);
+		close(saved[i]);
+	}
+
+	// drop whatever stdio read ahead from the redirected input
+	if (saved[0] != -1) {
+		__fpurge(stdin);
+		clearerr(stdin);
+	}
+}
+
+/**
+ * Queue the descriptor setup for a child
+ * @param  actions [description]
+ * @param  in_fd   fd to become stdin, -1 to inherit
+ * @param  out_fd  fd to become stdout, -1 to inherit
+ * @return         0 or an errno value
+ */
+static int add_fd_actions(posix_spawn_file_actions_t *actions, int in_fd,
+						  int out_fd) {
+	int r;
+
+	if (in_fd != -1 && in_fd != STDIN_FILENO &&
+		(r = posix_spawn_file_actions_adddup2(actions, in_fd, STDIN_FILENO)))
+		return r;
+
+	if (out_fd != -1 && out_fd != STDOUT_FILENO &&
+		(r = posix_spawn_file_actions_adddup2(actions, out_fd,
+											  STDOUT_FILENO)))
+		return r;
+
+	return 0;
+}
+
+/**
+ * Signals an interactive shell ignores for itself; every child gets them
+ * back at their default disposition.
+ */
+static const int shell_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN,
+									SIGTTOU};
+
+#define NSHELL_SIGNALS (sizeof(shell_signals) / sizeof(shell_signals[0]))
+
+void launch_ignore_signals() {
+	for (size_t i = 0; i < NSHELL_SIGNALS; i++)
+		signal(shell_signals[i], SIG_IGN);
+}
+
+/**
+ * Set up a forked (not spawned) child the way spawn_command sets up its
+ * children: process group, terminal, default signals, empty signal mask.
+ * @param pgid process group to join, 0 to lead a new one, -1 to keep ours
+ * @param tty  terminal to hand to the group, -1 for none
+ */
+void launch_child_setup(pid_t pgid, int tty) {
+	sigset_t none;
+
+	if (pgid != -1) {
+		setpgid(0, pgid);
+		if (tty != -1)
+			tcsetpgrp(tty, getpgrp()); // SIGTTOU is still ignored here
+	}
+
+	for (size_t i = 0; i < NSHELL_SIGNALS; i++)
+		signal(shell_signals[i], SIG_DFL);
+	signal(SIGCHLD, SIG_DFL); // the parent's job table isn't this child's
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+/**
+ * Process group, terminal and signal setup for a spawned child
+ * @param  attr    [description]
+ * @param  actions [description]
+ * @param  pgid    process group to join, 0 to lead a new one, -1 to keep ours
+ * @param  tty     terminal to hand to the group, -1 for none
+ * @return         0 or an errno value
+ */
+static int add_job_attrs(posix_spawnattr_t *attr,
+						 posix_spawn_file_actions_t *actions, pid_t pgid,
+						 int tty) {
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+	sigset_t set;
+	int r;
+
+	sigemptyset(&set);
+	if ((r = posix_spawnattr_setsigmask(attr, &set)))
+		return r;
+	for (size_t i = 0; i < NSHELL_SIGNALS; i++)
+		sigaddset(&set, shell_signals[i]);
+	if ((r = posix_spawnattr_setsigdefault(attr, &set)))
+		return r;
+
+	if (pgid != -1) {
+		flags |= POSIX_SPAWN_SETPGROUP;
+		if ((r = posix_spawnattr_setpgroup(attr, pgid)))
+			return r;
+		// done in the child, before exec, so it never reads the terminal
+		// from the background
+		if (tty != -1 &&
+			(r = posix_spawn_file_actions_addtcsetpgrp_np(actions, tty)))
+			return r;
+	}
+
+	return posix_spawnattr_setflags(attr, flags);
+}
+
+/**
+ * Start an external command without waiting for it. Pipe descriptors
+ * handed in should be close-on-exec so that only the dup2'ed copies
+ * survive in the child. The command's own redirections take precedence
+ * over in_fd/out_fd, as in sh.
+ * @param  command [description]
+ * @param  in_fd   fd to become the child's stdin, -1 to inherit
+ * @param  out_fd  fd to become the child's stdout, -1 to inherit
+ * @param  pgid    process group to join, 0 to lead a new one, -1 to keep ours
+ * @param  tty     terminal to make the group's foreground, -1 for none
+ * @return         pid of the child, -1 if it could not be started
+ */
+pid_t spawn_command(struct command_t *command, int in_fd, int out_fd,
+					pid_t pgid, int tty) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	pid_t pid;
+	int r, redir_in, redir_out;
+
+	fflush(stdout); // keep our own output ahead of the child's
+
+	// names without a '/' go through the PATH cache, the rest run as given
+	bool searched = strchr(command->name, '/') == NULL;
+	const char *path = searched ? path_lookup(command->name) : command->name;
+
+	if (path == NULL) {
+		printf("-%s: %s: command not found\n", sysname, command->name);
+		return -1;
+	}
+
+	if (open_redirects(command, &redir_in, &redir_out) == -1)
+		return -1;
+	if (redir_in != -1)
+		in_fd = redir_in;
+	if (redir_out != -1)
+		out_fd = redir_out;
+
+	if ((r = posix_spawn_file_actions_init(&actions)) != 0)
+		goto out;
+	if ((r = posix_spawnattr_init(&attr)) != 0) {
+		posix_spawn_file_actions_destroy(&actions);
+		goto out;
+	}
+
+	r = add_job_attrs(&attr, &actions, pgid, tty);
+	if (r == 0)
+		r = add_fd_actions(&actions, in_fd, out_fd);
+	if (r == 0) {
+		r = posix_spawn(&pid, path, &actions, &attr, command->args, environ);
+		// the cached binary went away without its directory's mtime
+		// changing (e.g. a bind mount); look it up once more
+		if (r == ENOENT && searched) {
+			path_forget(command->name);
+			path = path_lookup(command->name);
+			if (path)
+				r = posix_spawn(&pid, path, &actions, &attr, command->args,
+								environ);
+		}
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+out:
+	close_redirects(redir_in, redir_out);
+	if (r) {
+		printf("-%s: %s: %s\n", sysname, command->name, strerror(r));
+		return -1;
+	}
+
+	return pid;
+}
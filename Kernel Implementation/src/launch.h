@@ -0,0 +1,23 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+#include "shell.h"
+
+/*
+ * Process launcher. Every external command is started through
+ * posix_spawn, which glibc implements with clone(CLONE_VM|CLONE_VFORK), so
+ * the cost of starting a child does not grow with the shell's heap.
+ * Descriptor setup is expressed as spawn file actions instead of code
+ * running in a forked child.
+ */
+pid_t spawn_command(struct command_t *command, int in_fd, int out_fd,
+					pid_t pgid, int tty);
+int open_redirects(struct command_t *command, int *in_fd, int *out_fd);
+void close_redirects(int in_fd, int out_fd);
+int redirect_builtin(struct command_t *command, int saved[2]);
+void restore_builtin_fds(int saved[2]);
+void launch_ignore_signals();
+void launch_child_setup(pid_t pgid, int tty);
+
+#endif
@@ -0,0 +1,473 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "linediff.h"
+#include "util.h"
+
+// below this many edit steps the search is always exact
+#define MIN_EXPENSIVE 4096
+
+/**
+ * Index the lines of a text. A last line without a newline still counts.
+ * @param  file [description]
+ * @param  data [description]
+ * @param  size [description]
+ * @return      0
+ */
+int line_file_split(struct line_file *file, const char *data, size_t size) {
+	const char *p = data, *end = data + size;
+	size_t n = 0;
+
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		p = nl ? nl + 1 : end;
+		n++;
+	}
+
+	file->data = data;
+	file->size = size;
+	file->nlines = n;
+	file->lines = xrealloc(NULL, (n + 1) * sizeof(const char *));
+
+	p = data;
+	for (size_t i = 0; i < n; i++) {
+		const char *nl = memchr(p, '\n', end - p);
+		file->lines[i] = p;
+		p = nl ? nl + 1 : end;
+	}
+	file->lines[n] = end;
+	return 0;
+}
+
+void line_file_free(struct line_file *file) {
+	free(file->lines);
+	file->lines = NULL;
+}
+
+/*
+ * Interning: lines are compared by content including their newline, so a
+ * final line without one differs from the same text with one. Slots only
+ * hold the id and part of the hash; the text of each id is kept once in
+ * lines[], so the table costs 8 bytes per slot.
+ */
+struct intern_slot {
+	uint32_t id; // UINT32_MAX for an empty slot
+	uint32_t hash; // high half of the line hash
+};
+
+struct interned_line {
+	const char *text;
+	size_t len;
+	uint64_t hash;
+};
+
+struct intern_table {
+	struct intern_slot *slots;
+	size_t mask;
+	struct interned_line *lines; // by id
+	uint32_t count;
+	uint32_t lines_cap;
+};
+
+static uint64_t hash_line(const char *p, size_t len) {
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t w;
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdull;
+		h ^= h >> 32;
+	}
+	if (len) {
+		uint64_t w = 0;
+		memcpy(&w, p, len);
+		h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+	}
+	h ^= h >> 29;
+	return h;
+}
+
+static void intern_init(struct intern_table *table) {
+	table->mask = 1023;
+	table->slots =
+		xrealloc(NULL, (table->mask + 1) * sizeof(struct intern_slot));
+	memset(table->slots, 0xff, (table->mask + 1) * sizeof(struct intern_slot));
+	table->lines_cap = 512;
+	table->lines =
+		xrealloc(NULL, table->lines_cap * sizeof(struct interned_line));
+	table->count = 0;
+}
+
+static void intern_destroy(struct intern_table *table) {
+	free(table->slots);
+	free(table->lines);
+}
+
+static size_t intern_find(struct intern_table *table, uint64_t hash,
+						  const char *text, size_t len) {
+	size_t i = hash & table->mask;
+
+	for (;; i = (i + 1) & table->mask) {
+		struct intern_slot *slot = &table->slots[i];
+
+		if (slot->id == UINT32_MAX)
+			return i;
+		if (slot->hash != (uint32_t)(hash >> 32))
+			continue;
+
+		struct interned_line *line = &table->lines[slot->id];
+		if (line->hash == hash && line->len == len &&
+			memcmp(line->text, text, len) == 0)
+			return i;
+	}
+}
+
+static void intern_grow(struct intern_table *table) {
+	struct intern_slot *old = table->slots;
+	size_t old_size = table->mask + 1;
+
+	table->mask = old_size * 2 - 1;
+	table->slots = xrealloc(NULL, old_size * 2 * sizeof(struct intern_slot));
+	memset(table->slots, 0xff, old_size * 2 * sizeof(struct intern_slot));
+
+	for (size_t i = 0; i < old_size; i++) {
+		if (old[i].id == UINT32_MAX)
+			continue;
+		size_t j = table->lines[old[i].id].hash & table->mask;
+		while (table->slots[j].id != UINT32_MAX)
+			j = (j + 1) & table->mask;
+		table->slots[j] = old[i];
+	}
+	free(old);
+}
+
+static uint32_t intern(struct intern_table *table, const char *text,
+					   size_t len) {
+	uint64_t hash = hash_line(text, len);
+	size_t i = intern_find(table, hash, text, len);
+
+	if (table->slots[i].id != UINT32_MAX)
+		return table->slots[i].id;
+
+	if (table->count == table->lines_cap) {
+		table->lines_cap *= 2;
+		table->lines = xrealloc(
+			table->lines, table->lines_cap * sizeof(struct interned_line));
+	}
+	table->lines[table->count] = (struct interned_line){text, len, hash};
+	table->slots[i].id = table->count;
+	table->slots[i].hash = hash >> 32;
+
+	if (++table->count * 2 > table->mask + 1)
+		intern_grow(table);
+	return table->count - 1;
+}
+
+/*
+ * State of one diff: the id sequences being searched (with lines unique to
+ * one side left out), where each of them sits in its file, and the changed
+ * flags the search fills in.
+ */
+struct diff_context {
+	const uint32_t *xv, *yv;
+	const uint32_t *xmap, *ymap;
+	bool *xchanged, *ychanged;
+	long *fdiag, *bdiag; // indexed by diagonal x - y, may be negative
+	long too_expensive;
+};
+
+struct split {
+	long x, y;
+};
+
+/**
+ * Find where a shortest edit script of x[xoff, xlim) into y[yoff, ylim)
+ * crosses its middle, searching forward from the start and backward from
+ * the end at the same time. Gives up on exactness after too_expensive
+ * steps and takes the diagonal that got furthest instead.
+ * @param ctx  [description]
+ * @param xoff [description]
+ * @param xlim [description]
+ * @param yoff [description]
+ * @param ylim [description]
+ * @return     the split point
+ */
+static struct split find_split(struct diff_context *ctx, long xoff, long xlim,
+							   long yoff, long ylim) {
+	const uint32_t *xv = ctx->xv, *yv = ctx->yv;
+	long *fd = ctx->fdiag, *bd = ctx->bdiag;
+	long dmin = xoff - ylim, dmax = xlim - yoff;
+	long fmid = xoff - yoff, bmid = xlim - ylim;
+	long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+	bool odd = (fmid - bmid) & 1;
+
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+
+	for (long c = 1;; c++) {
+		long d;
+
+		// one more step forward on every diagonal in reach
+		if (fmin > dmin)
+			fd[--fmin - 1] = -1;
+		else
+			fmin++;
+		if (fmax < dmax)
+			fd[++fmax + 1] = -1;
+		else
+			fmax--;
+
+		for (d = fmax; d >= fmin; d -= 2) {
+			long lo = fd[d - 1], hi = fd[d + 1];
+			long x = lo >= hi ? lo + 1 : hi, y = x - d;
+
+			while (x < xlim && y < ylim && xv[x] == yv[y]) {
+				x++;
+				y++;
+			}
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x)
+				return (struct split){x, y};
+		}
+
+		// and one more backward
+		if (bmin > dmin)
+			bd[--bmin - 1] = LONG_MAX;
+		else
+			bmin++;
+		if (bmax < dmax)
+			bd[++bmax + 1] = LONG_MAX;
+		else
+			bmax--;
+
+		for (d = bmax; d >= bmin; d -= 2) {
+			long lo = bd[d - 1], hi = bd[d + 1];
+			long x = lo < hi ? lo : hi - 1, y = x - d;
+
+			while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1]) {
+				x--;
+				y--;
+			}
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d])
+				return (struct split){x, y};
+		}
+
+		if (c < ctx->too_expensive)
+			continue;
+
+		// too costly: split where one of the searches made most progress
+		long fxybest = -1, fxbest = xoff, bxybest = LONG_MAX, bxbest = xlim;
+
+		for (d = fmax; d >= fmin; d -= 2) {
+			long x = fd[d] < xlim ? fd[d] : xlim, y = x - d;
+			if (y > ylim) {
+				x = ylim + d;
+				y = ylim;
+			}
+			if (x + y > fxybest) {
+				fxybest = x + y;
+				fxbest = x;
+			}
+		}
+		for (d = bmax; d >= bmin; d -= 2) {
+			long x = bd[d] > xoff ? bd[d] : xoff, y = x - d;
+			if (y < yoff) {
+				x = yoff + d;
+				y = yoff;
+			}
+			if (x + y < bxybest) {
+				bxybest = x + y;
+				bxbest = x;
+			}
+		}
+
+		if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff))
+			return (struct split){fxbest, fxybest - fxbest};
+		return (struct split){bxbest, bxybest - bxbest};
+	}
+}
+
+/**
+ * Mark the lines of x[xoff, xlim) and y[yoff, ylim) that are not part of
+ * the common subsequence found
+ * @param ctx  [description]
+ * @param xoff [description]
+ * @param xlim [description]
+ * @param yoff [description]
+ * @param ylim [description]
+ */
+static void compare_seq(struct diff_context *ctx, long xoff, long xlim,
+						long yoff, long ylim) {
+	for (;;) {
+		// common prefix and suffix are never part of the edit
+		while (xoff < xlim && yoff < ylim && ctx->xv[xoff] == ctx->yv[yoff]) {
+			xoff++;
+			yoff++;
+		}
+		while (xlim > xoff && ylim > yoff &&
+			   ctx->xv[xlim - 1] == ctx->yv[ylim - 1]) {
+			xlim--;
+			ylim--;
+		}
+
+		if (xoff == xlim) {
+			while (yoff < ylim)
+				ctx->ychanged[ctx->ymap[yoff++]] = true;
+			return;
+		}
+		if (yoff == ylim) {
+			while (xoff < xlim)
+				ctx->xchanged[ctx->xmap[xoff++]] = true;
+			return;
+		}
+
+		struct split s = find_split(ctx, xoff, xlim, yoff, ylim);
+		compare_seq(ctx, xoff, s.x, yoff, s.y);
+		xoff = s.x; // second half without recursing
+		yoff = s.y;
+	}
+}
+
+/**
+ * Keep the lines whose id also occurs on the other side; the rest are
+ * changed no matter what and only slow the search down
+ * @param  ids     ids of every line
+ * @param  n       number of lines
+ * @param  other   occurrences of each id on the other side
+ * @param  changed flags to mark the dropped lines in
+ * @param  kept    set to the ids kept
+ * @param  map     set to the line number of each kept id
+ * @return         number of ids kept
+ */
+static size_t drop_unique(const uint32_t *ids, size_t n, const uint32_t *other,
+						  bool *changed, uint32_t *kept, uint32_t *map) {
+	size_t k = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (other[ids[i]] == 0) {
+			changed[i] = true;
+		} else {
+			kept[k] = ids[i];
+			map[k++] = i;
+		}
+	}
+	return k;
+}
+
+/**
+ * Turn the changed flags into runs of replaced lines
+ * @param  xchanged [description]
+ * @param  nx       [description]
+ * @param  ychanged [description]
+ * @param  ny       [description]
+ * @param  changes  set to a malloc'ed array
+ * @return          number of changes
+ */
+static size_t collect_changes(const bool *xchanged, size_t nx,
+							  const bool *ychanged, size_t ny,
+							  struct line_change **changes) {
+	size_t count = 0, cap = 16, i = 0, j = 0;
+	struct line_change *list = xrealloc(NULL, cap * sizeof(*list));
+
+	while (i < nx || j < ny) {
+		if ((i < nx && xchanged[i]) || (j < ny && ychanged[j])) {
+			struct line_change c = {i, 0, j, 0};
+
+			while (i < nx && xchanged[i])
+				i++;
+			while (j < ny && ychanged[j])
+				j++;
+			c.nx = i - c.x;
+			c.ny = j - c.y;
+
+			if (count == cap) {
+				cap *= 2;
+				list = xrealloc(list, cap * sizeof(*list));
+			}
+			list[count++] = c;
+		} else {
+			i++;
+			j++;
+		}
+	}
+
+	*changes = list;
+	return count;
+}
+
+/**
+ * Diff two split files
+ * @param  a       [description]
+ * @param  b       [description]
+ * @param  changes set to a malloc'ed array, in file order
+ * @return         number of changes, 0 when the files are equal
+ */
+size_t line_diff(const struct line_file *a, const struct line_file *b,
+				 struct line_change **changes) {
+	size_t n = a->nlines, m = b->nlines;
+	struct intern_table table;
+
+	intern_init(&table);
+
+	uint32_t *xids = xrealloc(NULL, n * sizeof(uint32_t));
+	uint32_t *yids = xrealloc(NULL, m * sizeof(uint32_t));
+	for (size_t i = 0; i < n; i++)
+		xids[i] = intern(&table, a->lines[i], a->lines[i + 1] - a->lines[i]);
+	for (size_t j = 0; j < m; j++)
+		yids[j] = intern(&table, b->lines[j], b->lines[j + 1] - b->lines[j]);
+	intern_destroy(&table);
+
+	uint32_t *xcount = xcalloc(table.count, sizeof(uint32_t));
+	uint32_t *ycount = xcalloc(table.count, sizeof(uint32_t));
+	for (size_t i = 0; i < n; i++)
+		xcount[xids[i]]++;
+	for (size_t j = 0; j < m; j++)
+		ycount[yids[j]]++;
+
+	struct diff_context ctx;
+	bool *xchanged = xcalloc(n, sizeof(bool));
+	bool *ychanged = xcalloc(m, sizeof(bool));
+	uint32_t *xv = xrealloc(NULL, n * sizeof(uint32_t));
+	uint32_t *yv = xrealloc(NULL, m * sizeof(uint32_t));
+	uint32_t *xmap = xrealloc(NULL, n * sizeof(uint32_t));
+	uint32_t *ymap = xrealloc(NULL, m * sizeof(uint32_t));
+	size_t nx = drop_unique(xids, n, ycount, xchanged, xv, xmap);
+	size_t ny = drop_unique(yids, m, xcount, ychanged, yv, ymap);
+
+	free(xcount);
+	free(ycount);
+	free(xids);
+	free(yids);
+
+	// diagonals run from -(ny + 1) to nx + 1
+	long *diags = xrealloc(NULL, 2 * (nx + ny + 3) * sizeof(long));
+	ctx.xv = xv;
+	ctx.yv = yv;
+	ctx.xmap = xmap;
+	ctx.ymap = ymap;
+	ctx.xchanged = xchanged;
+	ctx.ychanged = ychanged;
+	ctx.fdiag = diags + ny + 1;
+	ctx.bdiag = diags + (nx + ny + 3) + ny + 1;
+	ctx.too_expensive = 1;
+	for (size_t total = nx + ny + 3; total > 0; total >>= 2)
+		ctx.too_expensive <<= 1; // about the square root of the input
+	if (ctx.too_expensive < MIN_EXPENSIVE)
+		ctx.too_expensive = MIN_EXPENSIVE;
+
+	compare_seq(&ctx, 0, nx, 0, ny);
+
+	free(diags);
+	free(xv);
+	free(yv);
+	free(xmap);
+	free(ymap);
+
+	size_t count = collect_changes(xchanged, n, ychanged, m, changes);
+	free(xchanged);
+	free(ychanged);
+	return count;
+}
@@ -0,0 +1,36 @@
+#ifndef LINEDIFF_H
+#define LINEDIFF_H
+
+#include <stddef.h>
+
+/*
+ * Line diff for hdiff -a. Every line of both files is hashed once and
+ * interned into an integer id, and Myers' O(ND) algorithm in its linear
+ * space form runs over the two id arrays. Lines that occur in only one of
+ * the files can never match and are taken out before the search, and very
+ * expensive searches settle for a good split instead of the optimal one,
+ * so memory stays proportional to the number of lines and time stays
+ * reasonable on large, very different inputs.
+ */
+
+// a text split into lines; line i is [lines[i], lines[i + 1])
+struct line_file {
+	const char *data;
+	size_t size;
+	size_t nlines;
+	const char **lines; // nlines + 1 entries
+};
+
+// lines [x, x + nx) of the first file were replaced by [y, y + ny) of the
+// second
+struct line_change {
+	size_t x, nx;
+	size_t y, ny;
+};
+
+int line_file_split(struct line_file *file, const char *data, size_t size);
+void line_file_free(struct line_file *file);
+size_t line_diff(const struct line_file *a, const struct line_file *b,
+				 struct line_change **changes);
+
+#endif
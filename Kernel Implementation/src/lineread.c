@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lineread.h"
+
+void line_reader_init(struct line_reader *reader, int fd, size_t cap) {
+	reader->fd = fd;
+	reader->cap = cap;
+	reader->start = reader->end = 0;
+	reader->eof = false;
+	reader->buf = malloc(cap);
+	if (!reader->buf) {
+		perror("line reader");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Move the partial line to the front of the buffer, growing the buffer if
+ * a single line already fills it, so there is room behind it.
+ * @param reader [description]
+ */
+static void compact(struct line_reader *reader) {
+	if (reader->start > 0) {
+		memmove(reader->buf, reader->buf + reader->start,
+				reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+
+	if (reader->end == reader->cap) {
+		char *buf = realloc(reader->buf, reader->cap * 2);
+		if (!buf) {
+			perror("line reader");
+			exit(EXIT_FAILURE);
+		}
+		reader->buf = buf;
+		reader->cap *= 2;
+	}
+}
+
+/**
+ * Read the next block behind the partial line
+ * @param  reader [description]
+ * @return        bytes read, 0 at end of input
+ */
+static ssize_t fill(struct line_reader *reader) {
+	ssize_t n;
+
+	compact(reader);
+	do {
+		n = read(reader->fd, reader->buf + reader->end,
+				 reader->cap - reader->end);
+	} while (n == -1 && errno == EINTR);
+
+	if (n <= 0) {
+		if (n == -1)
+			perror("read");
+		reader->eof = true;
+		return 0;
+	}
+
+	reader->end += n;
+	return n;
+}
+
+/**
+ * Return the next line without its newline, or NULL at end of input. A
+ * final line without a trailing newline is still returned.
+ * @param  reader [description]
+ * @return        line inside the reader's buffer
+ */
+char *line_reader_next(struct line_reader *reader) {
+	size_t scanned = 0;
+
+	while (1) {
+		char *line = reader->buf + reader->start;
+		size_t avail = reader->end - reader->start;
+		char *nl = memchr(line + scanned, '\n', avail - scanned);
+
+		if (nl) {
+			*nl = 0;
+			reader->start += nl - line + 1;
+			return line;
+		}
+
+		scanned = avail;
+		if (reader->eof || fill(reader) == 0)
+			break;
+	}
+
+	if (reader->start == reader->end)
+		return NULL;
+
+	// unterminated last line; make room for the NUL if needed
+	if (reader->end == reader->cap)
+		compact(reader);
+
+	char *line = reader->buf + reader->start;
+	reader->buf[reader->end] = 0;
+	reader->start = reader->end;
+	return line;
+}
+
+void line_reader_destroy(struct line_reader *reader) {
+	free(reader->buf);
+	reader->buf = NULL;
+}
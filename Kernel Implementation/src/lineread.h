@@ -0,0 +1,25 @@
+#ifndef LINEREAD_H
+#define LINEREAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Block-buffered line reader for non-interactive input. Lines are handed out
+ * as pointers into the read buffer, NUL-terminated in place, and stay valid
+ * until the next call to line_reader_next().
+ */
+struct line_reader {
+	int fd;
+	char *buf;
+	size_t cap;
+	size_t start; // first unconsumed byte
+	size_t end; // one past the last byte read
+	bool eof;
+};
+
+void line_reader_init(struct line_reader *reader, int fd, size_t cap);
+char *line_reader_next(struct line_reader *reader);
+void line_reader_destroy(struct line_reader *reader);
+
+#endif
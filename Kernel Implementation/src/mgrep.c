@@ -0,0 +1,575 @@
+#define _GNU_SOURCE // memmem, memrchr
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "mgrep.h"
+#include "outbuf.h"
+#include "pwalk.h"
+#include "timing.h"
+#include "treecache.h"
+#include "util.h"
+
+// a NUL among a file's first bytes marks it binary
+#define BINARY_PEEK 8192
+// the paths of the files found are kept in one arena
+#define GREP_ARENA_SIZE (1 << 20)
+
+struct grep_run {
+	const char *pattern;
+	bool fixed; // -F
+	bool line_numbers; // -n
+	char *literal; // every matching line contains it, or NULL
+	size_t literal_len;
+
+	// the files, queued by the walk as it finds them
+	pthread_mutex_t lock;
+	pthread_cond_t more; // a file was queued or the walk is done
+	const char **files;
+	size_t nfiles, cap, next;
+	bool walked;
+	int waiting;
+
+	pthread_mutex_t out_lock;
+	struct out_buffer out;
+};
+
+struct grep_worker {
+	struct grep_run *run;
+	pthread_t thread;
+	regex_t regex; // each thread has its own, regexec locks a shared one
+	unsigned char *buf; // SMALL_FILE bytes
+	char *lines; // the matching lines of the file at hand
+	size_t len, cap;
+	long files, binary, matches;
+};
+
+// turns the walk into paths of files
+struct grep_feed {
+	struct pwalker walker;
+	struct grep_run *run;
+	struct arena arena;
+	char *path; // of the directory entries are in
+	size_t path_cap;
+	size_t *lens; // by level, the length of its directory's path
+	int lens_cap;
+};
+
+// past the bracket expression p starts, on its ']'
+static const char *skip_bracket(const char *p) {
+	const char *q = p + 1;
+
+	if (*q == '^')
+		q++;
+	if (*q == ']')
+		q++;
+	for (; *q && *q != ']'; q++) {
+		if (*q == '[' && (q[1] == ':' || q[1] == '.' || q[1] == '=')) {
+			const char *end = strchr(q + 2, ']');
+			if (!end)
+				break;
+			q = end;
+		}
+	}
+	return *q ? q : q - 1;
+}
+
+/**
+ * Find the longest run of plain characters that every match of an
+ * extended regex contains. Characters that may be left out (before a *, ?
+ * or {), anything in parentheses, and whole patterns with | don't count.
+ * @param  pattern [description]
+ * @param  len     set to its length
+ * @return         the run, NULL if there is none
+ */
+static char *required_literal(const char *pattern, size_t *len) {
+	size_t n = strlen(pattern), best = 0, run_len = 0;
+	char *run = xrealloc(NULL, n + 1), *literal = xrealloc(NULL, n + 1);
+	int depth = 0;
+
+	for (const char *p = pattern;; p++) {
+		char c = *p;
+		bool plain = false;
+
+		switch (c) {
+		case '\0':
+			break;
+		case '\\':
+			// \w, \b and back-references aren't plain
+			plain = p[1] && !isalnum((unsigned char)p[1]);
+			if (p[1])
+				c = *++p;
+			break;
+		case '[':
+			p = skip_bracket(p);
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			depth--;
+			break;
+		case '|':
+			free(run);
+			free(literal);
+			return NULL;
+		case '*':
+		case '?':
+		case '{':
+			if (run_len > 0)
+				run_len--;
+			if (c == '{' && strchr(p, '}'))
+				p = strchr(p, '}');
+			break;
+		case '+':
+		case '.':
+		case '^':
+		case '$':
+			break;
+		default:
+			plain = c != '\n';
+		}
+		if (plain && depth == 0) {
+			run[run_len++] = c;
+			continue;
+		}
+		if (run_len > best) {
+			best = run_len;
+			memcpy(literal, run, best);
+		}
+		run_len = 0;
+		if (*p == '\0')
+			break;
+	}
+	free(run);
+	if (best == 0) {
+		free(literal);
+		return NULL;
+	}
+	*len = best;
+	return literal;
+}
+
+static void queue_file(struct grep_run *run, const char *path) {
+	pthread_mutex_lock(&run->lock);
+	if (run->nfiles == run->cap) {
+		run->cap = run->cap ? 2 * run->cap : 1024;
+		run->files = xrealloc(run->files, run->cap * sizeof(*run->files));
+	}
+	run->files[run->nfiles++] = path;
+	if (run->waiting)
+		pthread_cond_signal(&run->more);
+	pthread_mutex_unlock(&run->lock);
+}
+
+// the next file to search, NULL once the walk is done and all are taken
+static const char *next_file(struct grep_run *run) {
+	const char *path = NULL;
+
+	pthread_mutex_lock(&run->lock);
+	while (run->next == run->nfiles && !run->walked) {
+		run->waiting++;
+		pthread_cond_wait(&run->more, &run->lock);
+		run->waiting--;
+	}
+	if (run->next < run->nfiles)
+		path = run->files[run->next++];
+	pthread_mutex_unlock(&run->lock);
+	return path;
+}
+
+/**
+ * Build the path of an entry in the feed's path buffer
+ * @param  feed  [description]
+ * @param  entry [description]
+ * @return       its length
+ */
+static size_t entry_path(struct grep_feed *feed,
+						 const struct pwalk_entry *entry) {
+	size_t dir_len = feed->lens[entry->level];
+	bool slash = feed->path[dir_len - 1] != '/';
+	size_t name_len = strlen(entry->name);
+	size_t len = dir_len + slash + name_len;
+
+	if (len + 1 > feed->path_cap) {
+		feed->path_cap = 2 * (len + 1);
+		feed->path = xrealloc(feed->path, feed->path_cap);
+	}
+	if (slash)
+		feed->path[dir_len] = '/';
+	memcpy(feed->path + dir_len + slash, entry->name, name_len + 1);
+	return len;
+}
+
+static void feed_visit(struct pwalker *walker,
+					   const struct pwalk_entry *entry) {
+	struct grep_feed *feed = walker->arg;
+	size_t len = entry_path(feed, entry);
+
+	if (!entry->dir) {
+		char *path = arena_alloc(&feed->arena, len + 1);
+		memcpy(path, feed->path, len + 1);
+		queue_file(feed->run, path);
+		return;
+	}
+	// its contents come next
+	if (entry->level + 2 > feed->lens_cap) {
+		feed->lens_cap *= 2;
+		feed->lens =
+			xrealloc(feed->lens, feed->lens_cap * sizeof(*feed->lens));
+	}
+	feed->lens[entry->level + 1] = len;
+}
+
+static void feed_error(struct pwalker *walker, const struct pwalk_entry *entry,
+					   const char *what) {
+	struct grep_feed *feed = walker->arg;
+	int error = errno;
+
+	(void)what;
+	if (entry->level >= 0)
+		entry_path(feed, entry);
+	else
+		feed->path[feed->lens[0]] = '\0';
+	fprintf(stderr, "-%s: mgrep: %s: %s\n", sysname, feed->path,
+			strerror(error));
+}
+
+// add a line to the file's batch
+static void add_line(struct grep_worker *w, const char *path, long number,
+					 const char *line, size_t len) {
+	size_t path_len = strlen(path);
+	size_t most = path_len + len + 24;
+
+	if (w->len + most > w->cap) {
+		w->cap = 2 * (w->len + most);
+		w->lines = xrealloc(w->lines, w->cap);
+	}
+	char *p = w->lines + w->len;
+	memcpy(p, path, path_len);
+	p += path_len;
+	if (w->run->line_numbers)
+		p += sprintf(p, ":%ld", number);
+	*p++ = ':';
+	memcpy(p, line, len);
+	p += len;
+	*p++ = '\n';
+	w->len = p - w->lines;
+	w->matches++;
+}
+
+/**
+ * Collect the matching lines of a file's contents into the worker's batch
+ * @param w    [description]
+ * @param path [description]
+ * @param data [description]
+ * @param size [description]
+ */
+static void search(struct grep_worker *w, const char *path, const char *data,
+				   size_t size) {
+	const struct grep_run *run = w->run;
+	const char *end = data + size, *pos = data;
+	const char *counted = data; // newlines before it are in number
+	long number = 1;
+
+	while (pos < end) {
+		const char *start, *stop;
+
+		if (run->literal) {
+			// only lines with the literal can match
+			const char *hit =
+				memmem(pos, end - pos, run->literal, run->literal_len);
+			if (!hit)
+				break;
+			start = memrchr(pos, '\n', hit - pos);
+			start = start ? start + 1 : pos;
+			stop = memchr(hit, '\n', end - hit);
+			stop = stop ? stop : end;
+			if (!run->fixed) {
+				regmatch_t m = {.rm_so = 0, .rm_eo = stop - start};
+				if (regexec(&w->regex, start, 1, &m, REG_STARTEND) != 0) {
+					pos = stop + 1;
+					continue;
+				}
+			}
+		} else {
+			regmatch_t m = {.rm_so = 0, .rm_eo = end - pos};
+			if (regexec(&w->regex, pos, 1, &m, REG_STARTEND) != 0)
+				break;
+			const char *hit = pos + m.rm_so;
+			// past the last newline there is no line, only the end
+			if (hit == end && end[-1] == '\n')
+				break;
+			start = memrchr(pos, '\n', hit - pos);
+			start = start ? start + 1 : pos;
+			stop = memchr(hit, '\n', end - hit);
+			stop = stop ? stop : end;
+		}
+
+		if (run->line_numbers) {
+			const char *nl;
+			while ((nl = memchr(counted, '\n', start - counted))) {
+				number++;
+				counted = nl + 1;
+			}
+			counted = start;
+		}
+		add_line(w, path, number, start, stop - start);
+		pos = stop + 1;
+	}
+}
+
+/**
+ * Search a file if it's a regular one, and write out its matching lines
+ * @param w    [description]
+ * @param path [description]
+ */
+static void grep_file(struct grep_worker *w, const char *path) {
+	// a FIFO would block the open without O_NONBLOCK
+	int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+	struct stat st;
+
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "-%s: mgrep: %s: %s\n", sysname, path,
+				strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+
+	size_t size = st.st_size;
+	const char *data;
+	if (size <= SMALL_FILE) {
+		// a file that shrank since the fstat reads short
+		errno = 0;
+		data = read_full(fd, w->buf, size) ? (const char *)w->buf : NULL;
+	} else {
+		void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		data = map == MAP_FAILED ? NULL : map;
+		if (data)
+			madvise(map, size, MADV_SEQUENTIAL);
+	}
+	if (!data) {
+		if (errno)
+			fprintf(stderr, "-%s: mgrep: %s: %s\n", sysname, path,
+					strerror(errno));
+		close(fd);
+		return;
+	}
+
+	w->files++;
+	if (memchr(data, '\0', size < BINARY_PEEK ? size : BINARY_PEEK)) {
+		w->binary++;
+	} else {
+		w->len = 0;
+		search(w, path, data, size);
+		if (w->len) {
+			pthread_mutex_lock(&w->run->out_lock);
+			out_buffer_write(&w->run->out, w->lines, w->len);
+			pthread_mutex_unlock(&w->run->out_lock);
+		}
+	}
+	if (size > SMALL_FILE)
+		munmap((void *)data, size);
+	close(fd);
+}
+
+/**
+ * Set up a worker
+ * @param  w   [description]
+ * @param  run [description]
+ * @return     0, or regcomp's error
+ */
+static int worker_init(struct grep_worker *w, struct grep_run *run) {
+	*w = (struct grep_worker){.run = run};
+	if (!run->fixed) {
+		int error = regcomp(&w->regex, run->pattern,
+							REG_EXTENDED | REG_NEWLINE);
+		if (error)
+			return error;
+	}
+	w->buf = xrealloc(NULL, SMALL_FILE);
+	return 0;
+}
+
+static void worker_free(struct grep_worker *w) {
+	if (!w->run->fixed)
+		regfree(&w->regex);
+	free(w->buf);
+	free(w->lines);
+}
+
+static void *grep_worker(void *arg) {
+	struct grep_worker *w = arg;
+	const char *path;
+
+	while ((path = next_file(w->run)))
+		grep_file(w, path);
+	return NULL;
+}
+
+/**
+ * Read the options, the pattern and the directory
+ * @param  command [description]
+ * @param  run     [description]
+ * @param  jobs    set to the thread count
+ * @param  dir     [description]
+ * @return         false after printing an error
+ */
+static bool parse_args(struct command_t *command, struct grep_run *run,
+					   long *jobs, const char **dir) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int i = 1;
+
+	*jobs = ncpu > 0 ? ncpu : 1;
+	for (; command->args[i] && command->args[i][0] == '-'; i++) {
+		const char *arg = command->args[i];
+
+		if (strcmp(arg, "-F") == 0) {
+			run->fixed = true;
+		} else if (strcmp(arg, "-n") == 0) {
+			run->line_numbers = true;
+		} else if (strncmp(arg, "-j", 2) == 0) {
+			const char *value = arg[2] ? arg + 2 : command->args[++i];
+			char *end;
+
+			if (value)
+				*jobs = strtol(value, &end, 10);
+			if (!value || *end != '\0' || *jobs <= 0) {
+				printf("-%s: mgrep: -j: expected a positive number\n",
+					   sysname);
+				return false;
+			}
+		} else if (strcmp(arg, "--") == 0) {
+			i++;
+			break;
+		} else {
+			break;
+		}
+	}
+
+	run->pattern = command->args[i];
+	*dir = run->pattern ? command->args[i + 1] : NULL;
+	if (!run->pattern || (*dir && command->args[i + 2])) {
+		printf("Usage: mgrep [-F] [-n] [-j N] PATTERN [DIR]\n");
+		return false;
+	}
+	if (!*dir)
+		*dir = ".";
+	return true;
+}
+
+int mgrep_builtin(struct command_t *command) {
+	struct grep_run run = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.more = PTHREAD_COND_INITIALIZER,
+		.out_lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	const char *dir;
+	long jobs;
+
+	if (!parse_args(command, &run, &jobs, &dir))
+		return SUCCESS;
+
+	if (run.fixed) {
+		run.literal_len = strlen(run.pattern);
+		run.literal = run.literal_len ? strdup(run.pattern) : NULL;
+		// the empty string is in every line
+		run.fixed = run.literal != NULL;
+	} else {
+		run.literal = required_literal(run.pattern, &run.literal_len);
+	}
+
+	// the calling thread searches too, once the walk is done
+	struct grep_worker *workers =
+		xrealloc(NULL, (jobs + 1) * sizeof(*workers));
+	int error = worker_init(&workers[0], &run);
+	if (error) {
+		char message[256];
+		regerror(error, &workers[0].regex, message, sizeof(message));
+		printf("-%s: mgrep: %s: %s\n", sysname, run.pattern, message);
+		free(workers);
+		free(run.literal);
+		return SUCCESS;
+	}
+	long started = 1;
+	for (; started <= jobs; started++) {
+		struct grep_worker *w = &workers[started];
+
+		if (worker_init(w, &run) != 0)
+			break;
+		if (pthread_create(&w->thread, NULL, grep_worker, w) != 0) {
+			worker_free(w);
+			break;
+		}
+	}
+
+	struct grep_feed feed = {
+		.walker = {.follow_links = true,
+				   .visit = feed_visit,
+				   .error = feed_error},
+		.run = &run,
+		.lens_cap = 16,
+	};
+	size_t len = strlen(dir);
+	double start = timing_now();
+	bool cached;
+
+	feed.walker.arg = &feed;
+
+	// the matches bypass stdio
+	fflush(stdout);
+	out_buffer_init(&run.out, STDOUT_FILENO, OUT_BUFFER_SIZE);
+	arena_init(&feed.arena, GREP_ARENA_SIZE);
+	feed.path_cap = len + 256;
+	feed.path = xrealloc(NULL, feed.path_cap);
+	feed.lens = xrealloc(NULL, feed.lens_cap * sizeof(*feed.lens));
+	memcpy(feed.path, dir, len + 1);
+	feed.lens[0] = len > 1 && dir[len - 1] == '/' ? len - 1 : len;
+	treecache_walk(&feed.walker, dir, false, &cached);
+
+	pthread_mutex_lock(&run.lock);
+	run.walked = true;
+	pthread_cond_broadcast(&run.more);
+	pthread_mutex_unlock(&run.lock);
+	grep_worker(&workers[0]);
+
+	long files = 0, binary = 0, matches = 0;
+	for (long i = 0; i < started; i++) {
+		if (i > 0)
+			pthread_join(workers[i].thread, NULL);
+		files += workers[i].files;
+		binary += workers[i].binary;
+		matches += workers[i].matches;
+		worker_free(&workers[i]);
+	}
+	if (out_buffer_flush(&run.out) == -1)
+		fprintf(stderr, "-%s: mgrep: write: %s\n", sysname, strerror(errno));
+
+	double elapsed = timing_now() - start;
+	fprintf(stderr,
+			"mgrep: %ld matching lines in %ld files (%ld binary skipped) "
+			"in %.3f s\n",
+			matches, files, binary, elapsed);
+
+	out_buffer_destroy(&run.out);
+	arena_destroy(&feed.arena);
+	free(feed.path);
+	free(feed.lens);
+	free(workers);
+	free(run.files);
+	free(run.literal);
+	return SUCCESS;
+}
@@ -0,0 +1,24 @@
+#ifndef MGREP_H
+#define MGREP_H
+
+#include "shell.h"
+
+/*
+ * mgrep [-F] [-n] [-j N] PATTERN [DIR]: print the lines of the files below
+ * DIR (default .) that match PATTERN, a POSIX extended regex, or a fixed
+ * string with -F, as "path:line", or "path:number:line" with -n. The tree
+ * is walked the way mindmap walks it, through treecache.h, and the files
+ * are handed to N threads (default: online CPUs) as the walk finds them,
+ * the calling thread joining in once the walk is done. Each thread reads
+ * a file whole, small ones into a buffer and large ones through mmap, and
+ * skips it if a NUL shows up in its first block. Before any regex work,
+ * the longest run of plain characters every match has to contain is looked
+ * for with memmem, and only the lines it turns up in are handed to
+ * regexec; files without it cost one memmem. A file's matching lines are
+ * gathered and written together, so lines from different files never
+ * interleave, though files come out in the order they are finished. Counts
+ * and timing are reported on stderr at the end.
+ */
+int mgrep_builtin(struct command_t *command);
+
+#endif
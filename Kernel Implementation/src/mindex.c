@@ -0,0 +1,755 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "mindex.h"
+#include "outbuf.h"
+#include "pathindex.h"
+#include "pwalk.h"
+#include "timing.h"
+#include "treecache.h"
+#include "util.h"
+
+// the paths of a tree are kept in one arena
+#define INDEX_ARENA_SIZE (1 << 20)
+
+struct index_entry {
+	const char *path; // below the root
+	bool dir;
+	bool unreadable; // a directory that couldn't be listed
+	bool gone; // dropped by the refresh
+	bool changed; // a directory to list again
+	uint64_t dev, ino;
+	int64_t mtime_ns;
+};
+
+struct entries {
+	struct index_entry *e;
+	size_t n, cap;
+};
+
+struct index_run {
+	const char *root; // resolved
+	int root_fd;
+	time_t start;
+	struct arena arena;
+	struct index_entry top; // the root itself
+	struct entries old; // from the index, in order
+	struct entries added; // by the refresh or the first walk
+	long reads; // directories listed
+};
+
+// turns a walk of a directory into entries
+struct collector {
+	struct pwalker walker;
+	struct index_run *run;
+	struct entries *out;
+	long top; // the entry of the walked directory, -1 for the root
+	char *path; // of the directory entries are in
+	size_t path_cap;
+	size_t *lens; // by level, the length of its directory's path
+	int lens_cap;
+};
+
+static struct index_entry *add_entry(struct entries *entries,
+									 const char *path, bool dir) {
+	if (entries->n == entries->cap) {
+		entries->cap = entries->cap ? 2 * entries->cap : 1024;
+		entries->e =
+			xrealloc(entries->e, entries->cap * sizeof(*entries->e));
+	}
+	struct index_entry *e = &entries->e[entries->n++];
+	*e = (struct index_entry){.path = path, .dir = dir};
+	return e;
+}
+
+static void print_error(const struct index_run *run, const char *path) {
+	const char *sep = *path && strcmp(run->root, "/") != 0 ? "/" : "";
+	printf("-%s: mindex: %s%s%s: %s\n", sysname, run->root, sep, path,
+		   strerror(errno));
+}
+
+/**
+ * Find the index file of a root, creating the directories on the default
+ * path
+ * @param  root resolved
+ * @param  path [description]
+ * @param  size [description]
+ * @return      false if there is nowhere to keep it
+ */
+static bool index_path(const char *root, char *path, size_t size) {
+	const char *env = getenv("MISHELL_PATH_INDEX");
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (const char *p = root; *p; p++)
+		hash = (hash ^ (unsigned char)*p) * 0x100000001b3ULL;
+
+	if (env && *env) {
+		snprintf(path, size, "%s", env);
+	} else {
+		if (base && *base)
+			snprintf(path, size, "%s", base);
+		else if (home && *home)
+			snprintf(path, size, "%s/.cache", home);
+		else
+			return false;
+		mkdir(path, 0700);
+
+		size_t len = strlen(path);
+		if (snprintf(path + len, size - len, "/mishell") >= (int)(size - len))
+			return false;
+		mkdir(path, 0700);
+
+		len = strlen(path);
+		if (snprintf(path + len, size - len, "/paths") >= (int)(size - len))
+			return false;
+	}
+	mkdir(path, 0700);
+
+	size_t len = strlen(path);
+	return snprintf(path + len, size - len, "/%016llx",
+					(unsigned long long)hash) < (int)(size - len);
+}
+
+/**
+ * Note a directory's identity and mtime, unless the mtime is too recent to
+ * tell later changes in the same tick apart
+ * @param run [description]
+ * @param e   [description]
+ * @param st  [description]
+ */
+static void set_dir_stat(const struct index_run *run, struct index_entry *e,
+						 const struct stat *st) {
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->mtime_ns = st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+	if (e->unreadable || st->st_mtim.tv_sec >= run->start - 1)
+		e->mtime_ns = 0;
+}
+
+static void collect_visit(struct pwalker *walker,
+						  const struct pwalk_entry *entry) {
+	struct collector *c = walker->arg;
+	size_t len = c->lens[entry->level];
+	size_t name_len = strlen(entry->name);
+
+	if (len + name_len + 2 > c->path_cap) {
+		c->path_cap = 2 * (len + name_len + 2);
+		c->path = xrealloc(c->path, c->path_cap);
+	}
+	if (len)
+		c->path[len++] = '/';
+	memcpy(c->path + len, entry->name, name_len + 1);
+
+	char *path = arena_alloc(&c->run->arena, len + name_len + 1);
+	memcpy(path, c->path, len + name_len + 1);
+	add_entry(c->out, path, entry->dir);
+	if (!entry->dir)
+		return;
+
+	c->run->reads++;
+	if (entry->level + 2 > c->lens_cap) {
+		c->lens_cap *= 2;
+		c->lens = xrealloc(c->lens, c->lens_cap * sizeof(*c->lens));
+	}
+	c->lens[entry->level + 1] = len + name_len;
+}
+
+static void collect_error(struct pwalker *walker,
+						  const struct pwalk_entry *entry, const char *what) {
+	struct collector *c = walker->arg;
+	int error = errno;
+
+	(void)what;
+	if (entry->dir) {
+		// the directory visited last, or the walk's own
+		struct index_entry *e = entry->level == -1 ? NULL
+												   : &c->out->e[c->out->n - 1];
+		if (!e)
+			e = c->top == -1 ? &c->run->top : &c->out->e[c->top];
+		e->unreadable = true;
+		errno = error;
+		print_error(c->run, e->path);
+		return;
+	}
+
+	size_t len = c->lens[entry->level];
+	char *path = malloc(len + strlen(entry->name) + 2);
+	if (path) {
+		sprintf(path, "%.*s%s%s", (int)len, c->path, len ? "/" : "",
+				entry->name);
+		errno = error;
+		print_error(c->run, path);
+		free(path);
+	}
+}
+
+/**
+ * Walk a directory into entries
+ * @param  run    [description]
+ * @param  out    [description]
+ * @param  top    the directory's entry in out, -1 for the root
+ * @param  rescan walk the root afresh rather than from treecache.h
+ */
+static void collect(struct index_run *run, struct entries *out, long top,
+					bool rescan) {
+	const char *rel = top == -1 ? "" : out->e[top].path;
+	size_t len = strlen(rel);
+	struct collector c = {
+		.walker = {.follow_links = true,
+				   .visit = collect_visit,
+				   .error = collect_error},
+		.run = run,
+		.out = out,
+		.top = top,
+		.path_cap = len + 256,
+		.lens_cap = 16,
+	};
+	bool cached;
+
+	c.walker.arg = &c;
+	c.path = xrealloc(NULL, c.path_cap);
+	memcpy(c.path, rel, len + 1);
+	c.lens = xrealloc(NULL, c.lens_cap * sizeof(*c.lens));
+	c.lens[0] = len;
+	run->reads++;
+
+	if (top == -1) {
+		// the way mindmap walks, so a tree it has drawn isn't read again
+		treecache_walk(&c.walker, run->root, rescan, &cached);
+	} else {
+		char *path = malloc(strlen(run->root) + len + 2);
+		if (path) {
+			sprintf(path, "%s/%s", run->root, rel);
+			pwalk_tree(&c.walker, path);
+			free(path);
+		}
+	}
+	free(c.path);
+	free(c.lens);
+}
+
+static int entry_cmp(const void *a, const void *b) {
+	return path_cmp(((const struct index_entry *)a)->path,
+						 ((const struct index_entry *)b)->path);
+}
+
+static bool load_path(void *arg, uint64_t id, const char *path, size_t len) {
+	struct index_run *run = arg;
+	char *copy = arena_alloc(&run->arena, len + 1);
+
+	(void)id;
+	memcpy(copy, path, len + 1);
+	add_entry(&run->old, copy, false);
+	return true;
+}
+
+/**
+ * Read the entries and directories of an index
+ * @param  run   [description]
+ * @param  index [description]
+ * @return       false if it doesn't fit together
+ */
+static bool load_index(struct index_run *run, const struct pathindex *index) {
+	pathindex_each(index, load_path, run);
+	if (run->old.n != index->npaths)
+		return false;
+
+	for (uint64_t i = 0; i < index->ndirs; i++) {
+		const struct pathindex_dir *d = &index->dirs[i];
+		struct index_entry *e;
+
+		if (d->path == PATHINDEX_ROOT)
+			e = &run->top;
+		else if (d->path < run->old.n)
+			e = &run->old.e[d->path];
+		else
+			return false;
+		e->dir = true;
+		e->dev = d->dev;
+		e->ino = d->ino;
+		e->mtime_ns = d->mtime_ns;
+	}
+	return true;
+}
+
+// the entries below old.e[i] follow it, up to the returned index
+static size_t subtree_end(const struct entries *entries, size_t i) {
+	const char *path = entries->e[i].path;
+	size_t len = strlen(path), j = i + 1;
+
+	while (j < entries->n && strncmp(entries->e[j].path, path, len) == 0 &&
+		   entries->e[j].path[len] == '/')
+		j++;
+	return j;
+}
+
+static void drop_contents(struct index_run *run, struct index_entry *dir) {
+	size_t i = dir == &run->top ? 0 : (size_t)(dir - run->old.e) + 1;
+	size_t end = dir == &run->top ? run->old.n
+								  : subtree_end(&run->old, i - 1);
+
+	for (; i < end; i++)
+		run->old.e[i].gone = true;
+}
+
+/**
+ * Find the entry of a path's directory among the old ones
+ * @param  run  [description]
+ * @param  path [description]
+ * @param  len  of the directory's path, 0 for the root
+ * @return      NULL if it isn't there
+ */
+static struct index_entry *find_dir(struct index_run *run, const char *path,
+									size_t len) {
+	if (len == 0)
+		return &run->top;
+
+	char *dir = strndup(path, len);
+	size_t lo = 0, hi = run->old.n;
+	while (dir && lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (path_cmp(run->old.e[mid].path, dir) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	bool found = dir && lo < run->old.n &&
+				 strcmp(run->old.e[lo].path, dir) == 0;
+	free(dir);
+	return found ? &run->old.e[lo] : NULL;
+}
+
+// whether a directory is one it's inside of, through a link
+static bool links_back(struct index_run *run, const struct index_entry *e) {
+	if (e == &run->top)
+		return false;
+	if (e->dev == run->top.dev && e->ino == run->top.ino)
+		return true;
+	for (const char *p = e->path; (p = strchr(p, '/')); p++) {
+		struct index_entry *up = find_dir(run, e->path, p - e->path);
+		if (up && up->dev == e->dev && up->ino == e->ino)
+			return true;
+	}
+	return false;
+}
+
+struct listed {
+	const char *name;
+	bool dir;
+	dev_t dev; // of a directory
+	ino_t ino;
+};
+
+static int listed_cmp(const void *a, const void *b) {
+	return path_cmp(((const struct listed *)a)->name,
+						 ((const struct listed *)b)->name);
+}
+
+/**
+ * Add a new entry below dir, walking it if it's a directory
+ * @param run    [description]
+ * @param dir    [description]
+ * @param name   [description]
+ * @param is_dir [description]
+ * @param st     its stat, for a directory
+ */
+static void add_new(struct index_run *run, const struct index_entry *dir,
+					const char *name, bool is_dir, const struct stat *st) {
+	size_t len = strlen(dir->path), name_len = strlen(name);
+	char *path = arena_alloc(&run->arena, len + name_len + 2);
+
+	sprintf(path, "%s%s%s", dir->path, len ? "/" : "", name);
+	struct index_entry *e = add_entry(&run->added, path, is_dir);
+	if (!is_dir)
+		return;
+
+	// a walk from a link only knows the directories above its target
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	if (links_back(run, e)) {
+		e->unreadable = true;
+		errno = ELOOP;
+		print_error(run, path);
+		return;
+	}
+	collect(run, &run->added, run->added.n - 1, false);
+}
+
+/**
+ * List a changed directory again and bring its entries up to date
+ * @param run [description]
+ * @param dir [description]
+ */
+static void relist(struct index_run *run, struct index_entry *dir) {
+	struct listed *names = NULL;
+	size_t n = 0, cap = 0;
+	struct stat st;
+	DIR *d = NULL;
+	int fd;
+
+	dir->unreadable = true;
+	dir->mtime_ns = 0;
+	if (links_back(run, dir)) {
+		errno = ELOOP;
+		print_error(run, dir->path);
+		drop_contents(run, dir);
+		return;
+	}
+	fd = openat(run->root_fd, *dir->path ? dir->path : ".",
+				O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1 || !(d = fdopendir(fd))) {
+		print_error(run, dir->path);
+		if (fd != -1)
+			close(fd);
+		drop_contents(run, dir);
+		return;
+	}
+	dir->unreadable = false;
+	set_dir_stat(run, dir, &st);
+	run->reads++;
+
+	for (struct dirent *de; (de = readdir(d));) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		// only a link can lead back up, a real directory has no ino to check
+		bool is_dir = de->d_type == DT_DIR;
+		st.st_dev = st.st_ino = 0;
+		if (de->d_type == DT_LNK || de->d_type == DT_UNKNOWN) {
+			if (fstatat(fd, de->d_name, &st, 0) == -1) {
+				char *path = malloc(strlen(dir->path) + strlen(de->d_name) + 2);
+				if (path) {
+					int error = errno;
+					sprintf(path, "%s%s%s", dir->path, *dir->path ? "/" : "",
+							de->d_name);
+					errno = error;
+					print_error(run, path);
+					free(path);
+				}
+				continue;
+			}
+			is_dir = S_ISDIR(st.st_mode);
+		}
+		if (n == cap) {
+			cap = cap ? 2 * cap : 64;
+			names = xrealloc(names, cap * sizeof(*names));
+		}
+		names[n++] = (struct listed){arena_strdup(&run->arena, de->d_name),
+									 is_dir, st.st_dev, st.st_ino};
+	}
+	closedir(d);
+	qsort(names, n, sizeof(*names), listed_cmp);
+
+	// match them up with the old entries directly inside
+	size_t len = strlen(dir->path);
+	size_t j = dir == &run->top ? 0 : (size_t)(dir - run->old.e) + 1;
+	size_t end = dir == &run->top ? run->old.n : subtree_end(&run->old, j - 1);
+	size_t k = 0;
+	while (j < end || k < n) {
+		struct index_entry *old = j < end ? &run->old.e[j] : NULL;
+		const char *name = old ? old->path + (len ? len + 1 : 0) : NULL;
+
+		if (old && (old->gone || strchr(name, '/'))) {
+			j++;
+			continue;
+		}
+		int cmp = !old ? 1 : k == n ? -1 : path_cmp(name, names[k].name);
+		if (cmp == 0 && old->dir == names[k].dir) {
+			j++;
+			k++;
+			continue;
+		}
+		if (cmp <= 0) {
+			old->gone = true;
+			if (old->dir)
+				drop_contents(run, old);
+			j++;
+		}
+		if (cmp >= 0) {
+			struct stat at = {.st_dev = names[k].dev,
+							  .st_ino = names[k].ino};
+			add_new(run, dir, names[k].name, names[k].dir, &at);
+			k++;
+		}
+	}
+	free(names);
+}
+
+/**
+ * Find the directories that changed since the index was written and list
+ * them again
+ * @param run [description]
+ */
+static void refresh(struct index_run *run) {
+	struct stat st;
+
+	if (fstat(run->root_fd, &st) == -1 || st.st_dev != run->top.dev ||
+		st.st_ino != run->top.ino ||
+		st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec !=
+			run->top.mtime_ns ||
+		run->top.mtime_ns == 0)
+		run->top.changed = true;
+
+	for (size_t i = 0; i < run->old.n; i++) {
+		struct index_entry *e = &run->old.e[i];
+		if (e->gone || !e->dir)
+			continue;
+
+		// one that's gone or no longer a directory goes with its parent
+		if (fstatat(run->root_fd, e->path, &st, 0) == -1 ||
+			!S_ISDIR(st.st_mode)) {
+			const char *slash = strrchr(e->path, '/');
+			struct index_entry *up =
+				find_dir(run, e->path, slash ? slash - e->path : 0);
+			if (up)
+				up->changed = true;
+			drop_contents(run, e);
+			continue;
+		}
+		if (e->mtime_ns == 0 || st.st_dev != e->dev || st.st_ino != e->ino ||
+			st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec !=
+				e->mtime_ns)
+			e->changed = true;
+		e->dev = st.st_dev;
+		e->ino = st.st_ino;
+	}
+
+	if (run->top.changed)
+		relist(run, &run->top);
+	for (size_t i = 0; i < run->old.n; i++) {
+		struct index_entry *e = &run->old.e[i];
+		if (!e->gone && e->dir && e->changed)
+			relist(run, e);
+	}
+}
+
+/**
+ * Put the old entries that are left and the added ones together, and write
+ * them out
+ * @param  run  [description]
+ * @param  file [description]
+ * @return      the number of paths, -1 with errno set if writing failed
+ */
+static long write_index(struct index_run *run, const char *file) {
+	struct entries *old = &run->old, *added = &run->added;
+	size_t n = 0, ndirs = 0, i = 0, j = 0;
+	struct stat st;
+
+	// the added directories were walked before this, as they are now
+	for (size_t k = 0; k < added->n; k++) {
+		struct index_entry *e = &added->e[k];
+		if (e->dir && fstatat(run->root_fd, e->path, &st, 0) == 0)
+			set_dir_stat(run, e, &st);
+	}
+	qsort(added->e, added->n, sizeof(*added->e), entry_cmp);
+
+	const char **paths = xrealloc(NULL, (old->n + added->n + 1) *
+											sizeof(*paths));
+	struct pathindex_dir *dirs =
+		xrealloc(NULL, (old->n + added->n + 1) * sizeof(*dirs));
+	while (i < old->n || j < added->n) {
+		if (i < old->n && old->e[i].gone) {
+			i++;
+			continue;
+		}
+		struct index_entry *e;
+		if (j == added->n ||
+			(i < old->n && entry_cmp(&old->e[i], &added->e[j]) < 0))
+			e = &old->e[i++];
+		else
+			e = &added->e[j++];
+		if (e->dir)
+			dirs[ndirs++] = (struct pathindex_dir){n, e->dev, e->ino,
+												   e->mtime_ns};
+		paths[n++] = e->path;
+	}
+	dirs[ndirs++] = (struct pathindex_dir){PATHINDEX_ROOT, run->top.dev,
+										   run->top.ino, run->top.mtime_ns};
+
+	int r = pathindex_write(file, run->root, paths, n, dirs, ndirs);
+	free(paths);
+	free(dirs);
+	return r == -1 ? -1 : (long)n;
+}
+
+int mindex_builtin(struct command_t *command) {
+	const char *dir = NULL;
+	bool rescan = false;
+	char file[PATH_MAX];
+	struct pathindex index;
+	struct stat st;
+
+	for (int i = 1; command->args[i]; i++) {
+		if (strcmp(command->args[i], "-f") == 0 && !rescan) {
+			rescan = true;
+		} else if (command->args[i][0] != '-' && !dir) {
+			dir = command->args[i];
+		} else {
+			printf("Usage: mindex [-f] [DIR]\n");
+			return SUCCESS;
+		}
+	}
+	if (!dir)
+		dir = ".";
+
+	struct index_run run = {.root_fd = -1, .top = {.path = "", .dir = true}};
+	char *root = realpath(dir, NULL);
+	if (!root || (run.root_fd = open(root, O_RDONLY | O_DIRECTORY |
+												 O_CLOEXEC)) == -1) {
+		printf("-%s: mindex: %s: %s\n", sysname, dir, strerror(errno));
+		free(root);
+		return SUCCESS;
+	}
+	if (!index_path(root, file, sizeof(file))) {
+		printf("-%s: mindex: nowhere to keep the index, set "
+			   "MISHELL_PATH_INDEX\n",
+			   sysname);
+		close(run.root_fd);
+		free(root);
+		return SUCCESS;
+	}
+
+	double start = timing_now();
+	run.root = root;
+	run.start = time(NULL);
+	arena_init(&run.arena, INDEX_ARENA_SIZE);
+
+	bool refreshing = !rescan && pathindex_open(&index, file) == 0;
+	if (refreshing) {
+		refreshing = index.root_len == strlen(root) &&
+					 memcmp(index.root, root, index.root_len) == 0 &&
+					 load_index(&run, &index);
+		pathindex_close(&index);
+	}
+	if (refreshing) {
+		refresh(&run);
+	} else {
+		// anything loaded from an index that didn't fit is dropped
+		arena_reset(&run.arena);
+		run.old.n = 0;
+		run.top = (struct index_entry){.path = "", .dir = true};
+		collect(&run, &run.added, -1, rescan);
+		if (fstat(run.root_fd, &st) == 0)
+			set_dir_stat(&run, &run.top, &st);
+	}
+
+	long paths = write_index(&run, file);
+	double elapsed = timing_now() - start;
+	if (paths == -1)
+		printf("-%s: mindex: %s: %s\n", sysname, file, strerror(errno));
+	else
+		fprintf(stderr,
+				"mindex: %s: %ld paths, %ld directories listed in %.3f s\n",
+				root, paths, run.reads, elapsed);
+
+	arena_destroy(&run.arena);
+	free(run.old.e);
+	free(run.added.e);
+	close(run.root_fd);
+	free(root);
+	return SUCCESS;
+}
+
+// where mfind writes its matches
+struct matches {
+	struct out_buffer out;
+	const char *root;
+	size_t root_len; // with the '/' after it
+	long count;
+};
+
+static bool print_match(void *arg, uint64_t id, const char *path,
+						size_t len) {
+	struct matches *m = arg;
+	char *p = out_buffer_reserve(&m->out, m->root_len + len + 1);
+
+	(void)id;
+	memcpy(p, m->root, m->root_len);
+	memcpy(p + m->root_len, path, len);
+	p[m->root_len + len] = '\n';
+	m->out.len += m->root_len + len + 1;
+	m->count++;
+	return true;
+}
+
+int mfind_builtin(struct command_t *command) {
+	const char *pattern = command->args[1];
+	const char *dir = pattern ? command->args[2] : NULL;
+	struct pathindex index;
+	char file[PATH_MAX];
+
+	if (!pattern || (dir && command->args[3])) {
+		printf("Usage: mfind PATTERN [DIR]\n");
+		return SUCCESS;
+	}
+	if (!dir)
+		dir = ".";
+
+	char *path = realpath(dir, NULL);
+	if (!path) {
+		printf("-%s: mfind: %s: %s\n", sysname, dir, strerror(errno));
+		return SUCCESS;
+	}
+
+	// the index of the directory or the nearest one above it
+	size_t len = strlen(path);
+	bool found = false;
+	while (!found) {
+		char c = path[len];
+		path[len] = '\0';
+		if (index_path(len ? path : "/", file, sizeof(file)) &&
+			pathindex_open(&index, file) == 0) {
+			found = index.root_len == (len ? len : 1) &&
+					memcmp(index.root, len ? path : "/", index.root_len) == 0;
+			if (!found)
+				pathindex_close(&index);
+		}
+		path[len] = c;
+		if (found || len == 0)
+			break;
+		while (len > 0 && path[--len] != '/')
+			;
+	}
+	if (!found) {
+		printf("-%s: mfind: %s: not indexed, see mindex\n", sysname, path);
+		free(path);
+		return SUCCESS;
+	}
+
+	// paths below dir, relative to the root, start with this
+	char *prefix = xrealloc(NULL, strlen(path) + 2);
+	const char *rel = path + len + (path[len] == '/');
+	sprintf(prefix, "%s%s", rel, *rel ? "/" : "");
+
+	struct matches m = {.count = 0};
+	char *root = xrealloc(NULL, index.root_len + 2);
+	memcpy(root, index.root, index.root_len);
+	m.root_len = index.root_len;
+	if (root[m.root_len - 1] != '/')
+		root[m.root_len++] = '/';
+	m.root = root;
+
+	fflush(stdout);
+	out_buffer_init(&m.out, STDOUT_FILENO, OUT_BUFFER_SIZE);
+	pathindex_find(&index, pattern, prefix, print_match, &m);
+	if (out_buffer_flush(&m.out) == -1)
+		fprintf(stderr, "-%s: mfind: write: %s\n", sysname, strerror(errno));
+
+	out_buffer_destroy(&m.out);
+	pathindex_close(&index);
+	free(root);
+	free(prefix);
+	free(path);
+	return SUCCESS;
+}
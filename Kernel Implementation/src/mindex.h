@@ -0,0 +1,26 @@
+#ifndef MINDEX_H
+#define MINDEX_H
+
+#include "shell.h"
+
+/*
+ * mindex [-f] [DIR]: index the paths below DIR (default .) in a
+ * pathindex.h file, kept in $MISHELL_PATH_INDEX, or else
+ * $XDG_CACHE_HOME/mishell/paths or ~/.cache/mishell/paths, one file per
+ * root. The first run walks the tree the way mindmap does, through
+ * treecache.h. Later runs refresh the index: every indexed directory is
+ * stat'ed, and only those whose inode or mtime changed are read again,
+ * new subdirectories being walked. Directories changed within a second of
+ * the run are read again next time, as an mtime can't tell changes in the
+ * same tick apart. -f walks everything afresh.
+ *
+ * mfind PATTERN [DIR]: print the indexed paths below DIR (default .) that
+ * match PATTERN, from the index of DIR or the nearest directory above it
+ * that has one, without touching the file system. PATTERN is matched
+ * against the path below the indexed root: as a glob where * also matches
+ * '/' when it has any of *?[, else as a substring.
+ */
+int mindex_builtin(struct command_t *command);
+int mfind_builtin(struct command_t *command);
+
+#endif
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "namematch.h"
+#include "util.h"
+
+// state sets up to this many words live on the stack while testing
+#define STACK_WORDS 4
+
+static void set_bit(uint64_t *set, int bit) {
+	set[bit / 64] |= 1ULL << (bit % 64);
+}
+
+/**
+ * Read a bracket expression, p just past its '['
+ * @param  p   [description]
+ * @param  set the bytes it takes
+ * @return     past its ']', or NULL if there is none and '[' is literal
+ */
+static const char *read_bracket(const char *p, bool set[256]) {
+	bool negate = *p == '!' || *p == '^';
+	bool in[256] = {false};
+
+	if (negate)
+		p++;
+	// a ']' right at the start is one of the bytes
+	for (bool first = true; *p && (first || *p != ']'); first = false) {
+		unsigned char lo = *p == '\\' && p[1] ? *++p : *p;
+		unsigned char hi = lo;
+
+		p++;
+		if (p[0] == '-' && p[1] && p[1] != ']') {
+			p++;
+			hi = *p == '\\' && p[1] ? *++p : *p;
+			p++;
+		}
+		for (int c = lo; c <= hi; c++)
+			in[c] = true;
+	}
+	if (*p != ']')
+		return NULL;
+	for (int c = 0; c < 256; c++)
+		set[c] = in[c] != negate;
+	return p + 1;
+}
+
+/**
+ * Read one element of a pattern
+ * @param  p    [description]
+ * @param  star set if it's a *
+ * @param  set  otherwise, the bytes it takes
+ * @return      past it
+ */
+static const char *read_element(const char *p, bool *star, bool set[256]) {
+	*star = *p == '*';
+	if (*star)
+		return p + 1;
+
+	memset(set, 0, 256 * sizeof(bool));
+	if (*p == '?') {
+		memset(set, 1, 256 * sizeof(bool));
+		return p + 1;
+	}
+	if (*p == '[') {
+		const char *end = read_bracket(p + 1, set);
+		if (end)
+			return end;
+	}
+	if (*p == '\\' && p[1])
+		p++;
+	set[(unsigned char)*p] = true;
+	return p + 1;
+}
+
+void namematch_add(struct namematch *match, const char *pattern) {
+	size_t size = (match->npatterns + 1) * sizeof(*match->patterns);
+
+	match->patterns = xrealloc(match->patterns, size);
+	match->patterns[match->npatterns++] = pattern;
+}
+
+/**
+ * Build the automaton of the patterns added so far
+ * @param match [description]
+ */
+void namematch_compile(struct namematch *match) {
+	bool star, set[256];
+	int positions = 0;
+
+	for (int i = 0; i < match->npatterns; i++) {
+		positions++;
+		for (const char *p = match->patterns[i]; *p;) {
+			p = read_element(p, &star, set);
+			positions += !star;
+		}
+	}
+
+	int words = match->words = (positions + 63) / 64;
+	match->masks = calloc(256 * words + 3 * words, sizeof(uint64_t));
+	if (!match->masks) {
+		perror("mindmap");
+		exit(EXIT_FAILURE);
+	}
+	match->loops = match->masks + 256 * words;
+	match->start = match->loops + words;
+	match->accept = match->start + words;
+
+	// each pattern's first position is only ever set by start, so no bit
+	// moves on from the pattern before
+	int pos = 0;
+	for (int i = 0; i < match->npatterns; i++, pos++) {
+		set_bit(match->start, pos);
+		for (const char *p = match->patterns[i]; *p;) {
+			p = read_element(p, &star, set);
+			if (star) {
+				set_bit(match->loops, pos);
+				continue;
+			}
+			pos++;
+			for (int c = 0; c < 256; c++) {
+				if (set[c])
+					set_bit(match->masks + c * words, pos);
+			}
+		}
+		set_bit(match->accept, pos);
+	}
+}
+
+/**
+ * Whether a name matches any of the patterns
+ * @param  match compiled
+ * @param  name  [description]
+ * @return       [description]
+ */
+bool namematch_test(const struct namematch *match, const char *name) {
+	const unsigned char *p = (const unsigned char *)name;
+	int words = match->words;
+
+	if (words == 0)
+		return false;
+	if (words == 1) {
+		uint64_t state = match->start[0], loops = match->loops[0];
+
+		for (; *p && state; p++)
+			state = (state << 1 & match->masks[*p]) | (state & loops);
+		return state & match->accept[0];
+	}
+
+	uint64_t stack[STACK_WORDS];
+	uint64_t *state = words <= STACK_WORDS
+						  ? stack
+						  : xrealloc(NULL, words * sizeof(*state));
+	bool live = true;
+
+	memcpy(state, match->start, words * sizeof(*state));
+	for (; *p && live; p++) {
+		const uint64_t *mask = match->masks + *p * words;
+		uint64_t carry = 0;
+
+		live = false;
+		for (int w = 0; w < words; w++) {
+			uint64_t next = (state[w] << 1 | carry) & mask[w];
+			carry = state[w] >> 63;
+			state[w] = next | (state[w] & match->loops[w]);
+			live |= state[w] != 0;
+		}
+	}
+
+	bool matched = false;
+	for (int w = 0; w < words && live; w++)
+		matched |= (state[w] & match->accept[w]) != 0;
+	if (state != stack)
+		free(state);
+	return matched;
+}
+
+void namematch_free(struct namematch *match) {
+	free(match->patterns);
+	free(match->masks);
+	*match = (struct namematch){0};
+}
@@ -0,0 +1,32 @@
+#ifndef NAMEMATCH_H
+#define NAMEMATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Glob patterns on file names, for mindmap's -name and -prune: * and ?,
+ * bracket expressions with ranges and a leading ! or ^, and \ to quote.
+ * All the patterns added are compiled into one automaton that runs over
+ * a name once, byte by byte, without backtracking: the states are bits,
+ * one per pattern position, a * being a position that keeps its bit, and
+ * a byte advances every live position at once through a table of which
+ * positions it may move into. A name matches if it's in any accepting
+ * position at the end.
+ */
+struct namematch {
+	const char **patterns;
+	int npatterns;
+	int words; // of each state set
+	uint64_t *masks; // by byte, the positions it moves into
+	uint64_t *loops; // positions of a *, which any byte keeps
+	uint64_t *start;
+	uint64_t *accept;
+};
+
+void namematch_add(struct namematch *match, const char *pattern);
+void namematch_compile(struct namematch *match);
+bool namematch_test(const struct namematch *match, const char *name);
+void namematch_free(struct namematch *match);
+
+#endif
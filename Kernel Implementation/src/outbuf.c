@@ -0,0 +1,74 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "outbuf.h"
+
+void out_buffer_init(struct out_buffer *out, int fd, size_t cap) {
+	out->fd = fd;
+	out->cap = cap;
+	out->len = 0;
+	out->error = 0;
+	out->buf = malloc(cap);
+	if (!out->buf) {
+		perror("output buffer");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Write out everything buffered
+ * @param  out [description]
+ * @return     0, or -1 with errno set if a write failed now or before
+ */
+int out_buffer_flush(struct out_buffer *out) {
+	size_t done = 0;
+
+	while (done < out->len && !out->error) {
+		ssize_t n = write(out->fd, out->buf + done, out->len - done);
+		if (n == -1 && errno != EINTR)
+			out->error = errno;
+		else if (n > 0)
+			done += n;
+	}
+	out->len = 0;
+	if (out->error) {
+		errno = out->error;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Make room for len more bytes, to be filled in by the caller, who then
+ * adds what it used to out->len
+ * @param  out [description]
+ * @param  len [description]
+ * @return     where to put them
+ */
+char *out_buffer_reserve(struct out_buffer *out, size_t len) {
+	if (out->cap - out->len < len) {
+		out_buffer_flush(out);
+		if (len > out->cap) {
+			char *buf = realloc(out->buf, len);
+			if (!buf) {
+				perror("output buffer");
+				exit(EXIT_FAILURE);
+			}
+			out->buf = buf;
+			out->cap = len;
+		}
+	}
+	return out->buf + out->len;
+}
+
+void out_buffer_write(struct out_buffer *out, const void *data, size_t len) {
+	memcpy(out_buffer_reserve(out, len), data, len);
+	out->len += len;
+}
+
+void out_buffer_destroy(struct out_buffer *out) {
+	free(out->buf);
+	out->buf = NULL;
+}
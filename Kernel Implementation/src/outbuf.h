@@ -0,0 +1,29 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Block-buffered writer, the output side of lineread.h. Data is gathered in
+ * one large buffer and handed to write(2) a block at a time, bypassing
+ * stdio, so anything printed with stdio before has to be flushed first.
+ * After a failed write the rest is dropped, and out_buffer_flush reports it.
+ */
+#define OUT_BUFFER_SIZE (256 * 1024)
+
+struct out_buffer {
+	int fd;
+	char *buf;
+	size_t cap;
+	size_t len; // bytes waiting to be written
+	int error; // errno of a failed write, 0 if none
+};
+
+void out_buffer_init(struct out_buffer *out, int fd, size_t cap);
+char *out_buffer_reserve(struct out_buffer *out, size_t len);
+void out_buffer_write(struct out_buffer *out, const void *data, size_t len);
+int out_buffer_flush(struct out_buffer *out);
+void out_buffer_destroy(struct out_buffer *out);
+
+#endif
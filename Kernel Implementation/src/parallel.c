@@ -0,0 +1,401 @@
+#define _GNU_SOURCE // ppoll, pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "arena.h"
+#include "jobs.h"
+#include "lineread.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "timing.h"
+#include "util.h"
+
+#define PARALLEL_BLOCK_SIZE (64 * 1024)
+#define PARALLEL_ARENA_SIZE (16 * 1024)
+#define READ_CHUNK (64 * 1024)
+#define INITIAL_WINDOW 64
+
+// output of one input line, kept until every earlier line has been written
+struct output {
+	char *buf;
+	size_t len;
+	size_t cap;
+	bool done;
+};
+
+struct slot {
+	struct job *job; // NULL when the line could not be started
+	int fd; // read end of the job's stdout, -1 after EOF
+	size_t seq; // input line number
+};
+
+/*
+ * Outputs of lines [next_print, next_seq) in a ring indexed by seq. It only
+ * grows past INITIAL_WINDOW when a slow job holds back many finished ones.
+ */
+static struct {
+	struct output *ring;
+	size_t cap;
+	size_t next_print;
+	size_t next_seq;
+	bool write_failed;
+} window;
+
+static volatile sig_atomic_t parallel_interrupted;
+
+static void parallel_sigint_handler(int sig) {
+	(void)sig;
+	parallel_interrupted = 1;
+}
+
+static struct output *output_of(size_t seq) {
+	return &window.ring[seq & (window.cap - 1)];
+}
+
+/**
+ * Reserve the output slot for the next input line, doubling the ring when
+ * every slot is in use
+ * @return sequence number of the line
+ */
+static size_t window_push() {
+	if (window.next_seq - window.next_print == window.cap) {
+		size_t cap = window.cap * 2;
+		struct output *ring = xrealloc(NULL, cap * sizeof(struct output));
+
+		for (size_t seq = window.next_print; seq < window.next_seq; seq++)
+			ring[seq & (cap - 1)] = *output_of(seq);
+		free(window.ring);
+		window.ring = ring;
+		window.cap = cap;
+	}
+
+	struct output *out = output_of(window.next_seq);
+	memset(out, 0, sizeof(*out));
+	return window.next_seq++;
+}
+
+static void write_stdout(const char *buf, size_t len) {
+	while (len > 0 && !window.write_failed) {
+		ssize_t n = write(STDOUT_FILENO, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			window.write_failed = true; // keep running, drop the output
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+static void buffer_output(struct output *out, const char *buf, size_t len) {
+	if (out->len + len > out->cap) {
+		out->cap = out->cap ? out->cap * 2 : READ_CHUNK;
+		while (out->cap < out->len + len)
+			out->cap *= 2;
+		out->buf = xrealloc(out->buf, out->cap);
+	}
+	memcpy(out->buf + out->len, buf, len);
+	out->len += len;
+}
+
+/**
+ * Write out everything that is now at the head of the window: finished
+ * outputs in order, then whatever the oldest running job has produced so far
+ */
+static void flush_window() {
+	while (window.next_print < window.next_seq) {
+		struct output *out = output_of(window.next_print);
+
+		write_stdout(out->buf, out->len);
+		free(out->buf);
+		out->buf = NULL;
+		out->len = out->cap = 0;
+
+		if (!out->done)
+			break; // the rest of this job streams straight through
+		window.next_print++;
+	}
+}
+
+/**
+ * Drain whatever is readable on a job's pipe
+ * @param slot [description]
+ */
+static void read_slot(struct slot *slot) {
+	char buf[READ_CHUNK];
+	ssize_t n;
+
+	for (;;) {
+		n = read(slot->fd, buf, sizeof(buf));
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		if (slot->seq == window.next_print)
+			write_stdout(buf, n);
+		else
+			buffer_output(output_of(slot->seq), buf, n);
+
+		if ((size_t)n < sizeof(buf))
+			return; // pipe drained, don't block on the next read
+	}
+
+	if (n == 0 || errno != EAGAIN) {
+		close(slot->fd);
+		slot->fd = -1;
+	}
+}
+
+/**
+ * Parse one input line and start it with its stdout on a new pipe
+ * @param  arena    scratch arena for the parse
+ * @param  line     input line, tokenized in place
+ * @param  null_fd  /dev/null, used as the job's stdin
+ * @param  slot     slot to fill
+ * @return          false if the line was blank or a comment
+ */
+static bool start_line(struct arena *arena, char *line, int null_fd,
+					   struct slot *slot) {
+	char *p = line;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == 0 || *p == '#')
+		return false;
+
+	struct command_t *command = arena_calloc(arena, sizeof(struct command_t));
+	parse_command(arena, line, command);
+
+	int pipefd[2];
+	slot->seq = window_push();
+	slot->job = NULL;
+	slot->fd = -1;
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1) {
+		printf("-%s: parallel: pipe: %s\n", sysname, strerror(errno));
+		arena_reset(arena);
+		return true;
+	}
+
+	// the job is the parallel's to wait for, a trailing & changes nothing
+	for (struct command_t *c = command; c; c = c->next)
+		c->background = false;
+
+	slot->job = start_pipeline(command, null_fd, pipefd[1], -1);
+	slot->fd = pipefd[0];
+	fcntl(slot->fd, F_SETFL, O_NONBLOCK);
+	close(pipefd[1]);
+
+	arena_reset(arena);
+	return true;
+}
+
+static bool job_failed(struct job *job) {
+	if (!job || job->nprocs == 0)
+		return true;
+
+	int status = job->procs[job->nprocs - 1].status;
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+static void interrupt_slots(struct slot *slots, int active) {
+	for (int i = 0; i < active; i++) {
+		struct job *job = slots[i].job;
+		if (!job)
+			continue;
+
+		if (job->pgid > 0) {
+			killpg(job->pgid, SIGINT);
+			continue;
+		}
+		for (int j = 0; j < job->nprocs; j++) {
+			if (job->procs[j].state != PROC_DONE)
+				kill(job->procs[j].pid, SIGINT);
+		}
+	}
+}
+
+/**
+ * Parse the -j option and the optional file argument
+ * @param  command  [description]
+ * @param  jobs_max set to the slot count
+ * @param  path     set to the file name, NULL for stdin
+ * @return          false after printing an error
+ */
+static bool parse_args(struct command_t *command, long *jobs_max,
+					   const char **path) {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*jobs_max = ncpu > 0 ? ncpu : 1;
+	*path = NULL;
+
+	for (int i = 1; command->args[i]; i++) {
+		const char *arg = command->args[i];
+
+		if (strncmp(arg, "-j", 2) == 0) {
+			const char *value = arg[2] ? arg + 2 : command->args[++i];
+			char *end;
+
+			if (value)
+				*jobs_max = strtol(value, &end, 10);
+			if (!value || *end != '\0' || *jobs_max <= 0) {
+				printf("-%s: parallel: -j: expected a positive number\n",
+					   sysname);
+				return false;
+			}
+		} else if (*path == NULL) {
+			*path = arg;
+		} else {
+			printf("-%s: parallel: usage: parallel [-j N] [file]\n",
+				   sysname);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int parallel_builtin(struct command_t *command) {
+	long jobs_max;
+	const char *path;
+
+	if (!parse_args(command, &jobs_max, &path))
+		return SUCCESS;
+
+	int fd = STDIN_FILENO;
+	if (path && (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		printf("-%s: parallel: %s: %s\n", sysname, path, strerror(errno));
+		return SUCCESS;
+	}
+
+	int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (null_fd == -1) {
+		printf("-%s: parallel: /dev/null: %s\n", sysname, strerror(errno));
+		if (path)
+			close(fd);
+		return SUCCESS;
+	}
+
+	struct sigaction sa, old_sa;
+	sigset_t block, old_mask, wait_mask;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = parallel_sigint_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, &old_sa);
+	parallel_interrupted = 0;
+
+	// children are only reaped while waiting in ppoll
+	sigemptyset(&block);
+	sigaddset(&block, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &block, &old_mask);
+	wait_mask = old_mask;
+	sigdelset(&wait_mask, SIGCHLD);
+	sigdelset(&wait_mask, SIGINT);
+
+	struct arena arena;
+	struct line_reader reader;
+	struct slot *slots = xrealloc(NULL, jobs_max * sizeof(struct slot));
+	struct pollfd *fds = xrealloc(NULL, jobs_max * sizeof(struct pollfd));
+	int *fd_slot = xrealloc(NULL, jobs_max * sizeof(int));
+	int active = 0;
+	size_t started = 0, failed = 0;
+	bool input_done = false, stopped = false;
+	char *line;
+
+	arena_init(&arena, PARALLEL_ARENA_SIZE);
+	line_reader_init(&reader, fd, PARALLEL_BLOCK_SIZE);
+	window.cap = INITIAL_WINDOW;
+	window.ring = xrealloc(NULL, window.cap * sizeof(struct output));
+	window.next_print = window.next_seq = 0;
+	window.write_failed = false;
+
+	fflush(stdout);
+	double start = timing_now();
+
+	for (;;) {
+		// refill free slots
+		while (!input_done && !stopped && active < jobs_max) {
+			if ((line = line_reader_next(&reader)) == NULL) {
+				input_done = true;
+				break;
+			}
+			if (start_line(&arena, line, null_fd, &slots[active])) {
+				active++;
+				started++;
+			}
+		}
+		fflush(stdout); // syntax errors from start_line
+
+		// retire jobs that exited and closed their output
+		for (int i = 0; i < active;) {
+			struct slot *slot = &slots[i];
+
+			if (slot->fd != -1 || (slot->job && !job_finished(slot->job))) {
+				i++;
+				continue;
+			}
+
+			failed += job_failed(slot->job);
+			if (slot->job)
+				job_release(slot->job);
+			output_of(slot->seq)->done = true;
+			*slot = slots[--active];
+		}
+		flush_window();
+
+		if (!input_done && !stopped && active < jobs_max)
+			continue; // a slot was freed, refill it first
+		if (active == 0)
+			break;
+
+		if (parallel_interrupted && !stopped) {
+			stopped = true;
+			interrupt_slots(slots, active);
+		}
+
+		int nfds = 0;
+		for (int i = 0; i < active; i++) {
+			if (slots[i].fd == -1)
+				continue;
+			fds[nfds].fd = slots[i].fd;
+			fds[nfds].events = POLLIN;
+			fd_slot[nfds++] = i;
+		}
+
+		// SIGCHLD and SIGINT only get through here
+		if (ppoll(fds, nfds, NULL, &wait_mask) <= 0)
+			continue;
+
+		for (int i = 0; i < nfds; i++) {
+			if (fds[i].revents)
+				read_slot(&slots[fd_slot[i]]);
+		}
+	}
+
+	double elapsed = timing_now() - start;
+
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	sigaction(SIGINT, &old_sa, NULL);
+
+	fprintf(stderr, "parallel: %zu jobs (%zu failed) in %.3f s, %.1f jobs/s\n",
+			started, failed, elapsed, elapsed > 0 ? started / elapsed : 0.0);
+
+	free(window.ring);
+	free(fd_slot);
+	free(fds);
+	free(slots);
+	line_reader_destroy(&reader);
+	arena_destroy(&arena);
+	close(null_fd);
+	if (path)
+		close(fd);
+	return SUCCESS;
+}
@@ -0,0 +1,17 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "shell.h"
+
+/*
+ * parallel [-j N] [file]: runs one command line per input line, with at
+ * most N of them (default: online CPUs) in flight. A new line is read and
+ * started as soon as a slot frees up, so the queue never holds more than N
+ * jobs. Each job's stdout goes through its own pipe and is written in input
+ * order: the oldest running job streams straight through, later ones are
+ * buffered until everything before them has been written. Jobs read from
+ * /dev/null. Wall time and throughput are reported on stderr at the end.
+ */
+int parallel_builtin(struct command_t *command);
+
+#endif
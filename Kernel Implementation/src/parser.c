@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include "shell.h"
+
+/**
+ * Prints a command struct
+ * @param struct command_t *
+ */
+void print_command(struct command_t *command) {
+	int i = 0;
+	printf("Command: <%s>\n", command->name);
+	printf("\tIs Background: %s\n", command->background ? "yes" : "no");
+	printf("\tNeeds Auto-complete: %s\n",
+		   command->auto_complete ? "yes" : "no");
+	printf("\tRedirects:\n");
+
+	for (i = 0; i < 3; i++) {
+		printf("\t\t%d: %s\n", i,
+			   command->redirects[i] ? command->redirects[i] : "N/A");
+	}
+
+	printf("\tArguments (%d):\n", command->arg_count);
+
+	for (i = 0; i < command->arg_count; ++i) {
+		printf("\t\tArg %d: %s\n", i, command->args[i]);
+	}
+
+	if (command->next) {
+		printf("\tPiped to:\n");
+		print_command(command->next);
+	}
+}
+
+static bool is_splitter(char c) {
+	return c == ' ' || c == '\t';
+}
+
+enum token_kind {
+	TOKEN_END = -2,
+	TOKEN_PIPE = -1,
+	// redirections use their redirects[] index as the kind
+	TOKEN_REDIRECT_IN = 0, // <
+	TOKEN_REDIRECT_OUT = 1, // >
+	TOKEN_REDIRECT_APPEND = 2, // >>
+	TOKEN_WORD = 3,
+};
+
+struct tokenizer {
+	char *cursor; // read position
+	enum token_kind pending; // operator that ended the previous word
+};
+
+static bool is_operator(char c) {
+	return c == '|' || c == '<' || c == '>';
+}
+
+/**
+ * Read the operator at *r and step over it
+ * @param  r [description]
+ * @return   kind of the operator
+ */
+static enum token_kind read_operator(char **r) {
+	char c = *(*r)++;
+
+	if (c == '|')
+		return TOKEN_PIPE;
+	if (c == '<')
+		return TOKEN_REDIRECT_IN;
+	if (**r == '>') {
+		(*r)++;
+		return TOKEN_REDIRECT_APPEND;
+	}
+	return TOKEN_REDIRECT_OUT;
+}
+
+/**
+ * Cut the next token out of the line in place. Quotes are removed by
+ * shifting the rest of the word left, so a quoted argument may contain
+ * whitespace or operator characters. An unquoted '|', '<', '>' or '>>'
+ * always ends a word and comes back as a token of its own, so "ls|wc" and
+ * "sort<in" split as in sh. Words are NUL-terminated inside the line
+ * buffer itself.
+ * @param  t      tokenizer state
+ * @param  word   set to the word for TOKEN_WORD
+ * @param  quoted set if any part of the word was quoted
+ * @return        kind of the token, TOKEN_END at the end of the line
+ */
+static enum token_kind next_token(struct tokenizer *t, char **word,
+								  bool *quoted) {
+	char *r = t->cursor, *w;
+	enum token_kind kind;
+
+	*quoted = false;
+
+	if (t->pending != TOKEN_END) {
+		kind = t->pending;
+		t->pending = TOKEN_END;
+		return kind;
+	}
+
+	while (is_splitter(*r))
+		r++;
+
+	if (*r == 0) {
+		t->cursor = r;
+		return TOKEN_END;
+	}
+
+	if (is_operator(*r)) {
+		kind = read_operator(&r);
+		t->cursor = r;
+		return kind;
+	}
+
+	*word = w = r;
+
+	while (*r && !is_splitter(*r)) {
+		if (is_operator(*r)) {
+			// the NUL below may overwrite it, so remember it instead
+			t->pending = read_operator(&r);
+			break;
+		}
+		if (*r == '"' || *r == '\'') {
+			char *close = strchr(r + 1, *r);
+			if (close) {
+				size_t n = close - (r + 1);
+				memmove(w, r + 1, n);
+				w += n;
+				r = close + 1;
+				*quoted = true;
+				continue;
+			}
+		}
+		*w++ = *r++;
+	}
+
+	if (is_splitter(*r))
+		r++; // step over the splitter before terminating
+	*w = 0;
+	t->cursor = r;
+	return TOKEN_WORD;
+}
+
+/**
+ * Terminate the argument vector of a pipeline stage
+ * @param arena   [description]
+ * @param command stage being closed
+ * @param argc    number of words collected for the stage
+ */
+static void close_stage(struct arena *arena, struct command_t *command,
+						int argc) {
+	if (command->name == NULL) {
+		// no words at all, keep the old "" name / {"", NULL} args shape
+		command->name = arena_calloc(arena, 1);
+		command->args = arena_alloc(arena, 2 * sizeof(char *));
+		command->args[0] = command->name;
+		argc = 1;
+	}
+
+	command->args[argc] = NULL;
+	command->arg_count = argc + 1;
+}
+
+/**
+ * Parse a command string into a command struct. The string is tokenized in
+ * place: name, args and redirects all point into buf, and the argument
+ * vectors and pipeline stages are carved out of the arena, so buf and the
+ * arena must outlive the command. Nothing has to be freed individually.
+ * @param  arena   per-line arena
+ * @param  buf     [description]
+ * @param  command zeroed command struct
+ * @return         0
+ */
+int parse_command(struct arena *arena, char *buf, struct command_t *command) {
+	size_t len;
+	bool auto_complete, background, quoted;
+
+	// trim left whitespace
+	while (is_splitter(*buf))
+		buf++;
+
+	// trim right whitespace
+	len = strlen(buf);
+	while (len > 0 && is_splitter(buf[len - 1]))
+		buf[--len] = 0;
+
+	auto_complete = len > 0 && buf[len - 1] == '?';
+	background = len > 0 && buf[len - 1] == '&';
+
+	// words are separated by a splitter or an operator, so a line has at
+	// most (len+1)/2 of them, and each stage needs one more slot for its NULL
+	size_t stages = 1;
+	for (char *p = buf; (p = strchr(p, '|')) != NULL; p++)
+		stages++;
+	char **argv =
+		arena_alloc(arena, sizeof(char *) * ((len + 1) / 2 + stages));
+	static char no_target[] = "";
+	struct command_t *c = command;
+	struct tokenizer t = {buf, TOKEN_END};
+	enum token_kind kind;
+	char *tok = NULL;
+	int argc = 0;
+	int pending_redirect = -1; // redirection waiting for its target word
+
+	c->args = argv;
+	c->auto_complete = auto_complete;
+	c->background = background;
+
+	while ((kind = next_token(&t, &tok, &quoted)) != TOKEN_END) {
+		if (pending_redirect != -1) {
+			if (kind == TOKEN_WORD) {
+				c->redirects[pending_redirect] = tok;
+				pending_redirect = -1;
+				continue;
+			}
+			// "> |" keeps the empty target, reported when it is opened
+			pending_redirect = -1;
+		}
+
+		// piping to another command
+		if (kind == TOKEN_PIPE) {
+			close_stage(arena, c, argc);
+			argv += argc + 1;
+			argc = 0;
+
+			c->next = arena_calloc(arena, sizeof(struct command_t));
+			c = c->next;
+			c->args = argv;
+			c->auto_complete = auto_complete;
+			c->background = background;
+			continue;
+		}
+
+		// handle input/output redirection, "<file" or "< file"
+		if (kind != TOKEN_WORD) {
+			c->redirects[kind] = no_target;
+			pending_redirect = kind;
+			continue;
+		}
+
+		// background process, handled before
+		if (!quoted && strcmp(tok, "&") == 0)
+			continue;
+
+		if (c->name == NULL)
+			c->name = tok; // args[0] is the name, as required by exec
+		argv[argc++] = tok;
+	}
+
+	close_stage(arena, c, argc);
+	return 0;
+}
@@ -0,0 +1,287 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pathcache.h"
+#include "util.h"
+
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+#define INITIAL_BUCKETS 64
+
+struct path_entry {
+	struct path_entry *next;
+	unsigned int hash;
+	unsigned long hits;
+	int dir; // index of the PATH directory the command was found in
+	char *name;
+	char *path;
+};
+
+struct path_dir {
+	char *dir;
+	struct timespec mtime;
+};
+
+static struct {
+	char *path_env; // PATH the directory list was built from
+	struct path_dir *dirs;
+	int ndirs;
+	struct path_entry **buckets;
+	size_t nbuckets;
+	size_t count;
+} cache;
+
+static unsigned int hash_name(const char *s) {
+	unsigned int h = 2166136261u; // FNV-1a
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void dir_mtime(const char *dir, struct timespec *mtime) {
+	struct stat st;
+	if (stat(dir, &st) == 0) {
+		*mtime = st.st_mtim;
+	} else {
+		mtime->tv_sec = -1; // missing directories compare equal to each other
+		mtime->tv_nsec = 0;
+	}
+}
+
+static void snapshot_dirs() {
+	for (int i = 0; i < cache.ndirs; i++)
+		dir_mtime(cache.dirs[i].dir, &cache.dirs[i].mtime);
+}
+
+/**
+ * Drop all remembered locations, keeping the table itself
+ */
+void path_cache_clear() {
+	for (size_t i = 0; i < cache.nbuckets; i++) {
+		struct path_entry *e = cache.buckets[i], *next;
+		for (; e; e = next) {
+			next = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+		}
+		cache.buckets[i] = NULL;
+	}
+	cache.count = 0;
+	snapshot_dirs();
+}
+
+/**
+ * Rebuild the directory list if PATH differs from the one it was built
+ * from. An empty PATH component means the current directory, as in sh.
+ */
+static void sync_path() {
+	const char *env = getenv("PATH");
+	if (!env)
+		env = DEFAULT_PATH;
+
+	if (cache.path_env && strcmp(cache.path_env, env) == 0)
+		return;
+
+	for (int i = 0; i < cache.ndirs; i++)
+		free(cache.dirs[i].dir);
+	free(cache.dirs);
+	free(cache.path_env);
+
+	cache.path_env = strdup(env);
+	cache.ndirs = 1;
+	for (const char *p = env; *p; p++)
+		cache.ndirs += *p == ':';
+	cache.dirs = xcalloc(cache.ndirs, sizeof(struct path_dir));
+
+	const char *start = env;
+	for (int i = 0; i < cache.ndirs; i++) {
+		const char *end = strchr(start, ':');
+		size_t len = end ? (size_t)(end - start) : strlen(start);
+		cache.dirs[i].dir = len ? strndup(start, len) : strdup(".");
+		if (end)
+			start = end + 1;
+	}
+
+	if (!cache.buckets) {
+		cache.nbuckets = INITIAL_BUCKETS;
+		cache.buckets = xcalloc(cache.nbuckets, sizeof(struct path_entry *));
+	}
+	path_cache_clear();
+}
+
+static struct path_entry **find_slot(const char *name, unsigned int h) {
+	struct path_entry **slot = &cache.buckets[h & (cache.nbuckets - 1)];
+	while (*slot && ((*slot)->hash != h || strcmp((*slot)->name, name) != 0))
+		slot = &(*slot)->next;
+	return slot;
+}
+
+static void grow() {
+	size_t nbuckets = cache.nbuckets * 2;
+	struct path_entry **buckets = xcalloc(nbuckets, sizeof(struct path_entry *));
+
+	for (size_t i = 0; i < cache.nbuckets; i++) {
+		struct path_entry *e = cache.buckets[i], *next;
+		for (; e; e = next) {
+			next = e->next;
+			e->next = buckets[e->hash & (nbuckets - 1)];
+			buckets[e->hash & (nbuckets - 1)] = e;
+		}
+	}
+
+	free(cache.buckets);
+	cache.buckets = buckets;
+	cache.nbuckets = nbuckets;
+}
+
+/**
+ * A cached location is still right as long as none of the directories up
+ * to and including the one it was found in has changed: nothing can have
+ * been added in front of it, and it cannot have been removed.
+ * @param  e [description]
+ * @return   true if the entry can be used as is
+ */
+static bool entry_valid(struct path_entry *e) {
+	struct timespec mtime;
+
+	for (int i = 0; i <= e->dir; i++) {
+		dir_mtime(cache.dirs[i].dir, &mtime);
+		if (mtime.tv_sec != cache.dirs[i].mtime.tv_sec ||
+			mtime.tv_nsec != cache.dirs[i].mtime.tv_nsec)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Resolve a command name to the absolute path execv should run
+ * @param  name command name without a '/'
+ * @return      path owned by the cache (valid until the next lookup), or
+ *              NULL if no executable of that name is in PATH
+ */
+const char *path_lookup(const char *name) {
+	static char candidate[PATH_MAX];
+	unsigned int h = hash_name(name);
+	struct path_entry **slot;
+	struct stat st;
+
+	sync_path();
+
+	slot = find_slot(name, h);
+	if (*slot) {
+		if (entry_valid(*slot)) {
+			(*slot)->hits++;
+			return (*slot)->path;
+		}
+		path_cache_clear();
+		slot = find_slot(name, h);
+	}
+
+	for (int i = 0; i < cache.ndirs; i++) {
+		const char *dir = cache.dirs[i].dir;
+		int n = snprintf(candidate, sizeof(candidate), "%s/%s", dir, name);
+		if (n < 0 || (size_t)n >= sizeof(candidate))
+			continue;
+		if (access(candidate, X_OK) != 0 || stat(candidate, &st) != 0 ||
+			!S_ISREG(st.st_mode))
+			continue;
+
+		// relative PATH entries depend on the cwd, never remember those
+		if (dir[0] != '/')
+			return candidate;
+
+		struct path_entry *e = xcalloc(1, sizeof(struct path_entry));
+		e->hash = h;
+		e->hits = 1;
+		e->dir = i;
+		e->name = strdup(name);
+		e->path = strdup(candidate);
+		*slot = e;
+
+		if (++cache.count > cache.nbuckets)
+			grow();
+		return e->path;
+	}
+
+	return NULL;
+}
+
+/**
+ * Forget a single command, e.g. after its cached path failed to exec
+ * @param name [description]
+ */
+void path_forget(const char *name) {
+	if (!cache.buckets)
+		return;
+
+	struct path_entry **slot = find_slot(name, hash_name(name));
+	struct path_entry *e = *slot;
+	if (e) {
+		*slot = e->next;
+		free(e->name);
+		free(e->path);
+		free(e);
+		cache.count--;
+	}
+}
+
+static void print_entries() {
+	if (cache.count == 0) {
+		printf("%s: hash table empty\n", sysname);
+		return;
+	}
+
+	printf("hits\tcommand\n");
+	for (size_t i = 0; i < cache.nbuckets; i++) {
+		for (struct path_entry *e = cache.buckets[i]; e; e = e->next)
+			printf("%4lu\t%s\n", e->hits, e->path);
+	}
+}
+
+/**
+ * hash            list remembered commands with their hit counts
+ * hash -r         forget everything
+ * hash -d name... forget the given commands
+ * hash name...    look the given commands up now
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int hash_builtin(struct command_t *command) {
+	int i = 1;
+	bool forget = false;
+
+	sync_path();
+
+	if (command->args[1] == NULL) {
+		print_entries();
+		return SUCCESS;
+	}
+
+	if (strcmp(command->args[1], "-r") == 0) {
+		path_cache_clear();
+		return SUCCESS;
+	}
+
+	if (strcmp(command->args[1], "-d") == 0) {
+		forget = true;
+		i++;
+	}
+
+	for (; command->args[i]; i++) {
+		const char *name = command->args[i];
+
+		if (forget) {
+			path_forget(name);
+		} else if (strchr(name, '/') == NULL && path_lookup(name) == NULL) {
+			printf("-%s: hash: %s: not found\n", sysname, name);
+		}
+	}
+
+	return SUCCESS;
+}
@@ -0,0 +1,17 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include "shell.h"
+
+/*
+ * Remembers where each command name was found in $PATH so repeated runs
+ * exec the absolute path directly. The whole table is dropped when PATH
+ * changes or when one of the directories searched to find an entry has a
+ * new mtime (a binary was added, removed or renamed there).
+ */
+const char *path_lookup(const char *name);
+void path_forget(const char *name);
+void path_cache_clear();
+int hash_builtin(struct command_t *command);
+
+#endif
@@ -0,0 +1,629 @@
+#define _GNU_SOURCE // memmem
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pathindex.h"
+#include "util.h"
+
+#define INDEX_MAGIC 0x3158444e49504d4dULL // "MMPINDX1"
+#define BLOCK_TRIGRAMS 4096 // slots of the set a block's trigrams go in
+
+struct index_header {
+	uint64_t magic;
+	uint64_t size; // of the whole file, to catch a truncated one
+	uint64_t root_len; // the root follows the header
+	uint64_t npaths, nblocks, ndirs, ntrigrams;
+	uint64_t blocks, data, dirs, trigrams, postings; // offsets
+};
+
+struct pathindex_trigram {
+	uint32_t key; // the three bytes, first one highest
+	uint32_t count; // blocks holding it
+	uint64_t offset; // of its block numbers in postings
+};
+
+// a trigram found in a block, while writing
+struct posting {
+	uint32_t key;
+	uint32_t block;
+};
+
+// a growing byte buffer, while writing
+struct bytes {
+	unsigned char *data;
+	size_t len, cap;
+};
+
+static unsigned char *bytes_reserve(struct bytes *b, size_t len) {
+	if (b->cap - b->len < len) {
+		b->cap = 2 * (b->len + len);
+		b->data = xrealloc(b->data, b->cap);
+	}
+	return b->data + b->len;
+}
+
+static void add_varint(struct bytes *b, uint64_t value) {
+	b->len += put_varint(bytes_reserve(b, VARINT_MAX), value);
+}
+
+static void put_bytes(struct bytes *b, const void *data, size_t len) {
+	memcpy(bytes_reserve(b, len), data, len);
+	b->len += len;
+}
+
+/**
+ * Read a varint, not past end
+ * @param  p     [description]
+ * @param  end   [description]
+ * @param  value [description]
+ * @return       past it, or NULL if it's cut off
+ */
+static const unsigned char *get_varint(const unsigned char *p,
+									   const unsigned char *end,
+									   uint64_t *value) {
+	*value = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		*value |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return p;
+	}
+	return NULL;
+}
+
+static uint32_t trigram(const char *p) {
+	const unsigned char *u = (const unsigned char *)p;
+	return (uint32_t)u[0] << 16 | u[1] << 8 | u[2];
+}
+
+/**
+ * Note the trigrams of a path that its block doesn't have yet
+ * @param  set      BLOCK_TRIGRAMS slots, UINT32_MAX when free
+ * @param  used     the slots taken, to free them for the next block
+ * @param  postings [description]
+ * @param  path     [description]
+ * @param  block    [description]
+ */
+static void add_trigrams(uint32_t *set, struct bytes *used,
+						 struct bytes *postings, const char *path,
+						 uint32_t block) {
+	size_t len = strlen(path);
+
+	for (size_t i = 0; i + 3 <= len; i++) {
+		uint32_t key = trigram(path + i);
+		size_t h = (key * 0x9e3779b1u) >> 20 & (BLOCK_TRIGRAMS - 1);
+
+		while (set[h] != UINT32_MAX && set[h] != key)
+			h = (h + 1) & (BLOCK_TRIGRAMS - 1);
+		if (set[h] == key)
+			continue;
+		// a full set makes for a few duplicate postings, dropped later
+		if (used->len / sizeof(uint32_t) < BLOCK_TRIGRAMS / 2) {
+			set[h] = key;
+			uint32_t slot = h;
+			put_bytes(used, &slot, sizeof(slot));
+		}
+		struct posting p = {key, block};
+		put_bytes(postings, &p, sizeof(p));
+	}
+}
+
+/**
+ * Sort postings by trigram, stably, so each trigram's blocks stay in
+ * order: two passes of radix sort on the 24-bit keys
+ * @param postings [description]
+ * @param n        [description]
+ */
+static void sort_postings(struct posting *postings, size_t n) {
+	struct posting *tmp = xrealloc(NULL, n * sizeof(*tmp) + 1);
+	struct posting *from = postings, *to = tmp;
+
+	for (int shift = 0; shift < 24; shift += 12) {
+		size_t count[4097] = {0};
+
+		for (size_t i = 0; i < n; i++)
+			count[(from[i].key >> shift & 0xfff) + 1]++;
+		for (int k = 0; k < 4096; k++)
+			count[k + 1] += count[k];
+		for (size_t i = 0; i < n; i++)
+			to[count[from[i].key >> shift & 0xfff]++] = from[i];
+
+		struct posting *t = from;
+		from = to;
+		to = t;
+	}
+	free(tmp);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+	const char *p = data;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Write an index, replacing file at once
+ * @param  file   [description]
+ * @param  root   [description]
+ * @param  paths  relative to root, in path_cmp order
+ * @param  npaths [description]
+ * @param  dirs   by path id, the root last
+ * @param  ndirs  [description]
+ * @return        0, or -1 with errno set
+ */
+int pathindex_write(const char *file, const char *root, const char **paths,
+					uint64_t npaths, const struct pathindex_dir *dirs,
+					uint64_t ndirs) {
+	struct index_header header = {.magic = INDEX_MAGIC};
+	struct bytes data = {0}, offsets = {0}, postings = {0}, used = {0};
+	struct bytes trigrams = {0}, lists = {0};
+	uint32_t *set = xrealloc(NULL, BLOCK_TRIGRAMS * sizeof(*set));
+	const char *prev = "";
+
+	memset(set, 0xff, BLOCK_TRIGRAMS * sizeof(*set));
+	for (uint64_t i = 0; i < npaths; i++) {
+		const char *path = paths[i];
+		size_t len = strlen(path), shared = 0;
+		uint32_t block = i / PATHINDEX_BLOCK;
+
+		if (i % PATHINDEX_BLOCK == 0) {
+			uint64_t offset = data.len;
+			put_bytes(&offsets, &offset, sizeof(offset));
+			for (size_t k = 0; k < used.len / sizeof(uint32_t); k++)
+				set[((uint32_t *)used.data)[k]] = UINT32_MAX;
+			used.len = 0;
+			add_varint(&data, len);
+		} else {
+			while (prev[shared] && prev[shared] == path[shared])
+				shared++;
+			add_varint(&data, shared);
+			add_varint(&data, len - shared);
+		}
+		put_bytes(&data, path + shared, len - shared);
+		add_trigrams(set, &used, &postings, path, block);
+		prev = path;
+	}
+	uint64_t end = data.len;
+	put_bytes(&offsets, &end, sizeof(end));
+	free(set);
+	free(used.data);
+
+	size_t n = postings.len / sizeof(struct posting);
+	struct posting *p = (struct posting *)postings.data;
+	sort_postings(p, n);
+	for (size_t i = 0; i < n;) {
+		struct pathindex_trigram t = {p[i].key, 0, lists.len};
+		uint32_t last = 0;
+
+		for (; i < n && p[i].key == t.key; i++) {
+			if (t.count && p[i].block == last)
+				continue;
+			add_varint(&lists, p[i].block - last);
+			last = p[i].block;
+			t.count++;
+		}
+		put_bytes(&trigrams, &t, sizeof(t));
+	}
+	free(postings.data);
+
+	// everything after the header and the root is 8-byte aligned
+	header.root_len = strlen(root);
+	header.npaths = npaths;
+	header.nblocks = offsets.len / sizeof(uint64_t) - 1;
+	header.ndirs = ndirs;
+	header.ntrigrams = trigrams.len / sizeof(struct pathindex_trigram);
+	header.blocks = (sizeof(header) + header.root_len + 7) & ~7ULL;
+	header.dirs = header.blocks + offsets.len;
+	header.trigrams = header.dirs + ndirs * sizeof(*dirs);
+	header.data = header.trigrams + trigrams.len;
+	header.postings = (header.data + data.len + 7) & ~7ULL;
+	header.size = header.postings + lists.len;
+
+	char tmp[PATH_MAX];
+	static const char pad[8];
+	int r = -1;
+	int fd = -1;
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid()) <
+		(int)sizeof(tmp))
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	else
+		errno = ENAMETOOLONG;
+	if (fd != -1 && write_all(fd, &header, sizeof(header)) == 0 &&
+		write_all(fd, root, header.root_len) == 0 &&
+		write_all(fd, pad, header.blocks - sizeof(header) - header.root_len) ==
+			0 &&
+		write_all(fd, offsets.data, offsets.len) == 0 &&
+		write_all(fd, dirs, ndirs * sizeof(*dirs)) == 0 &&
+		write_all(fd, trigrams.data, trigrams.len) == 0 &&
+		write_all(fd, data.data, data.len) == 0 &&
+		write_all(fd, pad, header.postings - header.data - data.len) == 0 &&
+		write_all(fd, lists.data, lists.len) == 0)
+		r = rename(tmp, file);
+
+	int error = errno;
+	if (fd != -1) {
+		close(fd);
+		if (r == -1)
+			unlink(tmp);
+	}
+	free(data.data);
+	free(offsets.data);
+	free(trigrams.data);
+	free(lists.data);
+	errno = error;
+	return r;
+}
+
+/**
+ * Map an index
+ * @param  index [description]
+ * @param  file  [description]
+ * @return       0, or -1 with errno set, EBADMSG if it isn't an index
+ */
+int pathindex_open(struct pathindex *index, const char *file) {
+	struct index_header h;
+	struct stat st;
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(h)) {
+		close(fd);
+		errno = EBADMSG;
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	// the sections have to lie in the file in order
+	memcpy(&h, map, sizeof(h));
+	if (h.magic != INDEX_MAGIC || h.size != (uint64_t)st.st_size ||
+		h.root_len > h.size || h.blocks < sizeof(h) + h.root_len ||
+		h.nblocks != (h.npaths + PATHINDEX_BLOCK - 1) / PATHINDEX_BLOCK ||
+		(h.dirs - h.blocks) / sizeof(uint64_t) != h.nblocks + 1 ||
+		(h.trigrams - h.dirs) / sizeof(struct pathindex_dir) != h.ndirs ||
+		(h.data - h.trigrams) / sizeof(struct pathindex_trigram) !=
+			h.ntrigrams ||
+		h.data > h.postings || h.postings > h.size) {
+		munmap(map, st.st_size);
+		errno = EBADMSG;
+		return -1;
+	}
+
+	index->map = map;
+	index->size = st.st_size;
+	index->root = (const char *)index->map + sizeof(h);
+	index->root_len = h.root_len;
+	index->npaths = h.npaths;
+	index->nblocks = h.nblocks;
+	index->ndirs = h.ndirs;
+	index->ntrigrams = h.ntrigrams;
+	index->blocks = (const uint64_t *)(index->map + h.blocks);
+	index->data = index->map + h.data;
+	index->dirs = (const struct pathindex_dir *)(index->map + h.dirs);
+	index->trigrams =
+		(const struct pathindex_trigram *)(index->map + h.trigrams);
+	index->postings = index->map + h.postings;
+	if (index->blocks[h.nblocks] > h.postings - h.data) {
+		pathindex_close(index);
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+}
+
+void pathindex_close(struct pathindex *index) {
+	munmap((void *)index->map, index->size);
+	index->map = NULL;
+}
+
+// where a block's paths are decoded
+struct path_buf {
+	char *path;
+	size_t cap;
+};
+
+/**
+ * Hand the paths of a block to fn
+ * @param  index [description]
+ * @param  block [description]
+ * @param  buf   [description]
+ * @param  fn    [description]
+ * @param  arg   [description]
+ * @return       false if fn asked to stop
+ */
+static bool decode_block(const struct pathindex *index, uint64_t block,
+						 struct path_buf *buf, pathindex_fn fn, void *arg) {
+	const unsigned char *p = index->data + index->blocks[block];
+	const unsigned char *end = index->data + index->blocks[block + 1];
+	uint64_t id = block * PATHINDEX_BLOCK;
+	size_t len = 0;
+
+	for (; p && p < end && id < index->npaths; id++) {
+		uint64_t shared = 0, rest;
+
+		if (id % PATHINDEX_BLOCK)
+			p = get_varint(p, end, &shared);
+		if (p)
+			p = get_varint(p, end, &rest);
+		// a damaged index ends the block
+		if (!p || shared > len || rest > (uint64_t)(end - p))
+			break;
+		if (shared + rest + 1 > buf->cap) {
+			buf->cap = 2 * (shared + rest + 1);
+			buf->path = xrealloc(buf->path, buf->cap);
+		}
+		memcpy(buf->path + shared, p, rest);
+		len = shared + rest;
+		buf->path[len] = '\0';
+		p += rest;
+		if (!fn(arg, id, buf->path, len))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Hand every path to fn, in order
+ * @param  index [description]
+ * @param  fn    [description]
+ * @param  arg   [description]
+ * @return       false if fn asked to stop
+ */
+bool pathindex_each(const struct pathindex *index, pathindex_fn fn,
+					void *arg) {
+	struct path_buf buf = {NULL, 0};
+	bool done = true;
+
+	for (uint64_t b = 0; b < index->nblocks && done; b++)
+		done = decode_block(index, b, &buf, fn, arg);
+	free(buf.path);
+	return done;
+}
+
+static const struct pathindex_trigram *find_trigram(
+	const struct pathindex *index, uint32_t key) {
+	size_t lo = 0, hi = index->ntrigrams;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->trigrams[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < index->ntrigrams && index->trigrams[lo].key == key
+			   ? &index->trigrams[lo]
+			   : NULL;
+}
+
+/**
+ * Decode the blocks holding a trigram
+ * @param  index  [description]
+ * @param  t      [description]
+ * @param  blocks room for t->count
+ * @return        how many there are
+ */
+static size_t posting_list(const struct pathindex *index,
+						   const struct pathindex_trigram *t,
+						   uint32_t *blocks) {
+	const unsigned char *p = index->postings + t->offset;
+	const unsigned char *end = index->map + index->size;
+	uint64_t block = 0, delta;
+	size_t n = 0;
+
+	if (t->offset > (uint64_t)(end - index->postings))
+		return 0;
+	for (; n < t->count && (p = get_varint(p, end, &delta)); n++) {
+		block += delta;
+		blocks[n] = block;
+	}
+	return n;
+}
+
+/**
+ * Collect the trigrams of the parts of a pattern that have to appear
+ * literally: all of it for a substring, the runs between wildcards and
+ * bracket expressions for a glob
+ * @param  pattern [description]
+ * @param  glob    [description]
+ * @param  keys    room for strlen(pattern) of them
+ * @return         how many there are
+ */
+static size_t pattern_trigrams(const char *pattern, bool glob,
+							   uint32_t *keys) {
+	size_t len = strlen(pattern), n = 0, run = 0;
+	char *lit = xrealloc(NULL, len + 1);
+
+	for (size_t i = 0; i <= len; i++) {
+		char c = pattern[i];
+		bool special = glob && (c == '*' || c == '?' || c == '[');
+
+		if (glob && c == '\\' && pattern[i + 1]) {
+			lit[run++] = pattern[++i];
+			continue;
+		}
+		if (c && !special) {
+			lit[run++] = c;
+			continue;
+		}
+		for (size_t k = 0; k + 3 <= run; k++)
+			keys[n++] = trigram(lit + k);
+		run = 0;
+		if (c == '[') {
+			// past the closing bracket, which may come first in the set
+			size_t j = i + 1;
+			if (pattern[j] == '!' || pattern[j] == '^')
+				j++;
+			if (pattern[j] == ']')
+				j++;
+			while (pattern[j] && pattern[j] != ']')
+				j++;
+			if (pattern[j])
+				i = j;
+		}
+	}
+	free(lit);
+	return n;
+}
+
+struct find_state {
+	const char *pattern;
+	size_t pattern_len;
+	bool glob;
+	const char *prefix;
+	size_t prefix_len;
+	pathindex_fn fn;
+	void *arg;
+	bool past; // beyond the paths below prefix
+};
+
+static bool find_path(void *arg, uint64_t id, const char *path, size_t len) {
+	struct find_state *s = arg;
+
+	if (s->prefix_len && strncmp(path, s->prefix, s->prefix_len) != 0) {
+		s->past = path_cmp(path, s->prefix) > 0;
+		return !s->past;
+	}
+	if (s->glob ? fnmatch(s->pattern, path, 0) != 0
+				: !memmem(path, len, s->pattern, s->pattern_len))
+		return true;
+	return s->fn(s->arg, id, path, len);
+}
+
+static int key_cmp(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Hand the paths matching a pattern to fn, in order. A pattern with any of
+ * *?[ is a glob matched against the whole path with fnmatch, where * also
+ * matches '/'; any other is a substring.
+ * @param  index   [description]
+ * @param  pattern [description]
+ * @param  prefix  only paths starting with it, or "" for all
+ * @param  fn      [description]
+ * @param  arg     [description]
+ * @return         false if fn asked to stop
+ */
+bool pathindex_find(const struct pathindex *index, const char *pattern,
+					const char *prefix, pathindex_fn fn, void *arg) {
+	struct find_state s = {
+		pattern, strlen(pattern), strpbrk(pattern, "*?[") != NULL,
+		prefix,	 strlen(prefix),  fn,
+		arg,	 false,
+	};
+	uint32_t *keys = xrealloc(NULL, (s.pattern_len + 1) * sizeof(*keys));
+	size_t nkeys = pattern_trigrams(pattern, s.glob, keys);
+	struct path_buf buf = {NULL, 0};
+	uint32_t *blocks = NULL;
+	size_t nblocks = 0;
+	bool all = nkeys == 0, done = true;
+
+	// the blocks holding every trigram: the rarest one's, less those
+	// missing from the others
+	qsort(keys, nkeys, sizeof(*keys), key_cmp);
+	const struct pathindex_trigram **ts =
+		xrealloc(NULL, (nkeys + 1) * sizeof(*ts));
+	size_t nts = 0;
+	for (size_t i = 0; i < nkeys; i++) {
+		if (i > 0 && keys[i] == keys[i - 1])
+			continue;
+		if (!(ts[nts] = find_trigram(index, keys[i])))
+			goto out;
+		if (ts[nts]->count < ts[0]->count) {
+			const struct pathindex_trigram *t = ts[0];
+			ts[0] = ts[nts];
+			ts[nts] = t;
+		}
+		nts++;
+	}
+	if (nts) {
+		blocks = xrealloc(NULL, ts[0]->count * sizeof(*blocks));
+		nblocks = posting_list(index, ts[0], blocks);
+		for (size_t k = 1; k < nts && nblocks; k++) {
+			const unsigned char *p = index->postings + ts[k]->offset;
+			const unsigned char *end = index->map + index->size;
+			uint64_t block = 0, delta;
+			size_t kept = 0, i = 0;
+
+			// walk the longer list without decoding all of it at once
+			for (uint32_t j = 0; j < ts[k]->count && i < nblocks; j++) {
+				if (!(p = get_varint(p, end, &delta)))
+					break;
+				block += delta;
+				while (i < nblocks && blocks[i] < block)
+					i++;
+				if (i < nblocks && blocks[i] == block)
+					blocks[kept++] = blocks[i++];
+			}
+			nblocks = kept;
+		}
+	}
+
+	// the paths below prefix start in the last block whose first path
+	// sorts before it
+	uint64_t first = 0;
+	if (s.prefix_len) {
+		uint64_t lo = 0, hi = index->nblocks;
+		while (lo < hi) {
+			uint64_t mid = lo + (hi - lo) / 2;
+			const unsigned char *p = index->data + index->blocks[mid];
+			const unsigned char *end = index->data + index->blocks[mid + 1];
+			uint64_t len;
+			char head[PATH_MAX];
+
+			if (!(p = get_varint(p, end, &len)) ||
+				len > (uint64_t)(end - p) || len >= sizeof(head))
+				len = 0;
+			memcpy(head, p ? (const char *)p : "", len);
+			head[len] = '\0';
+			if (path_cmp(head, prefix) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		first = lo > 0 ? lo - 1 : 0;
+	}
+
+	if (all) {
+		for (uint64_t b = first; b < index->nblocks && done && !s.past; b++)
+			done = decode_block(index, b, &buf, find_path, &s);
+	} else {
+		for (size_t i = 0; i < nblocks && done && !s.past; i++) {
+			if (blocks[i] >= first && blocks[i] < index->nblocks)
+				done = decode_block(index, blocks[i], &buf, find_path, &s);
+		}
+	}
+	// stopping at the end of the prefix isn't fn asking to
+	done = done || s.past;
+
+out:
+	free(ts);
+	free(keys);
+	free(blocks);
+	free(buf.path);
+	return done;
+}
@@ -0,0 +1,59 @@
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-disk index of the paths below a root, for mindex and mfind. The paths,
+ * relative to the root, are sorted by util.h's path_cmp ('/' below
+ * every other byte, so each directory is followed by its contents) and
+ * front coded in blocks of PATHINDEX_BLOCK: a block starts with a whole
+ * path, and every later one only stores how many bytes it shares with the
+ * one before and the rest. For every trigram (three consecutive bytes) of
+ * any path, the index lists the blocks holding it, as varint deltas, so a
+ * query only decodes the blocks that hold all trigrams of its literal
+ * parts. Directories are listed separately with their inode and mtime, for
+ * mindex to find the ones that changed since.
+ *
+ * The file is written elsewhere and renamed into place, and read through a
+ * read-only shared mapping, so queries never see half an index.
+ */
+#define PATHINDEX_BLOCK 32
+#define PATHINDEX_ROOT UINT64_MAX // the path id of the root directory
+
+struct pathindex_dir {
+	uint64_t path; // id, the position among the sorted paths
+	uint64_t dev, ino;
+	int64_t mtime_ns; // 0 when it has to be read again regardless
+};
+
+struct pathindex {
+	const unsigned char *map;
+	size_t size;
+	const char *root; // not NUL-terminated, see root_len
+	size_t root_len;
+	uint64_t npaths, nblocks, ndirs, ntrigrams;
+	const uint64_t *blocks; // offsets into data, nblocks + 1 of them
+	const unsigned char *data;
+	const struct pathindex_dir *dirs; // by path id, the root last
+	const struct pathindex_trigram *trigrams; // by key
+	const unsigned char *postings;
+};
+
+// called with each path in order, path NUL-terminated; return false to stop
+typedef bool (*pathindex_fn)(void *arg, uint64_t id, const char *path,
+							 size_t len);
+
+int pathindex_write(const char *file, const char *root, const char **paths,
+					uint64_t npaths, const struct pathindex_dir *dirs,
+					uint64_t ndirs);
+int pathindex_open(struct pathindex *index, const char *file);
+void pathindex_close(struct pathindex *index);
+bool pathindex_each(const struct pathindex *index, pathindex_fn fn,
+					void *arg);
+bool pathindex_find(const struct pathindex *index, const char *pattern,
+					const char *prefix, pathindex_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE // pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "jobs.h"
+#include "launch.h"
+#include "pipeline.h"
+
+/**
+ * Run a builtin as a pipeline stage. Builtins are shell code, so this is
+ * the one place that still needs a real fork.
+ * @param  command  stage to run
+ * @param  in_fd    fd to become stdin, -1 to inherit
+ * @param  out_fd   fd to become stdout, -1 to inherit
+ * @param  other_fd read end of the next pipe, which this stage must not keep
+ * @param  pgid     process group to join, 0 to lead a new one, -1 to keep ours
+ * @param  tty      terminal to hand to the group, -1 to leave it alone
+ * @return          pid of the child, -1 on failure
+ */
+static pid_t fork_builtin(struct command_t *command, int in_fd, int out_fd,
+						  int other_fd, pid_t pgid, int tty) {
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		printf("-%s: fork: %s\n", sysname, strerror(errno));
+		return -1;
+	}
+
+	if (pid == 0) {
+		launch_child_setup(pgid, tty);
+		jobs_init_child();
+
+		if (in_fd != -1) {
+			dup2(in_fd, STDIN_FILENO);
+			close(in_fd);
+		}
+		if (out_fd != -1) {
+			dup2(out_fd, STDOUT_FILENO);
+			close(out_fd);
+		}
+		if (other_fd != -1)
+			close(other_fd);
+
+		// the job runs and reports for the whole pipeline; left set,
+		// background would start this stage as a job of its own again
+		command->next = NULL;
+		command->timed = false;
+		command->background = false;
+		process_command(command);
+		fflush(stdout);
+		_exit(0);
+	}
+
+	return pid;
+}
+
+/**
+ * Start every stage of the pipeline as one job without waiting for it.
+ * SIGCHLD stays blocked, as after job_create().
+ * @param  command first stage
+ * @param  in_fd   stdin of the first stage, -1 to inherit; not closed
+ * @param  out_fd  stdout of the last stage, -1 to inherit; not closed
+ * @param  tty     terminal to hand to the job, -1 to leave it alone
+ * @return         the job, NULL after a syntax error
+ */
+struct job *start_pipeline(struct command_t *command, int in_fd, int out_fd,
+						   int tty) {
+	struct command_t *c;
+	int stage = 0;
+
+	for (c = command; c; c = c->next) {
+		if (c->name[0] == '\0') {
+			printf("-%s: syntax error near unexpected token `|'\n", sysname);
+			return NULL;
+		}
+	}
+
+	struct job *job = job_create(command);
+
+	for (c = command; c; c = c->next, stage++) {
+		int pipefd[2] = {-1, c->next ? -1 : out_fd};
+
+		if (c->next && pipe2(pipefd, O_CLOEXEC) == -1) {
+			printf("-%s: pipe: %s\n", sysname, strerror(errno));
+			break;
+		}
+
+		pid_t pid =
+			is_builtin(c->name)
+				? fork_builtin(c, in_fd, pipefd[1], pipefd[0], job->pgid, tty)
+				: spawn_command(c, in_fd, pipefd[1], job->pgid, tty);
+
+		if (pid > 0)
+			job_add_process(job, stage, pid);
+
+		// the shell keeps neither end it handed to a child
+		if (in_fd != -1 && c != command)
+			close(in_fd);
+		if (pipefd[1] != -1 && c->next)
+			close(pipefd[1]);
+		in_fd = pipefd[0];
+	}
+
+	if (c != NULL && c != command)
+		close(in_fd); // read end left over after a failed pipe2
+
+	return job;
+}
+
+/**
+ * Start every stage of the pipeline as one job, then wait for it unless
+ * it runs in the background
+ * @param  command first stage
+ * @return         SUCCESS
+ */
+int run_pipeline(struct command_t *command) {
+	struct job *job = start_pipeline(
+		command, -1, -1, command->background ? -1 : shell_terminal);
+
+	return job ? job_launched(job) : SUCCESS;
+}
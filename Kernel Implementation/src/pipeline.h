@@ -0,0 +1,17 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "jobs.h"
+#include "shell.h"
+
+/*
+ * Runs the command_t->next chain built by parse_command as one job. All
+ * stages are started before any of them is waited for, they share one
+ * process group, and each child only keeps the pipe ends it was handed on
+ * 0 and 1. The shell's own descriptors are never redirected.
+ */
+int run_pipeline(struct command_t *command);
+struct job *start_pipeline(struct command_t *command, int in_fd, int out_fd,
+						   int tty);
+
+#endif
@@ -0,0 +1,601 @@
+#define _GNU_SOURCE // O_PATH
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/stat.h> // struct statx
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include "pwalk.h"
+#include "timing.h"
+#include "uring.h"
+#include "util.h"
+
+// listing directories is mostly waiting on the file system, so the pool is
+// larger than the number of CPUs
+#define THREADS_PER_CPU 2
+#define MIN_THREADS 4
+
+// each getdents64 call returns this many bytes worth of entries
+#define DIRENT_BUF (128 << 10)
+// statx requests in flight per worker
+#define STAT_BATCH 64
+// a stat taking longer than this went to the device: the directory's other
+// entries are likely uncached too and worth sending through io_uring,
+// where cached ones are quicker with plain fstatat
+#define COLD_STAT_SEC 20e-6
+
+// what getdents64 fills its buffer with
+struct linux_dirent64 {
+	ino_t d_ino;
+	off_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct pw_entry {
+	size_t name; // offset into the directory's names
+	int error; // errno of a failed stat, the entry is skipped
+	bool dir;
+	bool loop; // a link to the directory itself or one above it
+	struct pw_node *child;
+	struct pwalk_stat st; // with need_stat
+};
+
+struct file_id {
+	dev_t dev;
+	ino_t ino;
+};
+
+/*
+ * A directory. Its worker fills in the entries and sets done; the visiting
+ * thread then reads them and frees the node. The directory stays open for
+ * its subdirectories' openat until refs, one for the listing and one per
+ * subdirectory still to be opened, drops to zero.
+ */
+struct pw_node {
+	struct pw_node *parent;
+	const char *name; // in the parent's names, or the root itself
+	int level; // of its entries
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	struct file_id *above; // the root's parent directories, up to /
+	size_t nabove;
+	_Atomic int refs;
+	int error; // errno of a failed open
+	struct pw_entry *entries;
+	size_t n, cap;
+	char *names;
+	size_t names_len, names_cap;
+	_Atomic bool done;
+};
+
+// owner pushes and pops at the tail, thieves take from the head
+struct deque {
+	pthread_mutex_t lock;
+	struct pw_node **items;
+	size_t head, tail, cap; // head and tail grow, items are taken mod cap
+};
+
+struct pool {
+	struct deque *deques;
+	int nthreads;
+	bool follow_links;
+	bool need_stat;
+	int depth;
+	struct pwalker *walker; // for prune and opened, called from the workers
+	_Atomic long outstanding; // nodes pushed and not yet listed
+	_Atomic long queued; // nodes sitting in a deque
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond; // work arrived or everything is done
+	pthread_mutex_t done_lock;
+	pthread_cond_t done_cond; // a node is done
+	bool visitor_waiting;
+};
+
+struct worker {
+	struct pool *pool;
+	int id;
+	char *dirents; // DIRENT_BUF bytes
+	struct uring ring;
+	int ring_state; // 0 until needed, 1 once set up, -1 if unavailable
+	size_t *unknown; // entries whose type needs a stat
+	size_t unknown_cap;
+};
+
+static void deque_push(struct deque *q, struct pw_node *node) {
+	pthread_mutex_lock(&q->lock);
+	if (q->tail - q->head == q->cap) {
+		size_t cap = q->cap ? 2 * q->cap : 64;
+		struct pw_node **items = xrealloc(NULL, cap * sizeof(*items));
+
+		for (size_t i = q->head; i < q->tail; i++)
+			items[i % cap] = q->items[i % q->cap];
+		free(q->items);
+		q->items = items;
+		q->cap = cap;
+	}
+	q->items[q->tail++ % q->cap] = node;
+	pthread_mutex_unlock(&q->lock);
+}
+
+static struct pw_node *deque_pop(struct deque *q) {
+	struct pw_node *node = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->tail != q->head)
+		node = q->items[--q->tail % q->cap];
+	pthread_mutex_unlock(&q->lock);
+	return node;
+}
+
+static struct pw_node *deque_steal(struct deque *q) {
+	struct pw_node *node = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->tail != q->head)
+		node = q->items[q->head++ % q->cap];
+	pthread_mutex_unlock(&q->lock);
+	return node;
+}
+
+static void node_unref(struct pw_node *node) {
+	if (atomic_fetch_sub(&node->refs, 1) == 1 && node->fd != -1)
+		close(node->fd);
+}
+
+static void add_entry(struct pw_node *node, const char *name, int error,
+					  bool dir) {
+	size_t len = strlen(name) + 1;
+
+	if (node->n == node->cap) {
+		node->cap = node->cap ? 2 * node->cap : 16;
+		node->entries =
+			xrealloc(node->entries, node->cap * sizeof(*node->entries));
+	}
+	if (node->names_len + len > node->names_cap) {
+		while (node->names_len + len > node->names_cap)
+			node->names_cap = node->names_cap ? 2 * node->names_cap : 256;
+		node->names = xrealloc(node->names, node->names_cap);
+	}
+	memcpy(node->names + node->names_len, name, len);
+	node->entries[node->n++] = (struct pw_entry){
+		.name = node->names_len,
+		.error = error,
+		.dir = dir,
+	};
+	node->names_len += len;
+}
+
+// whether the directory dev, ino is node or one of its ancestors
+static bool is_ancestor(const struct pw_node *node, dev_t dev, ino_t ino) {
+	for (;; node = node->parent) {
+		if (node->dev == dev && node->ino == ino)
+			return true;
+		if (!node->parent)
+			break;
+	}
+	for (size_t i = 0; i < node->nabove; i++) {
+		if (node->above[i].dev == dev && node->above[i].ino == ino)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Collect the directories above the root by following "..", so that a
+ * link to one of them isn't followed either: it leads back to the root.
+ * @param node the root, opened
+ */
+static void find_above(struct pw_node *node) {
+	struct file_id last = {node->dev, node->ino};
+	int fd = node->fd;
+	size_t cap = 0;
+	struct stat st;
+
+	for (;;) {
+		int up = openat(fd, "..", O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (fd != node->fd)
+			close(fd);
+		if (up == -1)
+			return;
+		if (fstat(up, &st) == -1 ||
+			(st.st_dev == last.dev && st.st_ino == last.ino)) {
+			close(up);
+			return;
+		}
+
+		if (node->nabove == cap) {
+			cap = cap ? 2 * cap : 16;
+			node->above = xrealloc(node->above, cap * sizeof(*node->above));
+		}
+		last = (struct file_id){st.st_dev, st.st_ino};
+		node->above[node->nabove++] = last;
+		fd = up;
+	}
+}
+
+static void stat_done(struct pw_node *node, struct pw_entry *e, mode_t mode,
+					  const struct pwalk_stat *st) {
+	e->error = 0;
+	e->dir = S_ISDIR(mode);
+	e->st = *st;
+	// a link back up the tree is shown but not followed
+	e->loop = e->dir && is_ancestor(node, st->dev, st->ino);
+}
+
+static void stat_one(struct pool *pool, struct pw_node *node,
+					 struct pw_entry *e) {
+	int flags = pool->follow_links ? 0 : AT_SYMLINK_NOFOLLOW;
+	struct stat st;
+
+	if (fstatat(node->fd, node->names + e->name, &st, flags) == -1) {
+		e->error = errno;
+		e->dir = false;
+		return;
+	}
+
+	struct pwalk_stat pst = {
+		st.st_dev, st.st_ino, st.st_nlink, st.st_blocks,
+		st.st_mode, st.st_size, st.st_mtim,
+	};
+	stat_done(node, e, st.st_mode, &pst);
+}
+
+/**
+ * Stat the entries d_type left open, or all of them with need_stat. When
+ * the first one had to wait for the device, the rest go to the kernel
+ * through a ring STAT_BATCH at a time, so a slow device sees them all at
+ * once rather than one after another; a failed one is retried with
+ * fstatat for its errno.
+ * @param worker [description]
+ * @param node   [description]
+ * @param n      the number of entries in worker->unknown
+ */
+static void stat_unknown(struct worker *worker, struct pw_node *node,
+						 size_t n) {
+	struct pool *pool = worker->pool;
+	struct statx stx[STAT_BATCH];
+
+	double start_time = timing_now();
+	stat_one(pool, node, &node->entries[worker->unknown[0]]);
+	bool cold = timing_now() - start_time > COLD_STAT_SEC;
+
+	if (cold && worker->ring_state == 0 && n > 2)
+		worker->ring_state =
+			uring_init(&worker->ring, STAT_BATCH) == 0 ? 1 : -1;
+	if (!cold || worker->ring_state != 1 || n <= 2) {
+		for (size_t i = 1; i < n; i++)
+			stat_one(pool, node, &node->entries[worker->unknown[i]]);
+		return;
+	}
+
+	for (size_t start = 1; start < n; start += STAT_BATCH) {
+		size_t batch = n - start < STAT_BATCH ? n - start : STAT_BATCH;
+		size_t submitted = 0;
+
+		for (size_t i = 0; i < batch; i++) {
+			struct pw_entry *e = &node->entries[worker->unknown[start + i]];
+			struct io_uring_sqe *sqe = uring_sqe(&worker->ring);
+
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = node->fd;
+			sqe->addr = (unsigned long)(node->names + e->name);
+			sqe->len = STATX_BASIC_STATS;
+			sqe->off = (unsigned long)&stx[i];
+			sqe->statx_flags = pool->follow_links ? 0 : AT_SYMLINK_NOFOLLOW;
+			sqe->user_data = i;
+		}
+		while (submitted < batch) {
+			int r = uring_submit(&worker->ring, batch - submitted);
+			if (r == -1) {
+				perror("mindmap: io_uring_enter");
+				exit(EXIT_FAILURE);
+			}
+
+			struct io_uring_cqe *cqe;
+			while ((cqe = uring_cqe(&worker->ring)) != NULL) {
+				size_t i = cqe->user_data;
+				struct pw_entry *e =
+					&node->entries[worker->unknown[start + i]];
+
+				if (cqe->res < 0) {
+					stat_one(pool, node, e);
+				} else {
+					struct pwalk_stat st = {
+						makedev(stx[i].stx_dev_major, stx[i].stx_dev_minor),
+						stx[i].stx_ino,
+						stx[i].stx_nlink,
+						stx[i].stx_blocks,
+						stx[i].stx_mode,
+						stx[i].stx_size,
+						{stx[i].stx_mtime.tv_sec, stx[i].stx_mtime.tv_nsec},
+					};
+					stat_done(node, e, stx[i].stx_mode, &st);
+				}
+				uring_seen(&worker->ring);
+				submitted++;
+			}
+		}
+	}
+}
+
+/**
+ * Open and read one directory, and push its subdirectories onto the
+ * worker's own deque, last first so that it carries on with the first
+ * @param worker [description]
+ * @param node   [description]
+ */
+static void list_node(struct worker *worker, struct pw_node *node) {
+	struct pool *pool = worker->pool;
+	int at = node->parent ? node->parent->fd : AT_FDCWD;
+	int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+	struct stat st;
+
+	// an entry replaced by a link since it was stat'ed isn't followed
+	if (node->parent && !pool->follow_links)
+		flags |= O_NOFOLLOW;
+	node->fd = openat(at, node->name, flags);
+	if (node->fd != -1 && fstat(node->fd, &st) == 0) {
+		node->dev = st.st_dev;
+		node->ino = st.st_ino;
+		if (!node->parent)
+			find_above(node);
+	} else {
+		node->error = errno;
+		if (node->fd != -1)
+			close(node->fd);
+		node->fd = -1;
+	}
+	if (node->fd != -1 && pool->walker->opened)
+		pool->walker->opened(pool->walker, node->fd);
+	if (node->parent)
+		node_unref(node->parent);
+
+	size_t unknown = 0;
+	long nread;
+	while (node->fd != -1 &&
+		   (nread = syscall(SYS_getdents64, node->fd, worker->dirents,
+							DIRENT_BUF)) > 0) {
+		for (long off = 0; off < nread;) {
+			struct linux_dirent64 *d =
+				(struct linux_dirent64 *)(worker->dirents + off);
+			off += d->d_reclen;
+
+			if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+				continue;
+			// pruned entries are never stat'ed or opened
+			if (pool->walker->prune &&
+				pool->walker->prune(pool->walker, d->d_name))
+				continue;
+			add_entry(node, d->d_name, 0, d->d_type == DT_DIR);
+			if (!pool->need_stat && d->d_type != DT_UNKNOWN &&
+				(d->d_type != DT_LNK || !pool->follow_links))
+				continue;
+
+			if (unknown == worker->unknown_cap) {
+				worker->unknown_cap =
+					worker->unknown_cap ? 2 * worker->unknown_cap : 64;
+				worker->unknown =
+					xrealloc(worker->unknown,
+							 worker->unknown_cap * sizeof(*worker->unknown));
+			}
+			worker->unknown[unknown++] = node->n - 1;
+		}
+	}
+	if (unknown)
+		stat_unknown(worker, node, unknown);
+
+	// directories at the last level asked for aren't opened
+	long subdirs = 0;
+	if (!pool->depth || node->level + 1 < pool->depth) {
+		for (size_t i = 0; i < node->n; i++)
+			subdirs += node->entries[i].dir;
+	}
+
+	atomic_store(&node->refs, 1 + subdirs);
+	for (size_t i = node->n; subdirs && i-- > 0;) {
+		struct pw_entry *e = &node->entries[i];
+		if (!e->dir)
+			continue;
+
+		e->child = xrealloc(NULL, sizeof(*e->child));
+		*e->child = (struct pw_node){
+			.parent = node,
+			.name = node->names + e->name,
+			.level = node->level + 1,
+			.fd = -1,
+		};
+		if (e->loop) {
+			e->child->error = ELOOP;
+			atomic_store(&e->child->done, true);
+			node_unref(node);
+		} else {
+			atomic_fetch_add(&pool->outstanding, 1);
+			deque_push(&pool->deques[worker->id], e->child);
+			atomic_fetch_add(&pool->queued, 1);
+		}
+	}
+	if (subdirs) {
+		pthread_mutex_lock(&pool->idle_lock);
+		pthread_cond_broadcast(&pool->idle_cond);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+
+	// the node may be freed as soon as it's done
+	node_unref(node);
+	pthread_mutex_lock(&pool->done_lock);
+	atomic_store(&node->done, true);
+	if (pool->visitor_waiting)
+		pthread_cond_signal(&pool->done_cond);
+	pthread_mutex_unlock(&pool->done_lock);
+}
+
+static struct pw_node *find_work(struct pool *pool, int id) {
+	struct pw_node *node = deque_pop(&pool->deques[id]);
+
+	for (int i = 1; !node && i < pool->nthreads; i++)
+		node = deque_steal(&pool->deques[(id + i) % pool->nthreads]);
+	if (node)
+		atomic_fetch_sub(&pool->queued, 1);
+	return node;
+}
+
+static void *walk_worker(void *arg) {
+	struct worker *worker = arg;
+	struct pool *pool = worker->pool;
+
+	worker->dirents = xrealloc(NULL, DIRENT_BUF);
+
+	for (;;) {
+		struct pw_node *node = find_work(pool, worker->id);
+
+		if (node) {
+			list_node(worker, node);
+			if (atomic_fetch_sub(&pool->outstanding, 1) == 1) {
+				pthread_mutex_lock(&pool->idle_lock);
+				pthread_cond_broadcast(&pool->idle_cond);
+				pthread_mutex_unlock(&pool->idle_lock);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->idle_lock);
+		while (atomic_load(&pool->queued) == 0 &&
+			   atomic_load(&pool->outstanding) > 0)
+			pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+		bool finished = atomic_load(&pool->outstanding) == 0;
+		pthread_mutex_unlock(&pool->idle_lock);
+		if (finished)
+			break;
+	}
+
+	if (worker->ring_state == 1)
+		uring_free(&worker->ring);
+	free(worker->dirents);
+	free(worker->unknown);
+	return NULL;
+}
+
+/**
+ * Hand a listed directory's entries to visit, and recurse into its
+ * subdirectories as they come, freeing each node once it's been visited
+ * @param  walker [description]
+ * @param  pool   [description]
+ * @param  node   [description]
+ * @param  level  [description]
+ * @return        the number of entries visited
+ */
+static long visit_node(struct pwalker *walker, struct pool *pool,
+					   struct pw_node *node, int level) {
+	long count = 0;
+
+	if (!atomic_load(&node->done)) {
+		pthread_mutex_lock(&pool->done_lock);
+		pool->visitor_waiting = true;
+		while (!atomic_load(&node->done))
+			pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+		pool->visitor_waiting = false;
+		pthread_mutex_unlock(&pool->done_lock);
+	}
+
+	if (node->error) {
+		struct pwalk_entry entry = {node->name, level - 1, true, NULL};
+		errno = node->error;
+		walker->error(walker, &entry, "Unable to open directory");
+	}
+	for (size_t i = 0; i < node->n; i++) {
+		struct pw_entry *e = &node->entries[i];
+		struct pwalk_entry entry = {
+			node->names + e->name,
+			level,
+			e->dir,
+			pool->need_stat ? &e->st : NULL,
+		};
+
+		if (e->error) {
+			errno = e->error;
+			walker->error(walker, &entry, "Unable to get file status");
+			continue;
+		}
+		walker->visit(walker, &entry);
+		count++;
+		if (e->child)
+			count += visit_node(walker, pool, e->child, level + 1);
+	}
+
+	free(node->entries);
+	free(node->names);
+	free(node->above);
+	free(node);
+	return count;
+}
+
+long pwalk_tree(struct pwalker *walker, const char *root) {
+	struct pool pool = {
+		.idle_lock = PTHREAD_MUTEX_INITIALIZER,
+		.idle_cond = PTHREAD_COND_INITIALIZER,
+		.done_lock = PTHREAD_MUTEX_INITIALIZER,
+		.done_cond = PTHREAD_COND_INITIALIZER,
+	};
+
+	pool.follow_links = walker->follow_links;
+	pool.need_stat = walker->need_stat;
+	pool.depth = walker->depth;
+	pool.walker = walker;
+	pool.nthreads = walker->threads;
+	if (pool.nthreads <= 0) {
+		pool.nthreads = THREADS_PER_CPU * sysconf(_SC_NPROCESSORS_ONLN);
+		if (pool.nthreads < MIN_THREADS)
+			pool.nthreads = MIN_THREADS;
+	}
+
+	pool.deques = xrealloc(NULL, pool.nthreads * sizeof(*pool.deques));
+	for (int i = 0; i < pool.nthreads; i++) {
+		pool.deques[i] = (struct deque){.items = NULL};
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+	}
+
+	struct pw_node *top = xrealloc(NULL, sizeof(*top));
+	*top = (struct pw_node){.name = root, .fd = -1};
+	pool.outstanding = 1;
+	pool.queued = 1;
+	deque_push(&pool.deques[0], top);
+
+	pthread_t *threads = xrealloc(NULL, pool.nthreads * sizeof(pthread_t));
+	struct worker *workers =
+		xrealloc(NULL, pool.nthreads * sizeof(struct worker));
+	int started = 0;
+	for (; started < pool.nthreads; started++) {
+		workers[started] = (struct worker){.pool = &pool, .id = started};
+		if (pthread_create(&threads[started], NULL, walk_worker,
+						   &workers[started]) != 0)
+			break;
+	}
+	if (started == 0) {
+		// no pool at all, list everything from this thread first
+		workers[0] = (struct worker){.pool = &pool, .id = 0};
+		walk_worker(&workers[0]);
+	}
+
+	long count = visit_node(walker, &pool, top, 0);
+
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	for (int i = 0; i < pool.nthreads; i++) {
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].items);
+	}
+	free(pool.deques);
+	free(workers);
+	free(threads);
+	return count;
+}
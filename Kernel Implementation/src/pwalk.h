@@ -0,0 +1,67 @@
+#ifndef PWALK_H
+#define PWALK_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Parallel directory walk for mindmap and hdiff -r. Directories are opened
+ * with openat relative to their parent's descriptor and read by a pool of
+ * threads, each taking work from its own deque and stealing from the
+ * others' when that runs dry. Directories are read with large getdents64
+ * batches, and entries are only stat'ed when asked to or when d_type can't
+ * tell a directory apart (followed symlinks, DT_UNKNOWN), in batches
+ * through io_uring where the kernel allows it. Names can be pruned as
+ * they're read, before any stat or open. The calling thread hands the
+ * entries to visit in readdir order, each directory right before its
+ * contents, waiting for directories the workers haven't listed yet. An
+ * entry that can't be stat'ed is reported and left out, and the rest of
+ * its directory is still visited.
+ */
+struct pwalk_stat {
+	dev_t dev;
+	ino_t ino;
+	nlink_t nlink;
+	blkcnt_t blocks; // 512-byte blocks allocated
+	mode_t mode;
+	off_t size;
+	struct timespec mtime;
+};
+
+struct pwalk_entry {
+	const char *name;
+	int level; // 0 for the root's own entries
+	bool dir;
+	const struct pwalk_stat *st; // with need_stat, else NULL
+};
+
+struct pwalker {
+	int threads; // 0 for the default
+	bool follow_links; // stat rather than lstat the entries
+	bool need_stat; // stat every entry, not just those d_type leaves open
+	int depth; // levels of entries to read, 0 for all
+	// if set and true for a name as it's read, that entry is left out,
+	// along with everything below it; called from the worker threads
+	bool (*prune)(struct pwalker *walker, const char *name);
+	// if set, handed every directory's descriptor once it's open, before
+	// it's read; called from the worker threads
+	void (*opened)(struct pwalker *walker, int fd);
+	void (*visit)(struct pwalker *walker, const struct pwalk_entry *entry);
+	// the directory entry (visited already, level -1 for the root) couldn't
+	// be opened or entry couldn't be stat'ed (and isn't visited), with errno
+	// set; what is the operation that failed
+	void (*error)(struct pwalker *walker, const struct pwalk_entry *entry,
+				  const char *what);
+	void *arg;
+};
+
+/**
+ * Walk the tree below root
+ * @param  walker [description]
+ * @param  root   [description]
+ * @return        the number of entries visited
+ */
+long pwalk_tree(struct pwalker *walker, const char *root);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <errno.h>
 #include <stdbool.h>
@@ -9,79 +10,54 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "shell.h"
+#include "timing.h"
+#include "lineread.h"
+#include "launch.h"
+#include "pathcache.h"
+#include "delta.h"
+#include "du.h"
+#include "hdiff.h"
+#include "jobs.h"
+#include "mgrep.h"
+#include "mindex.h"
+#include "namematch.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "pwalk.h"
+#include "treecache.h"
+#include "treeout.h"
 const char *sysname = "mishell";
 
-enum return_codes {
-	SUCCESS = 0,
-	EXIT = 1,
-	UNKNOWN = 2,
+#define LINE_ARENA_SIZE (64 * 1024)
+#define PROMPT_BUF_SIZE 4096
+#define SCRIPT_BLOCK_SIZE (256 * 1024)
+
+// holds the current line and everything parse_command builds from it
+static struct arena line_arena;
+
+int run_builtin(struct command_t *command);
+int time_builtin(struct command_t *command);
+const char *autocomplete_command(const char *buf);
+struct mindmap_options {
+    const char *directory;
+    bool rescan; // -f: walk afresh rather than from treecache.h
+    bool du; // --du: sizes per directory, see du.h
+    int top; // --top K: only the K largest directories
+    int depth; // --depth N: only N levels down
+    enum treeout_format format; // --format: see treeout.h
+    struct namematch names; // -name PATTERN: only entries matching one
+    struct namematch prunes; // -prune PATTERN: skip these and their subtrees
+    char type; // -type f|d: only files or directories
 };
 
-struct command_t {
-	char *name;
-	bool background;
-	bool auto_complete;
-	int arg_count;
-	char **args;
-	char *redirects[3]; // in/out redirection
-	struct command_t *next; // for piping
-};
-
-/**
- * Prints a command struct
- * @param struct command_t *
- */
-void print_command(struct command_t *command) {
-	int i = 0;
-	printf("Command: <%s>\n", command->name);
-	printf("\tIs Background: %s\n", command->background ? "yes" : "no");
-	printf("\tNeeds Auto-complete: %s\n",
-		   command->auto_complete ? "yes" : "no");
-	printf("\tRedirects:\n");
-
-	for (i = 0; i < 3; i++) {
-		printf("\t\t%d: %s\n", i,
-			   command->redirects[i] ? command->redirects[i] : "N/A");
-	}
-
-	printf("\tArguments (%d):\n", command->arg_count);
-
-	for (i = 0; i < command->arg_count; ++i) {
-		printf("\t\tArg %d: %s\n", i, command->args[i]);
-	}
-
-	if (command->next) {
-		printf("\tPiped to:\n");
-		print_command(command->next);
-	}
-}
-
-/**
- * Release allocated memory of a command
- * @param  command [description]
- * @return         [description]
- */
-int free_command(struct command_t *command) {
-	if (command->arg_count) {
-		for (int i = 0; i < command->arg_count; ++i)
-			free(command->args[i]);
-		free(command->args);
-	}
-
-	for (int i = 0; i < 3; ++i) {
-		if (command->redirects[i])
-			free(command->redirects[i]);
-	}
-
-	if (command->next) {
-		free_command(command->next);
-		command->next = NULL;
-	}
-
-	free(command->name);
-	free(command);
-	return 0;
-}
+void mindmap(const struct mindmap_options *options);
+bool parseMindmapOptions(struct command_t *command, struct mindmap_options *options);
+void freeMindmapOptions(struct mindmap_options *options);
+long exploreDirectory(struct treeout *out,
+                      const struct mindmap_options *options, bool *cached);
 
 /**
  * Show the command prompt
@@ -95,161 +71,6 @@ int show_prompt() {
 	return 0;
 }
 
-/**
- * Parse a command string into a command struct
- * @param  buf     [description]
- * @param  command [description]
- * @return         0
- */
-int parse_command(char *buf, struct command_t *command) {
-	const char *splitters = " \t"; // split at whitespace
-	int index, len;
-	len = strlen(buf);
-
-	// trim left whitespace
-	while (len > 0 && strchr(splitters, buf[0]) != NULL) {
-		buf++;
-		len--;
-	}
-
-	while (len > 0 && strchr(splitters, buf[len - 1]) != NULL) {
-		// trim right whitespace
-		buf[--len] = 0;
-	}
-
-	// auto-complete
-	if (len > 0 && buf[len - 1] == '?') {
-		command->auto_complete = true;
-	}
-
-	// background
-	if (len > 0 && buf[len - 1] == '&') {
-		command->background = true;
-	}
-
-	char *pch = strtok(buf, splitters);
-	if (pch == NULL) {
-		command->name = (char *)malloc(1);
-		command->name[0] = 0;
-	} else {
-		command->name = (char *)malloc(strlen(pch) + 1);
-		strcpy(command->name, pch);
-	}
-
-	command->args = (char **)malloc(sizeof(char *));
-
-	int redirect_index;
-	int arg_index = 0;
-	char temp_buf[1024], *arg;
-
-	while (1) {
-		// tokenize input on splitters
-		pch = strtok(NULL, splitters);
-		if (!pch)
-			break;
-		arg = temp_buf;
-		strcpy(arg, pch);
-		len = strlen(arg);
-
-		// empty arg, go for next
-		if (len == 0) {
-			continue;
-		}
-
-		// trim left whitespace
-		while (len > 0 && strchr(splitters, arg[0]) != NULL) {
-			arg++;
-			len--;
-		}
-
-		// trim right whitespace
-		while (len > 0 && strchr(splitters, arg[len - 1]) != NULL) {
-			arg[--len] = 0;
-		}
-
-		// empty arg, go for next
-		if (len == 0) {
-			continue;
-		}
-
-		// piping to another command
-		if (strcmp(arg, "|") == 0) {
-			struct command_t *c = malloc(sizeof(struct command_t));
-			int l = strlen(pch);
-			pch[l] = splitters[0]; // restore strtok termination
-			index = 1;
-			while (pch[index] == ' ' || pch[index] == '\t')
-				index++; // skip whitespaces
-
-			parse_command(pch + index, c);
-			pch[l] = 0; // put back strtok termination
-			command->next = c;
-			continue;
-		}
-
-		// background process
-		if (strcmp(arg, "&") == 0) {
-			// handled before
-			continue;
-		}
-
-		// handle input redirection
-		redirect_index = -1;
-		if (arg[0] == '<') {
-			redirect_index = 0;
-		}
-
-		if (arg[0] == '>') {
-			if (len > 1 && arg[1] == '>') {
-				redirect_index = 2;
-				arg++;
-				len--;
-			} else {
-				redirect_index = 1;
-			}
-		}
-
-		if (redirect_index != -1) {
-			command->redirects[redirect_index] = malloc(len);
-			strcpy(command->redirects[redirect_index], arg + 1);
-			continue;
-		}
-
-		// normal arguments
-		if (len > 2 &&
-			((arg[0] == '"' && arg[len - 1] == '"') ||
-			 (arg[0] == '\'' && arg[len - 1] == '\''))) // quote wrapped arg
-		{
-			arg[--len] = 0;
-			arg++;
-		}
-
-		command->args =
-			(char **)realloc(command->args, sizeof(char *) * (arg_index + 1));
-
-		command->args[arg_index] = (char *)malloc(len + 1);
-		strcpy(command->args[arg_index++], arg);
-	}
-	command->arg_count = arg_index;
-
-	// increase args size by 2
-	command->args = (char **)realloc(
-		command->args, sizeof(char *) * (command->arg_count += 2));
-
-	// shift everything forward by 1
-	for (int i = command->arg_count - 2; i > 0; --i) {
-		command->args[i] = command->args[i - 1];
-	}
-
-	// set args[0] as a copy of name
-	command->args[0] = strdup(command->name);
-
-	// set args[arg_count-1] (last) to NULL
-	command->args[command->arg_count - 1] = NULL;
-
-	return 0;
-}
-
 void prompt_backspace() {
 	putchar(8); // go back 1
 	putchar(' '); // write empty over
@@ -265,8 +86,8 @@ void prompt_backspace() {
 int prompt(struct command_t *command) {
 	size_t index = 0;
 	char c;
-	char buf[4096];
-	static char oldbuf[4096];
+	char *buf = arena_alloc(&line_arena, PROMPT_BUF_SIZE);
+	static char oldbuf[PROMPT_BUF_SIZE];
 
 	// tcgetattr gets the parameters of the current terminal
 	// STDIN_FILENO will tell tcgetattr that it should write the settings
@@ -316,7 +137,7 @@ int prompt(struct command_t *command) {
 				index--;
 			}
 
-			char tmpbuf[4096];
+			char tmpbuf[PROMPT_BUF_SIZE];
 			printf("%s", oldbuf);
 			strcpy(tmpbuf, buf);
 			strcpy(buf, oldbuf);
@@ -327,7 +148,7 @@ int prompt(struct command_t *command) {
 
 		putchar(c); // echo the character
 		buf[index++] = c;
-		if (index >= sizeof(buf) - 1)
+		if (index >= PROMPT_BUF_SIZE - 1)
 			break;
 		if (c == '\n') // enter key
 			break;
@@ -345,7 +166,7 @@ int prompt(struct command_t *command) {
 
 	strcpy(oldbuf, buf);
 
-	parse_command(buf, command);
+	parse_command(&line_arena, buf, command);
 
 	// print_command(command); // DEBUG: uncomment for debugging
 
@@ -354,87 +175,104 @@ int prompt(struct command_t *command) {
 	return SUCCESS;
 }
 
-int process_command(struct command_t *command);
-
-void handle_piping(char *input_command) {
-    char *splitters = "|";
-    char *pch;
-    struct command_t *first_command = NULL;
-    struct command_t *prev_command = NULL;
-
-    pch = strtok(input_command, splitters);
-    while (pch != NULL) {
-        struct command_t *c = malloc(sizeof(struct command_t));
-        parse_command(pch, c);
-
-        if (first_command == NULL) {
-            first_command = c;
-        } else {
-            prev_command->next = c;
-        }
-        prev_command = c;
+/**
+ * Parse and run a single non-interactive line. Blank lines and lines
+ * starting with '#' (including a #! header) are skipped.
+ * @param  line NUL-terminated line, tokenized in place
+ * @return      SUCCESS, or EXIT if the line asked the shell to exit
+ */
+int run_line(char *line) {
+	char *p = line;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == 0 || *p == '#')
+		return SUCCESS;
 
-        pch = strtok(NULL, splitters);
-    }
+	struct command_t *command =
+		arena_calloc(&line_arena, sizeof(struct command_t));
+	parse_command(&line_arena, line, command);
 
-    // Now 'first_command' points to the first command in the pipeline
-    // 'prev_command' points to the last command in the pipeline
+	int code = process_command(command);
+	arena_reset(&line_arena);
+	jobs_notify(false);
+	return code;
+}
 
-    struct command_t *current_command = first_command;
-    int pipefd[2];
+/**
+ * Run commands from fd without any terminal handling: no termios, no
+ * prompt, input read in large blocks and fed straight to the parser.
+ * Commands started from a piped stdin script do not see the part of the
+ * script that has already been read ahead.
+ * @param fd script or pipe
+ */
+void run_script(int fd) {
+	struct line_reader reader;
+	char *line;
 
-    while (current_command != NULL) {
-        if (current_command->next != NULL) {
-            // Create pipe for communication between commands
-            if (pipe(pipefd) == -1) {
-                perror("Pipe creation failed");
-                exit(EXIT_FAILURE);
-            }
+	line_reader_init(&reader, fd, SCRIPT_BLOCK_SIZE);
+	while ((line = line_reader_next(&reader)) != NULL) {
+		if (run_line(line) == EXIT)
+			break;
+	}
+	line_reader_destroy(&reader);
+}
 
-            pid_t pid = fork();
-            if (pid == -1) {
-                perror("Fork failed");
-                exit(EXIT_FAILURE);
-            }
+/**
+ * Run the argument of -c, which may hold several newline separated lines
+ * @param cmd [description]
+ */
+void run_string(char *cmd) {
+	char *line = cmd, *nl;
+
+	while (line) {
+		nl = strchr(line, '\n');
+		if (nl)
+			*nl = 0;
+		if (run_line(line) == EXIT)
+			break;
+		line = nl ? nl + 1 : NULL;
+	}
+}
 
-            if (pid == 0) {
-                // Child process
-                close(pipefd[0]); // Close unused read end of pipe
-                dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to write end of pipe
-                close(pipefd[1]); // Close write end of pipe
-
-                // Execute current command
-                // For simplicity, assume execute_command function executes the command
-                process_command(current_command);
-
-                exit(EXIT_SUCCESS); // Exit child process
-            } else {
-                // Parent process
-                close(pipefd[1]); // Close write end of pipe
-                dup2(pipefd[0], STDIN_FILENO); // Redirect stdin to read end of pipe
-                close(pipefd[0]); // Close read end of pipe
-            }
-        } else {
-            // Last command in the pipeline, execute without creating pipe
-            process_command(current_command);
-        }
+int main(int argc, char *argv[]) {
+	arena_init(&line_arena, LINE_ARENA_SIZE);
 
-        current_command = current_command->next; // Move to next command in the pipeline
-    }
+	// job control only when a user is typing at a terminal
+	jobs_init(argc == 1 && isatty(STDIN_FILENO));
 
-    // Wait for all child processes to finish
-    while (wait(NULL) > 0);
-}
+	if (argc > 1) {
+		if (strcmp(argv[1], "-c") == 0) {
+			if (argc < 3) {
+				fprintf(stderr, "Usage: %s [-c command | script]\n", sysname);
+				return 2;
+			}
+			run_string(argv[2]);
+		} else {
+			int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+			if (fd == -1) {
+				fprintf(stderr, "%s: %s: %s\n", sysname, argv[1],
+						strerror(errno));
+				return 127;
+			}
+			run_script(fd);
+			close(fd);
+		}
+		arena_destroy(&line_arena);
+		return 0;
+	}
 
+	if (!isatty(STDIN_FILENO)) {
+		run_script(STDIN_FILENO);
+		arena_destroy(&line_arena);
+		return 0;
+	}
 
-int main() {
 	while (1) {
-		struct command_t *command = malloc(sizeof(struct command_t));
-
-		// set all bytes to 0
-		memset(command, 0, sizeof(struct command_t));
+		struct command_t *command =
+			arena_calloc(&line_arena, sizeof(struct command_t));
 
 		int code;
+		jobs_notify(true);
 		code = prompt(command);
 		if (code == EXIT) {
 			break;
@@ -447,65 +285,154 @@ int main() {
 		}
 //                printf("main: %s\n", command);
 
-		free_command(command);
+		arena_reset(&line_arena);
 	}
 
+	arena_destroy(&line_arena);
 	printf("\n");
 	return 0;
 }
 
+// commands process_command runs inside the shell itself
+static const char *builtins[] = {"exit",	  "mindmap", "hdiff",	 "hpatch",
+								 "hash",	  "cd",		 "jobs",	 "fg",
+								 "bg",		  "wait",	 "parallel", "mindex",
+								 "mfind",	  "mgrep"};
+
+bool is_builtin(const char *name) {
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+		if (strcmp(name, builtins[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
 int process_command(struct command_t *command) {
-	int r;
+	if (strcmp(command->name, "time") == 0) {
+		// time prefix: drop it and report what the rest of the line used
+		command->args++;
+		command->arg_count--;
+		command->name = command->args[0] ? command->args[0] : "";
+		command->timed = true;
+		return process_command(command);
+	}
 
-//	printf("process: %s\n", command);
-	
-	if(command->auto_complete){
+	if(command->auto_complete && command->name[0] != '\0'){
+	const char *match;
 	command->name[strlen(command->name) - 1] = '\0';
-	autocomplete_command(command->name);}
+	// name points into the line buffer, so take the completion by pointer
+	if ((match = autocomplete_command(command->name)) != NULL)
+		command->name = command->args[0] = (char *)match;}
 
 	if (strcmp(command->name, "") == 0) {
 	return SUCCESS;
 	}
 
+	// background builtins run in a forked child like any other job
+	if (command->next || command->background || !is_builtin(command->name)) {
+		return run_pipeline(command);
+	}
+
+	// builtins redirect the shell's own stdin/stdout instead of forking
+	int saved[2], code;
+	if (redirect_builtin(command, saved) == -1)
+		return SUCCESS;
+	code = command->timed ? time_builtin(command) : run_builtin(command);
+	restore_builtin_fds(saved);
+	return code;
+}
+
+/**
+ * Run a builtin inside the shell under the time prefix. There is no child
+ * to wait4 for, so the shell's own usage before and after is compared.
+ * @param  command [description]
+ * @return         what run_builtin returned
+ */
+int time_builtin(struct command_t *command) {
+	struct rusage before, after;
+	double start = timing_now();
+
+	getrusage(RUSAGE_SELF, &before);
+	int code = run_builtin(command);
+	getrusage(RUSAGE_SELF, &after);
+	double real = timing_now() - start;
+
+	fflush(stdout);
+	timing_sub(&after, &before);
+	timing_header();
+	timing_row("1", real, &after, -1, command->name, strlen(command->name));
+	return code;
+}
+
+/**
+ * Run a builtin inside the shell process
+ * @param  command [description]
+ * @return         SUCCESS, or EXIT for exit
+ */
+int run_builtin(struct command_t *command) {
+	int r;
+
 	if (strcmp(command->name, "exit") == 0) {
 		return EXIT;
 	}
 
 if (strcmp(command->name, "mindmap") == 0) {
-		if (command->arg_count != 2) {
-			printf("%d\n", command->arg_count);
-			printf("Usage: mindmap\n");
+		struct mindmap_options options;
+		if (!parseMindmapOptions(command, &options)) {
+			printf("Usage: mindmap [-f] [--depth N] "
+			       "[--format tree|ndjson|binary]\n"
+			       "               [-name GLOB]... [-prune GLOB]... "
+			       "[-type f|d] DIR\n"
+			       "       mindmap --du [--top K] [--depth N] DIR\n");
 			return SUCCESS;
 	}
-	    mindmap();}
+	    mindmap(&options);
+	    freeMindmapOptions(&options);
+	    return SUCCESS;}
 
-if (strcmp(command->name, "hdiff") == 0) {
-		if (command->arg_count < 4) {
-			printf("Usage: hdiff [-a | -b] file1 file2\n");
-			return SUCCESS;
+	if (strcmp(command->name, "hdiff") == 0) {
+		return hdiff_builtin(command);
 	}
-		else{
-			FILE *file1 = fopen(command->args[2], "rb");
-   		    FILE *file2 = fopen(command->args[3], "rb");
 
-    	if (!file1 || !file2) {
-        perror("Error opening files");
-        return SUCCESS;
-    }
+	if (strcmp(command->name, "hpatch") == 0) {
+		return hpatch_builtin(command);
+	}
 
-    if (strcmp(command->args[1], "-a") == 0) {
-        compareTextFiles(file1, file2);
-    } else if (strcmp(command->args[1], "-b") == 0) {
-        compareBinaryFiles(file1, file2);
-    } else {
-        printf("Invalid option: %s\n", command->args[1]);
-        
-    }
+	if (strcmp(command->name, "mindex") == 0) {
+		return mindex_builtin(command);
+	}
 
-    fclose(file1);
-    fclose(file2);
-		}
-		return SUCCESS;}
+	if (strcmp(command->name, "mfind") == 0) {
+		return mfind_builtin(command);
+	}
+
+	if (strcmp(command->name, "mgrep") == 0) {
+		return mgrep_builtin(command);
+	}
+
+	if (strcmp(command->name, "hash") == 0) {
+		return hash_builtin(command);
+	}
+
+	if (strcmp(command->name, "jobs") == 0) {
+		return jobs_builtin(command);
+	}
+
+	if (strcmp(command->name, "fg") == 0) {
+		return fg_builtin(command);
+	}
+
+	if (strcmp(command->name, "bg") == 0) {
+		return bg_builtin(command);
+	}
+
+	if (strcmp(command->name, "wait") == 0) {
+		return wait_builtin(command);
+	}
+
+	if (strcmp(command->name, "parallel") == 0) {
+		return parallel_builtin(command);
+	}
 
 	if (strcmp(command->name, "cd") == 0) {
 		if (command->arg_count > 0) {
@@ -519,72 +446,11 @@ if (strcmp(command->name, "hdiff") == 0) {
 			return SUCCESS;
 		}
 	}
-/* if (command->arg_count > 0 && strcmp(command->args[command->arg_count - 1], "&") == 0) {
-        command->background = 1; // Set background flag
-        command->arg_count--; // Remove "&" from argument list
-        command->args[command->arg_count] = NULL; // Null-terminate argument list
-    } */
-
-char *pch = strtok(command->name, "|");
-    if (pch != NULL && strtok(NULL, "|") != NULL) {
-        // Command contains piping, handle it
-        handle_piping(command->name);
-        return SUCCESS;
-    }
-
-	pid_t pid = fork();
-	// child
-	if (pid == 0) {
-		/// This shows how to do exec with environ (but is not available on MacOs)
-		// extern char** environ; // environment variables
-		// execvpe(command->name, command->args, environ); // exec+args+path+environ
-
-		/// This shows how to do exec with auto-path resolve
-		// add a NULL argument to the end of args, and the name to the beginning
-		// as required by exec
-
-// own exec with path resolving using execv()
-		// do so by replacing the execvp call below
-
-		execvp(command->name, command->args);		
-		exit(0);}
-
-/*		char path[1024]; // Buffer to store resolved path
-    	if (find_executable(command->name, path)) {
-        	// Execute the command with the resolved path and argument list
-printf("HUAAAA\n");        	
-execv(path, command->args);}
-else{
-printf("kdgjksglks\n");}
-exit(0);
-	} */ else {
-		// TODO: implement background processes here
-	/*	if (command->background) {
-        	// If the command is supposed to run in the background
-        	// You may want to store background process information for later handling
-        	printf("[%d] %s\n", pid, command->name);
-    } 	
-    */
-    
-		wait(0); // wait for child process to finish
-		return SUCCESS;
-	}
-
-	// TODO: your implementation here
-
-	printf("-%s: %s: command not found\n", sysname, command->name);
-	return 0;
-}
 
-int find_executable(const char *command, char *path) {
-    // Function to find the executable path of a command
-    // You need to implement this function based on your system's path resolution logic
-  
-    snprintf(path, 1024, "/Users/akars20/%s", command);
-    return access(path, X_OK) == 0; // Check if the file is executable
+	return SUCCESS;
 }
 
-void autocomplete_command(char *buf) {
+const char *autocomplete_command(const char *buf) {
 //	printf("%s\n", &buf);
 
 	char matched_commands[10][100];
@@ -593,7 +459,7 @@ void autocomplete_command(char *buf) {
     int num_commands = sizeof(commands) / sizeof(commands[0]);
 //  buf[strlen(buf) - 1] = '\0';
     // Extract the partially typed command from the buffer
-    char partial_command[100]; // Adjust the size as needed
+    char partial_command[100] = ""; // Adjust the size as needed
     sscanf(buf, "%s", partial_command);
 //      buf[strlen(buf) - 1] = '\0';
   
@@ -650,10 +516,10 @@ void autocomplete_command(char *buf) {
 
     // Autocomplete the command if there's a single match
     if (num_matched == 1) {
-
-
-        strcpy(buf, matched_commands[num_matched-1]); // Replace input buffer with the match
-	return;
+        // hand the match back to the caller instead of writing into buf
+        for (int i = 0; i < num_commands; i++)
+            if (strcmp(commands[i], matched_commands[0]) == 0)
+                return commands[i];
     } else if (num_matched > 1) {
         // Print all matches for the user to choose from
         printf("\nMultiple matches found:\n");
@@ -664,96 +530,188 @@ void autocomplete_command(char *buf) {
         }
     }
 }
+    return NULL;
 }
 
 
-void compareTextFiles(FILE *file1, FILE *file2) {
-    char line1[256], line2[256];
-    int lineNum = 1;
-    int diffCount = 0;
+/**
+ * Read a positive count for an option
+ * @param  arg   [description]
+ * @param  count [description]
+ * @return       false if it isn't one
+ */
+static bool parseCount(const char *arg, int *count) {
+    char *end;
+    long n = strtol(arg, &end, 10);
+
+    if (*arg == '\0' || *end || n <= 0 || n > INT_MAX)
+        return false;
+    *count = n;
+    return true;
+}
 
-    while (fgets(line1, sizeof(line1), file1) && fgets(line2, sizeof(line2), file2)) {
-        if (strcmp(line1, line2) != 0) {
-            printf("%s:Line %d: %s", "file1.txt", lineNum, line1);
-            printf("%s:Line %d: %s", "file2.txt", lineNum, line2);
-            diffCount++;
+static bool readMindmapOptions(struct command_t *command,
+                               struct mindmap_options *options) {
+    bool formatted = false;
+
+    for (int i = 1; command->args[i]; i++) {
+        const char *arg = command->args[i];
+        const char *value = command->args[i + 1];
+
+        if (strcmp(arg, "-f") == 0) {
+            options->rescan = true;
+        } else if (strcmp(arg, "--du") == 0) {
+            options->du = true;
+        } else if (strcmp(arg, "--top") == 0 && value) {
+            if (!parseCount(command->args[++i], &options->top))
+                return false;
+            options->du = true;
+        } else if (strcmp(arg, "--depth") == 0 && value) {
+            if (!parseCount(command->args[++i], &options->depth))
+                return false;
+        } else if (strcmp(arg, "--format") == 0 && value) {
+            if (!treeout_parse_format(command->args[++i], &options->format))
+                return false;
+            formatted = true;
+        } else if (strcmp(arg, "-name") == 0 && value) {
+            namematch_add(&options->names, command->args[++i]);
+        } else if (strcmp(arg, "-prune") == 0 && value) {
+            namematch_add(&options->prunes, command->args[++i]);
+        } else if (strcmp(arg, "-type") == 0 && value) {
+            if (strcmp(value, "f") != 0 && strcmp(value, "d") != 0)
+                return false;
+            options->type = *command->args[++i];
+        } else if (arg[0] != '-' && !options->directory) {
+            options->directory = arg;
+        } else {
+            return false;
         }
-        lineNum++;
     }
+    bool filtered = options->names.npatterns || options->prunes.npatterns ||
+                    options->type;
 
-    if (diffCount > 0) {
-        printf("%d different lines found\n", diffCount);
-    } else {
-        printf("The two text files are identical\n");
-    }
+    // --du has its own output, and adds up everything
+    return options->directory && !(options->du && (formatted || filtered));
 }
 
-void compareBinaryFiles(FILE *file1, FILE *file2) {
-    fseek(file1, 0, SEEK_END);
-    fseek(file2, 0, SEEK_END);
-
-    long fileSize1 = ftell(file1);
-    long fileSize2 = ftell(file2);
+/**
+ * Read mindmap's options and directory, compiling the patterns
+ * @param  command [description]
+ * @param  options [description]
+ * @return         false for a usage error
+ */
+bool parseMindmapOptions(struct command_t *command, struct mindmap_options *options) {
+    *options = (struct mindmap_options){0};
 
-    if (fileSize1 != fileSize2) {
-        printf("The two files are different in %ld bytes\n", abs(fileSize1 - fileSize2));
-    } else {
-        printf("The two files are identical\n");
+    if (!readMindmapOptions(command, options)) {
+        freeMindmapOptions(options);
+        return false;
     }
+    if (options->names.npatterns)
+        namematch_compile(&options->names);
+    if (options->prunes.npatterns)
+        namematch_compile(&options->prunes);
+    return true;
 }
 
-
-
-void mindmap() {
-    char* directory = malloc(1024); // Allocate memory for directory
-    if (directory == NULL) {
-        perror("Memory allocation error");
-        return;
-    }
-    scanf("%s", directory);
-
-    printf("Creating mind map for directory: %s\n", directory);
-    exploreDirectory(directory, 0);
+void freeMindmapOptions(struct mindmap_options *options) {
+    namematch_free(&options->names);
+    namematch_free(&options->prunes);
 }
 
-void printIndent(int level) {
-    for (int i = 0; i < level; i++) {
-        printf("|   ");
+/**
+ * Draw the tree below a directory. Trees drawn before come from
+ * treecache.h unless options->rescan asks for a fresh walk; --du adds up
+ * sizes instead, always walking. Machine-readable formats leave out the
+ * heading. With -name or -type, the directories leading to an entry shown
+ * are shown too.
+ * @param options [description]
+ */
+void mindmap(const struct mindmap_options *options) {
+    const char *directory = options->directory;
+    bool heading = options->du || options->format == TREEOUT_TREE;
+    double start = timing_now();
+    bool cached = false;
+    long entries;
+
+    if (heading)
+        printf("Creating mind map for directory: %s\n", directory);
+    if (options->du) {
+        entries = du_tree(directory, options->top, options->depth);
+    } else {
+        struct treeout out;
+
+        // the entries bypass stdio
+        fflush(stdout);
+        treeout_init(&out, options->format, STDOUT_FILENO, directory);
+        entries = exploreDirectory(&out, options, &cached);
+        if (treeout_finish(&out) == -1)
+            fprintf(stderr, "-%s: mindmap: write: %s\n", sysname,
+                    strerror(errno));
     }
+    double elapsed = timing_now() - start;
+    fflush(stdout);
+    fprintf(stderr, "mindmap: %ld entries in %.3f s, %.0f entries/s%s\n",
+            entries, elapsed, elapsed > 0 ? entries / elapsed : 0,
+            cached ? " (cached)" : "");
 }
 
-void exploreDirectory(const char *path, int level) {
-    DIR *dir = opendir(path);
-    if (!dir) {
-        perror("Unable to open directory");
-        return;
-    }
+struct mindmapWalk {
+    struct treeout *out;
+    const struct mindmap_options *options;
+};
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
+static void printEntry(struct pwalker *walker, const struct pwalk_entry *entry) {
+    struct mindmapWalk *walk = walker->arg;
+    const struct mindmap_options *options = walk->options;
 
-        char fullPath[1024];
-        snprintf(fullPath, sizeof(fullPath), "%s/%s", path, entry->d_name);
+    if ((!options->names.npatterns ||
+         namematch_test(&options->names, entry->name)) &&
+        (!options->type || (options->type == 'd') == entry->dir))
+        treeout_entry(walk->out, entry);
+    else if (entry->dir)
+        treeout_defer(walk->out, entry);
+}
 
-        struct stat st;
-        if (stat(fullPath, &st) == -1) {
-            perror("Unable to get file status");
-            closedir(dir);
-            return;
-        }
+// called from pwalk.h's threads, which only read the compiled patterns
+static bool pruneEntry(struct pwalker *walker, const char *name) {
+    struct mindmapWalk *walk = walker->arg;
 
-        if (S_ISDIR(st.st_mode)) {
-            printIndent(level);
-            printf("|-- %s (Directory)\n", entry->d_name);
-            exploreDirectory(fullPath, level + 1);
-        } else {
-            printIndent(level);
-            printf("|-- %s\n", entry->d_name);
-        }
-    }
+    return namematch_test(&walk->options->prunes, name);
+}
 
-    closedir(dir);
-}   
+static void printWalkError(struct pwalker *walker, const struct pwalk_entry *entry,
+                           const char *what) {
+    struct mindmapWalk *walk = walker->arg;
+    int error = errno;
+
+    (void)entry;
+    // keep the message next to the entries before it
+    out_buffer_flush(&walk->out->out);
+    errno = error;
+    perror(what);
+}
+
+/**
+ * Write out the tree below options->directory, as far down and as
+ * filtered as the options say
+ * @param  out     [description]
+ * @param  options [description]
+ * @param  cached  set to whether it came from treecache.h
+ * @return         the number of entries walked
+ */
+long exploreDirectory(struct treeout *out,
+                      const struct mindmap_options *options, bool *cached) {
+    struct mindmapWalk walk = {out, options};
+    struct pwalker walker = {
+        .follow_links = true,
+        .depth = options->depth,
+        .prune = options->prunes.npatterns ? pruneEntry : NULL,
+        .visit = printEntry,
+        .error = printWalkError,
+        .arg = &walk,
+    };
+
+    return treecache_walk(&walker, options->directory, options->rescan,
+                          cached);
+}
@@ -0,0 +1,31 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stdbool.h>
+#include "arena.h"
+
+extern const char *sysname;
+
+enum return_codes {
+	SUCCESS = 0,
+	EXIT = 1,
+	UNKNOWN = 2,
+};
+
+struct command_t {
+	char *name;
+	bool background;
+	bool auto_complete;
+	bool timed; // time prefix, report resource usage when done
+	int arg_count;
+	char **args;
+	char *redirects[3]; // in/out redirection
+	struct command_t *next; // for piping
+};
+
+int process_command(struct command_t *command);
+bool is_builtin(const char *name);
+void print_command(struct command_t *command);
+int parse_command(struct arena *arena, char *buf, struct command_t *command);
+
+#endif
@@ -0,0 +1,172 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shell.h"
+#include "stream.h"
+
+/**
+ * Whether a path has to be streamed rather than mapped
+ * @param  path [description]
+ * @return      [description]
+ */
+bool stream_wanted(const char *path) {
+	struct stat st;
+
+	if (strcmp(path, "-") == 0)
+		return true;
+	// a missing file is left to the mapping code to report
+	return stat(path, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+/**
+ * Read until the block is full or the input ends. Only the read itself
+ * is a point where stream_close may cancel the thread.
+ * @param  stream [description]
+ * @param  block  [description]
+ * @return        bytes read, -1 on error
+ */
+static ptrdiff_t fill_block(struct stream *stream, unsigned char *block) {
+	size_t filled = 0;
+
+	while (filled < STREAM_BLOCK) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		ssize_t n = read(stream->fd, block + filled, STREAM_BLOCK - filled);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (n == 0)
+			break;
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			stream->error = errno;
+			return -1;
+		}
+		filled += n;
+	}
+	return filled;
+}
+
+static void *reader_main(void *arg) {
+	struct stream *stream = arg;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	for (int k = 0;; k ^= 1) {
+		pthread_mutex_lock(&stream->lock);
+		while (stream->ready[k] != -1 && !stream->stop)
+			pthread_cond_wait(&stream->changed, &stream->lock);
+		bool stop = stream->stop;
+		pthread_mutex_unlock(&stream->lock);
+		if (stop)
+			break;
+
+		ptrdiff_t n = fill_block(stream, stream->blocks[k]);
+
+		pthread_mutex_lock(&stream->lock);
+		stream->ready[k] = n < 0 ? 0 : n;
+		pthread_cond_broadcast(&stream->changed);
+		pthread_mutex_unlock(&stream->lock);
+
+		if (n < (ptrdiff_t)STREAM_BLOCK)
+			break;
+	}
+	return NULL;
+}
+
+/**
+ * Open a path, "-" being stdin, and start reading it
+ * @param  path [description]
+ * @return      NULL after printing an error
+ */
+struct stream *stream_open(const char *path) {
+	struct stream *stream = calloc(1, sizeof(*stream));
+
+	if (!stream) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+
+	stream->path = path;
+	stream->fd = strcmp(path, "-") == 0
+					 ? STDIN_FILENO
+					 : open(path, O_RDONLY | O_CLOEXEC);
+	if (stream->fd == -1 || fstat(stream->fd, &stream->st) == -1) {
+		printf("-%s: hdiff: %s: %s\n", sysname, path, strerror(errno));
+		if (stream->fd > STDIN_FILENO)
+			close(stream->fd);
+		free(stream);
+		return NULL;
+	}
+
+	stream->blocks[0] = malloc(2 * STREAM_BLOCK);
+	if (!stream->blocks[0]) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+	stream->blocks[1] = stream->blocks[0] + STREAM_BLOCK;
+	stream->ready[0] = stream->ready[1] = -1;
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->changed, NULL);
+
+	int err = pthread_create(&stream->reader, NULL, reader_main, stream);
+	if (err != 0) {
+		printf("-%s: hdiff: %s\n", sysname, strerror(err));
+		if (stream->fd > STDIN_FILENO)
+			close(stream->fd);
+		free(stream->blocks[0]);
+		free(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+/**
+ * Hand out the next block, taking back the one handed out before
+ * @param  stream [description]
+ * @param  data   set to the block
+ * @return        bytes in the block, 0 at the end or after an error
+ */
+size_t stream_next(struct stream *stream, const unsigned char **data) {
+	if (stream->done)
+		return 0;
+
+	pthread_mutex_lock(&stream->lock);
+	if (stream->handed) {
+		stream->ready[stream->current ^ 1] = -1;
+		pthread_cond_broadcast(&stream->changed);
+	}
+	while (stream->ready[stream->current] == -1)
+		pthread_cond_wait(&stream->changed, &stream->lock);
+	size_t n = stream->ready[stream->current];
+	pthread_mutex_unlock(&stream->lock);
+
+	*data = stream->blocks[stream->current];
+	stream->current ^= 1;
+	stream->handed = true;
+	stream->done = n < STREAM_BLOCK;
+	return n;
+}
+
+/**
+ * Stop the reader, which may be blocked reading a pipe nobody writes to
+ * any more, and free everything
+ * @param stream [description]
+ */
+void stream_close(struct stream *stream) {
+	pthread_mutex_lock(&stream->lock);
+	stream->stop = true;
+	pthread_cond_broadcast(&stream->changed);
+	pthread_mutex_unlock(&stream->lock);
+
+	pthread_cancel(stream->reader);
+	pthread_join(stream->reader, NULL);
+
+	if (stream->fd > STDIN_FILENO)
+		close(stream->fd);
+	pthread_mutex_destroy(&stream->lock);
+	pthread_cond_destroy(&stream->changed);
+	free(stream->blocks[0]);
+	free(stream);
+}
@@ -0,0 +1,40 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * Sequential block reader for hdiff inputs that can't be mapped: "-" for
+ * stdin, pipes, fifos and devices. A reader thread fills one block while
+ * the caller works on the other, so an input costs two blocks of memory
+ * however long it is. Every block but the last is full, which keeps the
+ * blocks of two streams at the same offsets.
+ */
+#define STREAM_BLOCK (1UL << 20)
+
+struct stream {
+	const char *path;
+	int fd;
+	struct stat st;
+	int error; // errno of a failed read, 0 if none
+
+	pthread_t reader;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	unsigned char *blocks[2];
+	ptrdiff_t ready[2]; // bytes in a filled block, -1 while it is free
+	int current; // block the caller gets next
+	bool handed; // the caller holds the other block
+	bool done; // the caller got the last block
+	bool stop;
+};
+
+bool stream_wanted(const char *path);
+struct stream *stream_open(const char *path);
+size_t stream_next(struct stream *stream, const unsigned char **data);
+void stream_close(struct stream *stream);
+
+#endif
@@ -0,0 +1,92 @@
+#define _GNU_SOURCE // sigabbrev_np
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "timing.h"
+
+static double seconds(struct timeval tv) {
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static struct timeval timeval_add(struct timeval a, struct timeval b, int sign) {
+	long usec = (a.tv_sec + sign * b.tv_sec) * 1000000L + a.tv_usec +
+				sign * b.tv_usec;
+	struct timeval tv = {usec / 1000000L, usec % 1000000L};
+	return tv;
+}
+
+/**
+ * Monotonic clock in seconds. Also called from the SIGCHLD handler, which
+ * clock_gettime allows.
+ * @return [description]
+ */
+double timing_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void timing_header() {
+	fprintf(stderr, "%-6s %9s %9s %9s %10s %7s %7s %8s %6s %-8s %s\n",
+			"stage", "real", "user", "sys", "maxrss_kb", "vcsw", "ivcsw",
+			"minflt", "majflt", "status", "command");
+}
+
+/**
+ * Print one row of the report
+ * @param label    stage number or "total"
+ * @param real     wall clock seconds
+ * @param usage    resource usage of the stage
+ * @param status   wait status, -1 when there is none
+ * @param text     command text, need not be terminated
+ * @param text_len length of text
+ */
+void timing_row(const char *label, double real, const struct rusage *usage,
+				int status, const char *text, int text_len) {
+	char state[16] = "-";
+
+	if (status != -1 && WIFSIGNALED(status)) {
+		const char *abbrev = sigabbrev_np(WTERMSIG(status));
+		snprintf(state, sizeof(state), "SIG%s", abbrev ? abbrev : "?");
+	} else if (status != -1) {
+		snprintf(state, sizeof(state), "%d", WEXITSTATUS(status));
+	}
+
+	fprintf(stderr, "%-6s %9.3f %9.3f %9.3f %10ld %7ld %7ld %8ld %6ld %-8s %.*s\n",
+			label, real, seconds(usage->ru_utime), seconds(usage->ru_stime),
+			usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw,
+			usage->ru_minflt, usage->ru_majflt, state, text_len, text);
+}
+
+/**
+ * Accumulate a stage into the pipeline total. Peak RSS is the largest
+ * stage's, everything else is summed.
+ * @param total [description]
+ * @param usage [description]
+ */
+void timing_add(struct rusage *total, const struct rusage *usage) {
+	total->ru_utime = timeval_add(total->ru_utime, usage->ru_utime, 1);
+	total->ru_stime = timeval_add(total->ru_stime, usage->ru_stime, 1);
+	if (usage->ru_maxrss > total->ru_maxrss)
+		total->ru_maxrss = usage->ru_maxrss;
+	total->ru_nvcsw += usage->ru_nvcsw;
+	total->ru_nivcsw += usage->ru_nivcsw;
+	total->ru_minflt += usage->ru_minflt;
+	total->ru_majflt += usage->ru_majflt;
+}
+
+/**
+ * Turn a getrusage(RUSAGE_SELF) reading into the usage since start. The
+ * peak RSS cannot be subtracted and stays the shell's own.
+ * @param usage [description]
+ * @param start [description]
+ */
+void timing_sub(struct rusage *usage, const struct rusage *start) {
+	usage->ru_utime = timeval_add(usage->ru_utime, start->ru_utime, -1);
+	usage->ru_stime = timeval_add(usage->ru_stime, start->ru_stime, -1);
+	usage->ru_nvcsw -= start->ru_nvcsw;
+	usage->ru_nivcsw -= start->ru_nivcsw;
+	usage->ru_minflt -= start->ru_minflt;
+	usage->ru_majflt -= start->ru_majflt;
+}
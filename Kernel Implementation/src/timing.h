@@ -0,0 +1,18 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <sys/resource.h>
+
+/*
+ * Report format of the time prefix: one row per pipeline stage with wall
+ * clock, CPU time, peak RSS, context switches and page faults, written to
+ * stderr so it never mixes with the pipeline's output.
+ */
+double timing_now();
+void timing_header();
+void timing_row(const char *label, double real, const struct rusage *usage,
+				int status, const char *text, int text_len);
+void timing_add(struct rusage *total, const struct rusage *usage);
+void timing_sub(struct rusage *usage, const struct rusage *start);
+
+#endif
@@ -0,0 +1,653 @@
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shell.h"
+#include "treecache.h"
+#include "util.h"
+
+#define WATCH_EVENTS                                                   \
+	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+	 IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/*
+ * An entry. One whose stat failed isn't shown, only its error; a directory
+ * that couldn't be opened is shown, followed by its error.
+ */
+struct cnode {
+	struct cnode *parent; // NULL for a root
+	struct cnode *first, *last; // contents, in the order they're shown
+	struct cnode *prev, *next;
+	struct cnode *hash_next; // in the (parent, name) table
+	struct cnode *wd_next; // another directory with the same watch
+	int wd; // -1 when not watched
+	int error;
+	const char *what; // the operation that failed
+	bool dir;
+	char name[]; // a root's is its resolved path
+};
+
+struct croot {
+	char *path; // resolved with realpath
+	struct cnode *top;
+	bool stale; // walk it afresh next time
+	unsigned long used;
+};
+
+/*
+ * Everything is guarded by lock: the event thread holds it while applying
+ * events, treecache_walk while it walks or replays a root.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pid_t owner; // forked copies of the shell don't get the events
+	int fd; // inotify
+	struct croot roots[TREECACHE_ROOTS];
+	int nroots;
+	unsigned long clock;
+	struct cnode **buckets;
+	size_t nbuckets, count;
+	struct cnode **watches; // directories by watch descriptor
+	size_t nwatches;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+
+// fills a walk's record in, as pwalk.h visits it
+struct builder {
+	struct pwalker walker;
+	struct pwalker *forward; // shown the walk as well, or NULL
+	struct cnode **dirs; // by level, the directory holding its entries
+	size_t *lens; // the length of each one's path
+	int cap;
+	char path[PATH_MAX];
+	int error; // errno of a directory that couldn't be watched
+	pthread_mutex_t opened_lock;
+	int *opened; // the watches build_opened added
+	size_t nopened, opened_cap;
+};
+
+static size_t name_hash(const struct cnode *parent, const char *name) {
+	uint64_t h = 1469598103934665603ULL ^ (uintptr_t)parent;
+
+	for (; *name; name++)
+		h = (h ^ (unsigned char)*name) * 1099511628211ULL;
+	return h ^ (h >> 29);
+}
+
+static struct cnode *find_child(const struct cnode *parent, const char *name) {
+	if (!cache.nbuckets)
+		return NULL;
+
+	struct cnode *c = cache.buckets[name_hash(parent, name) &
+									(cache.nbuckets - 1)];
+	for (; c; c = c->hash_next) {
+		if (c->parent == parent && strcmp(c->name, name) == 0)
+			return c;
+	}
+	return NULL;
+}
+
+static void hash_insert(struct cnode *node) {
+	if (cache.count >= cache.nbuckets) {
+		size_t nbuckets = cache.nbuckets ? 2 * cache.nbuckets : 1024;
+		struct cnode **buckets = calloc(nbuckets, sizeof(*buckets));
+
+		if (!buckets) {
+			perror("mindmap");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < cache.nbuckets; i++) {
+			struct cnode *c = cache.buckets[i], *next;
+			for (; c; c = next) {
+				next = c->hash_next;
+				size_t h = name_hash(c->parent, c->name) & (nbuckets - 1);
+				c->hash_next = buckets[h];
+				buckets[h] = c;
+			}
+		}
+		free(cache.buckets);
+		cache.buckets = buckets;
+		cache.nbuckets = nbuckets;
+	}
+
+	size_t h = name_hash(node->parent, node->name) & (cache.nbuckets - 1);
+	node->hash_next = cache.buckets[h];
+	cache.buckets[h] = node;
+	cache.count++;
+}
+
+static void hash_remove(struct cnode *node) {
+	struct cnode **p = &cache.buckets[name_hash(node->parent, node->name) &
+									  (cache.nbuckets - 1)];
+	while (*p != node)
+		p = &(*p)->hash_next;
+	*p = node->hash_next;
+	cache.count--;
+}
+
+/**
+ * Add an entry at the end of a directory
+ * @param  parent the directory, NULL for a root
+ * @param  name   [description]
+ * @param  dir    [description]
+ * @return        [description]
+ */
+static struct cnode *new_node(struct cnode *parent, const char *name,
+							  bool dir) {
+	size_t len = strlen(name) + 1;
+	struct cnode *node = xrealloc(NULL, sizeof(*node) + len);
+
+	*node = (struct cnode){.parent = parent, .wd = -1, .dir = dir};
+	memcpy(node->name, name, len);
+	if (parent) {
+		node->prev = parent->last;
+		if (parent->last)
+			parent->last->next = node;
+		else
+			parent->first = node;
+		parent->last = node;
+		hash_insert(node);
+	}
+	return node;
+}
+
+static bool watch_add(struct cnode *node, const char *path) {
+	int wd = inotify_add_watch(cache.fd, path, WATCH_EVENTS);
+
+	if (wd == -1)
+		return false;
+	if ((size_t)wd >= cache.nwatches) {
+		size_t n = cache.nwatches ? 2 * cache.nwatches : 1024;
+		while (n <= (size_t)wd)
+			n *= 2;
+		cache.watches = xrealloc(cache.watches, n * sizeof(*cache.watches));
+		memset(cache.watches + cache.nwatches, 0,
+			   (n - cache.nwatches) * sizeof(*cache.watches));
+		cache.nwatches = n;
+	}
+	node->wd = wd;
+	node->wd_next = cache.watches[wd];
+	cache.watches[wd] = node;
+	return true;
+}
+
+static void watch_drop(struct cnode *node) {
+	if (node->wd == -1)
+		return;
+
+	struct cnode **p = &cache.watches[node->wd];
+	while (*p != node)
+		p = &(*p)->wd_next;
+	*p = node->wd_next;
+	if (!cache.watches[node->wd])
+		inotify_rm_watch(cache.fd, node->wd);
+	node->wd = -1;
+}
+
+// remove an entry and everything below it
+static void free_node(struct cnode *node) {
+	while (node->first)
+		free_node(node->first);
+	watch_drop(node);
+
+	struct cnode *parent = node->parent;
+	if (parent) {
+		hash_remove(node);
+		if (node->prev)
+			node->prev->next = node->next;
+		else
+			parent->first = node->next;
+		if (node->next)
+			node->next->prev = node->prev;
+		else
+			parent->last = node->prev;
+	}
+	free(node);
+}
+
+/**
+ * The path of a directory in the cache
+ * @param  node [description]
+ * @param  buf  PATH_MAX bytes
+ * @return      its length, or -1 if it doesn't fit
+ */
+static int node_path(const struct cnode *node, char *buf) {
+	int len = 0;
+
+	if (node->parent) {
+		len = node_path(node->parent, buf);
+		if (len == -1 || len + 1 >= PATH_MAX)
+			return -1;
+		buf[len++] = '/';
+	}
+
+	size_t name_len = strlen(node->name);
+	if (len + name_len >= PATH_MAX)
+		return -1;
+	memcpy(buf + len, node->name, name_len + 1);
+	return len + name_len;
+}
+
+static struct croot *root_of(const struct cnode *node) {
+	while (node->parent)
+		node = node->parent;
+	for (int i = 0; i < cache.nroots; i++) {
+		if (cache.roots[i].top == node)
+			return &cache.roots[i];
+	}
+	return NULL;
+}
+
+static void mark_stale(const struct cnode *node) {
+	struct croot *root = root_of(node);
+	if (root)
+		root->stale = true;
+}
+
+static void build_visit(struct pwalker *walker,
+						const struct pwalk_entry *entry) {
+	struct builder *b = walker->arg;
+
+	if (b->forward)
+		b->forward->visit(b->forward, entry);
+
+	struct cnode *node =
+		new_node(b->dirs[entry->level], entry->name, entry->dir);
+	if (!entry->dir)
+		return;
+
+	if (entry->level + 2 > b->cap) {
+		b->cap *= 2;
+		b->dirs = xrealloc(b->dirs, b->cap * sizeof(*b->dirs));
+		b->lens = xrealloc(b->lens, b->cap * sizeof(*b->lens));
+	}
+
+	size_t len = b->lens[entry->level];
+	size_t name_len = strlen(entry->name);
+	b->dirs[entry->level + 1] = node;
+	b->lens[entry->level + 1] = len;
+	if (len + 1 + name_len >= PATH_MAX) {
+		b->error = ENAMETOOLONG;
+		return;
+	}
+	b->path[len] = '/';
+	memcpy(b->path + len + 1, entry->name, name_len + 1);
+	b->lens[entry->level + 1] = len + 1 + name_len;
+
+	// a directory that can't be read can't be watched either, and shows
+	// its error instead of contents
+	if (!watch_add(node, b->path) && errno != EACCES && !b->error)
+		b->error = errno;
+}
+
+// called from pwalk.h's threads as each directory is opened: watched
+// before it's listed, whatever appears after the listing still sends an
+// event. build_visit watches it again by path, which gets the same
+// descriptor, and records that; scan removes the ones it didn't record.
+static void build_opened(struct pwalker *walker, int fd) {
+	struct builder *b = walker->arg;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	int wd = inotify_add_watch(cache.fd, path, WATCH_EVENTS);
+	if (wd == -1)
+		return;
+
+	pthread_mutex_lock(&b->opened_lock);
+	if (b->nopened == b->opened_cap) {
+		b->opened_cap = b->opened_cap ? 2 * b->opened_cap : 256;
+		b->opened = xrealloc(b->opened, b->opened_cap * sizeof(*b->opened));
+	}
+	b->opened[b->nopened++] = wd;
+	pthread_mutex_unlock(&b->opened_lock);
+}
+
+static void build_error(struct pwalker *walker, const struct pwalk_entry *entry,
+						const char *what) {
+	struct builder *b = walker->arg;
+	int error = errno;
+	struct cnode *node;
+
+	if (b->forward)
+		b->forward->error(b->forward, entry, what);
+
+	if (entry->level == -1)
+		node = b->dirs[0];
+	else if (entry->dir)
+		node = b->dirs[entry->level + 1];
+	else
+		node = new_node(b->dirs[entry->level], entry->name, false);
+	node->error = error;
+	node->what = what;
+}
+
+/**
+ * Walk a directory and record its entries below node, watching every
+ * directory
+ * @param  node      [description]
+ * @param  walk_path the directory, as given to pwalk_tree
+ * @param  path      its resolved path, shorter than PATH_MAX
+ * @param  forward   shown the walk as well, or NULL
+ * @param  error     set to the errno of a directory that couldn't be
+ *                   watched, or 0
+ * @return           the number of entries
+ */
+static long scan(struct cnode *node, const char *walk_path, const char *path,
+				 struct pwalker *forward, int *error) {
+	struct builder b = {
+		.forward = forward,
+		.cap = 16,
+		.opened_lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	size_t len = strlen(path);
+
+	b.walker.follow_links = true;
+	b.walker.visit = build_visit;
+	b.walker.opened = build_opened;
+	b.walker.error = build_error;
+	b.walker.arg = &b;
+	if (forward)
+		b.walker.threads = forward->threads;
+	if (!watch_add(node, path) && errno != EACCES)
+		b.error = errno;
+	memcpy(b.path, path, len + 1);
+	b.dirs = xrealloc(NULL, b.cap * sizeof(*b.dirs));
+	b.lens = xrealloc(NULL, b.cap * sizeof(*b.lens));
+	b.dirs[0] = node;
+	b.lens[0] = len;
+
+	long count = pwalk_tree(&b.walker, walk_path);
+
+	// a directory build_visit gave up on, its path too long or its watch
+	// failing, was still watched when it was opened
+	for (size_t i = 0; i < b.nopened; i++) {
+		size_t wd = b.opened[i];
+		if (wd >= cache.nwatches || !cache.watches[wd])
+			inotify_rm_watch(cache.fd, wd);
+	}
+
+	free(b.opened);
+	free(b.dirs);
+	free(b.lens);
+	*error = b.error;
+	return count;
+}
+
+static long replay(struct pwalker *walker, const struct cnode *dir,
+				   int level) {
+	long count = 0;
+
+	if (dir->error) {
+		struct pwalk_entry entry = {dir->name, level - 1, true, NULL};
+		errno = dir->error;
+		walker->error(walker, &entry, dir->what);
+	}
+	for (const struct cnode *c = dir->first; c; c = c->next) {
+		struct pwalk_entry entry = {c->name, level, c->dir, NULL};
+
+		if (walker->prune && walker->prune(walker, c->name))
+			continue;
+		if (c->error && !c->dir) {
+			errno = c->error;
+			walker->error(walker, &entry, c->what);
+			continue;
+		}
+		walker->visit(walker, &entry);
+		count++;
+		if (c->dir && (!walker->depth || level + 1 < walker->depth))
+			count += replay(walker, c, level + 1);
+	}
+	return count;
+}
+
+// whether path is a link to dir or a directory above it, as pwalk.h won't
+// follow those
+static bool links_back(const char *path, const struct cnode *dir) {
+	char dir_path[PATH_MAX], target[PATH_MAX], resolved[PATH_MAX];
+	struct stat st;
+
+	if (lstat(path, &st) == -1 || !S_ISLNK(st.st_mode) ||
+		node_path(dir, dir_path) == -1 || !realpath(path, target) ||
+		!realpath(dir_path, resolved))
+		return false;
+
+	size_t len = strlen(target);
+	return strcmp(target, "/") == 0 ||
+		   (strncmp(resolved, target, len) == 0 &&
+			(resolved[len] == '\0' || resolved[len] == '/'));
+}
+
+/**
+ * Bring a directory's record up to date with an event about one of its
+ * entries
+ * @param dir  [description]
+ * @param name the entry
+ * @param mask the event
+ */
+static void apply_entry(struct cnode *dir, const char *name, uint32_t mask) {
+	struct cnode *child = find_child(dir, name);
+
+	if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+		if (child)
+			free_node(child);
+		return;
+	}
+	// new permissions might let a directory be read now
+	if ((mask & IN_ATTRIB) && !(child && child->dir && child->error))
+		return;
+
+	if (child)
+		free_node(child);
+
+	char path[PATH_MAX];
+	int len = node_path(dir, path);
+	size_t name_len = strlen(name);
+	if (len == -1 || len + 1 + name_len >= PATH_MAX) {
+		mark_stale(dir);
+		return;
+	}
+	path[len] = '/';
+	memcpy(path + len + 1, name, name_len + 1);
+
+	struct stat st;
+	if (stat(path, &st) == -1) {
+		child = new_node(dir, name, false);
+		child->error = errno;
+		child->what = "Unable to get file status";
+		return;
+	}
+
+	child = new_node(dir, name, S_ISDIR(st.st_mode));
+	if (!child->dir)
+		return;
+	if (links_back(path, dir)) {
+		child->error = ELOOP;
+		child->what = "Unable to open directory";
+		return;
+	}
+
+	int error;
+	scan(child, path, path, NULL, &error);
+	if (error)
+		mark_stale(dir);
+}
+
+static void apply_event(const struct inotify_event *ev) {
+	if (ev->mask & IN_Q_OVERFLOW) {
+		for (int i = 0; i < cache.nroots; i++)
+			cache.roots[i].stale = true;
+		return;
+	}
+	if (ev->wd < 0 || (size_t)ev->wd >= cache.nwatches)
+		return;
+
+	if (ev->mask & IN_IGNORED) {
+		struct cnode *next;
+		for (struct cnode *n = cache.watches[ev->wd]; n; n = next) {
+			next = n->wd_next;
+			n->wd = -1;
+		}
+		cache.watches[ev->wd] = NULL;
+		return;
+	}
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		for (struct cnode *n = cache.watches[ev->wd]; n; n = n->wd_next) {
+			if (!n->parent)
+				mark_stale(n);
+		}
+		return;
+	}
+	if (!ev->len)
+		return;
+
+	// links can show one directory in several places; applying the event
+	// to one of them can remove others, so each is looked up again
+	struct cnode *dirs[16];
+	int n = 0;
+	for (struct cnode *d = cache.watches[ev->wd]; d && n < 16; d = d->wd_next)
+		dirs[n++] = d;
+
+	for (int i = 0; i < n; i++) {
+		struct cnode *d = cache.watches[ev->wd];
+		while (d && d != dirs[i])
+			d = d->wd_next;
+		// a link back up the tree shares its target's watch
+		if (d && !d->error)
+			apply_entry(d, ev->name, ev->mask);
+	}
+}
+
+// apply the events queued so far
+static void drain_events() {
+	static char buf[64 << 10]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+
+	while ((n = read(cache.fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + n;) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			apply_event(ev);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+static void *event_thread(void *arg) {
+	struct pollfd pfd = {.fd = cache.fd, .events = POLLIN};
+
+	(void)arg;
+	for (;;) {
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+			return NULL;
+		pthread_mutex_lock(&cache.lock);
+		drain_events();
+		pthread_mutex_unlock(&cache.lock);
+	}
+}
+
+/**
+ * Set up inotify and the thread reading it, once
+ * @return whether the cache can be used
+ */
+static bool start_watching() {
+	if (cache.fd != -1)
+		return true;
+
+	cache.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (cache.fd == -1)
+		return false;
+
+	// the shell's signals stay with the main thread; without the thread
+	// events are still applied at the start of every walk
+	sigset_t all, old;
+	pthread_t thread;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&thread, NULL, event_thread, NULL) == 0)
+		pthread_detach(thread);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return true;
+}
+
+static void drop_root(struct croot *root) {
+	free_node(root->top);
+	free(root->path);
+	*root = cache.roots[--cache.nroots];
+}
+
+long treecache_walk(struct pwalker *walker, const char *root, bool rescan,
+					bool *cached) {
+	char *path = realpath(root, NULL);
+	long count;
+
+	*cached = false;
+	if (!path || (cache.owner && cache.owner != getpid())) {
+		free(path);
+		return pwalk_tree(walker, root);
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	cache.owner = getpid();
+	if (!start_watching()) {
+		pthread_mutex_unlock(&cache.lock);
+		free(path);
+		return pwalk_tree(walker, root);
+	}
+	drain_events();
+
+	struct croot *r = NULL;
+	for (int i = 0; i < cache.nroots && !r; i++) {
+		if (strcmp(cache.roots[i].path, path) == 0)
+			r = &cache.roots[i];
+	}
+	if (r && !r->stale && !rescan) {
+		r->used = ++cache.clock;
+		count = replay(walker, r->top, 0);
+		*cached = true;
+		pthread_mutex_unlock(&cache.lock);
+		free(path);
+		return count;
+	}
+
+	// a record has to hold everything, the walk leaves out what's below depth
+	// or pruned
+	if (walker->depth || walker->prune) {
+		pthread_mutex_unlock(&cache.lock);
+		free(path);
+		return pwalk_tree(walker, root);
+	}
+
+	if (r)
+		drop_root(r);
+	if (cache.nroots == TREECACHE_ROOTS) {
+		struct croot *lru = &cache.roots[0];
+		for (int i = 1; i < cache.nroots; i++) {
+			if (cache.roots[i].used < lru->used)
+				lru = &cache.roots[i];
+		}
+		drop_root(lru);
+	}
+
+	int error;
+	struct cnode *top = new_node(NULL, path, true);
+	count = scan(top, root, path, walker, &error);
+	if (error || top->error) {
+		if (error)
+			fprintf(stderr, "-%s: mindmap: %s: %s, not cached\n", sysname,
+					path, strerror(error));
+		free_node(top);
+		free(path);
+	} else {
+		cache.roots[cache.nroots++] =
+			(struct croot){path, top, false, ++cache.clock};
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return count;
+}
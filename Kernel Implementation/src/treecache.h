@@ -0,0 +1,32 @@
+#ifndef TREECACHE_H
+#define TREECACHE_H
+
+#include <stdbool.h>
+#include "pwalk.h"
+
+/*
+ * mindmap's memory of the trees it has drawn. The first walk of a root
+ * records every entry and puts an inotify watch on every directory, and a
+ * thread keeps the record current from the events: entries are added and
+ * dropped as they come and go, and a directory that appears is listed with
+ * pwalk.h. Later walks of the root replay the record without reading the
+ * file system, new entries coming after the ones listed with them. When
+ * the event queue overflows, or a directory can't be watched, the root is
+ * walked afresh next time. A walk limited to a depth, or pruning names,
+ * replays that much of a record, but isn't recorded itself. The last
+ * TREECACHE_ROOTS roots are kept.
+ */
+#define TREECACHE_ROOTS 8
+
+/**
+ * Walk root like pwalk_tree, from the cache when it holds root
+ * @param  walker [description]
+ * @param  root   [description]
+ * @param  rescan walk the file system and record it again regardless
+ * @param  cached set to whether the entries came from the cache
+ * @return        the number of entries visited
+ */
+long treecache_walk(struct pwalker *walker, const char *root, bool rescan,
+					bool *cached);
+
+#endif
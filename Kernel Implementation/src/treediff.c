@@ -0,0 +1,441 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "bytecmp.h"
+#include "shell.h"
+#include "treediff.h"
+#include "pwalk.h"
+#include "util.h"
+
+// each tree keeps its relative paths in an arena of its own
+#define TREE_ARENA_SIZE (1 << 20)
+
+struct tree_entry {
+	const char *rel;
+	mode_t mode;
+	off_t size;
+	struct timespec mtime;
+};
+
+struct tree {
+	const char *root;
+	struct tree_entry *entries;
+	size_t n, cap;
+	struct arena arena;
+	// while walking, dirs[level] is the directory whose entries are visited
+	// at level + 1, and lens[level] the length of its path
+	const char **dirs;
+	size_t *lens;
+	int levels;
+};
+
+// kind is '-' for removed, '+' for added, '!' for changed, '=' for same
+// contents and '?' until the contents have been compared
+struct tree_change {
+	const char *rel;
+	char kind;
+	bool dir;
+	int error; // errno of a failed comparison
+};
+
+struct compare_queue {
+	const char *roots[2];
+	struct tree_change *changes;
+	size_t *pending; // indices into changes
+	size_t npending;
+	_Atomic size_t next;
+};
+
+/**
+ * Join an entry's name to the path of its directory
+ * @param  tree  [description]
+ * @param  entry [description]
+ * @param  len   set to the length of the path
+ * @return       the entry's path below the root, in the tree's arena
+ */
+static const char *entry_rel(struct tree *tree,
+							 const struct pwalk_entry *entry, size_t *len) {
+	size_t name_len = strlen(entry->name);
+
+	if (entry->level == 0) {
+		*len = name_len;
+		return arena_strdup(&tree->arena, entry->name);
+	}
+
+	size_t dir_len = tree->lens[entry->level - 1];
+	char *rel = arena_alloc(&tree->arena, dir_len + 1 + name_len + 1);
+
+	memcpy(rel, tree->dirs[entry->level - 1], dir_len);
+	rel[dir_len] = '/';
+	memcpy(rel + dir_len + 1, entry->name, name_len + 1);
+	*len = dir_len + 1 + name_len;
+	return rel;
+}
+
+static void collect_entry(struct pwalker *walker,
+						  const struct pwalk_entry *entry) {
+	struct tree *tree = walker->arg;
+
+	if (tree->n == tree->cap) {
+		tree->cap = tree->cap ? 2 * tree->cap : 1024;
+		tree->entries =
+			xrealloc(tree->entries, tree->cap * sizeof(*tree->entries));
+	}
+
+	struct tree_entry *e = &tree->entries[tree->n++];
+	size_t len;
+	e->rel = entry_rel(tree, entry, &len);
+	e->mode = entry->st->mode;
+	e->size = entry->st->size;
+	e->mtime = entry->st->mtime;
+	if (!entry->dir)
+		return;
+
+	if (entry->level == tree->levels) {
+		tree->levels = tree->levels ? 2 * tree->levels : 64;
+		tree->dirs = xrealloc(tree->dirs, tree->levels * sizeof(*tree->dirs));
+		tree->lens = xrealloc(tree->lens, tree->levels * sizeof(*tree->lens));
+	}
+	tree->dirs[entry->level] = e->rel;
+	tree->lens[entry->level] = len;
+}
+
+static void walk_failed(struct pwalker *walker,
+						const struct pwalk_entry *entry, const char *what) {
+	struct tree *tree = walker->arg;
+	int error = errno;
+
+	(void)what;
+	if (entry->level < 0)
+		printf("-%s: hdiff: %s: %s\n", sysname, tree->root, strerror(error));
+	else if (entry->level == 0)
+		printf("-%s: hdiff: %s/%s: %s\n", sysname, tree->root, entry->name,
+			   strerror(error));
+	else
+		printf("-%s: hdiff: %s/%s/%s: %s\n", sysname, tree->root,
+			   tree->dirs[entry->level - 1], entry->name, strerror(error));
+}
+
+static int entry_cmp(const void *a, const void *b) {
+	return path_cmp(((const struct tree_entry *)a)->rel,
+					((const struct tree_entry *)b)->rel);
+}
+
+// whether rel lies inside the directory dir
+static bool below(const char *rel, const char *dir) {
+	size_t len = strlen(dir);
+	return strncmp(rel, dir, len) == 0 && rel[len] == '/';
+}
+
+static void add_change(struct tree_change **changes, size_t *n, size_t *cap,
+					   const char *rel, char kind, bool dir) {
+	if (*n == *cap) {
+		*cap = *cap ? 2 * *cap : 256;
+		*changes = realloc(*changes, *cap * sizeof(**changes));
+		if (!*changes) {
+			perror("hdiff");
+			exit(EXIT_FAILURE);
+		}
+	}
+	(*changes)[(*n)++] = (struct tree_change){rel, kind, dir, 0};
+}
+
+static bool same_link(const char *root1, const char *root2, const char *rel) {
+	char path[PATH_MAX], target1[PATH_MAX], target2[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", root1, rel);
+	ssize_t n1 = readlink(path, target1, sizeof(target1));
+	snprintf(path, sizeof(path), "%s/%s", root2, rel);
+	ssize_t n2 = readlink(path, target2, sizeof(target2));
+
+	return n1 == n2 && n1 >= 0 && memcmp(target1, target2, n1) == 0;
+}
+
+/**
+ * Whether two regular files have the same bytes. The sizes are checked
+ * again since the walk, and reading stops at the first difference.
+ * @param  path1 [description]
+ * @param  path2 [description]
+ * @param  buf   2 * SMALL_FILE bytes
+ * @return       1 if they do, 0 if not, -1 with errno set on failure
+ */
+static int same_contents(const char *path1, const char *path2,
+						 unsigned char *buf) {
+	int fd1 = open(path1, O_RDONLY | O_CLOEXEC);
+	int fd2 = fd1 == -1 ? -1 : open(path2, O_RDONLY | O_CLOEXEC);
+	struct stat st1, st2;
+	int result = -1;
+
+	if (fd2 == -1 || fstat(fd1, &st1) == -1 || fstat(fd2, &st2) == -1) {
+		// fall through to the cleanup with errno from the failed call
+	} else if (st1.st_size != st2.st_size) {
+		result = 0;
+	} else if (st1.st_size == 0) {
+		result = 1;
+	} else if ((size_t)st1.st_size <= SMALL_FILE) {
+		size_t size = st1.st_size;
+
+		// a file that shrank since the fstat reads short: errno stays 0
+		errno = 0;
+		if (read_full(fd1, buf, size) && read_full(fd2, buf + SMALL_FILE, size))
+			result = memcmp(buf, buf + SMALL_FILE, size) == 0;
+		else if (errno == 0)
+			result = 0;
+	} else {
+		size_t size = st1.st_size;
+		void *a = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd1, 0);
+		void *b = a == MAP_FAILED
+					  ? MAP_FAILED
+					  : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd2, 0);
+
+		if (b != MAP_FAILED) {
+			madvise(a, size, MADV_SEQUENTIAL);
+			madvise(b, size, MADV_SEQUENTIAL);
+			result = bytecmp_engine()->first_diff(a, b, size) == size;
+			munmap(b, size);
+		}
+		if (a != MAP_FAILED)
+			munmap(a, size);
+	}
+
+	int saved = errno;
+	if (fd1 != -1)
+		close(fd1);
+	if (fd2 != -1)
+		close(fd2);
+	errno = saved;
+	return result;
+}
+
+static void *compare_worker(void *arg) {
+	struct compare_queue *queue = arg;
+	char path1[PATH_MAX], path2[PATH_MAX];
+	unsigned char *buf = malloc(2 * SMALL_FILE);
+	size_t i;
+
+	if (!buf) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+
+	while ((i = atomic_fetch_add(&queue->next, 1)) < queue->npending) {
+		struct tree_change *c = &queue->changes[queue->pending[i]];
+
+		snprintf(path1, sizeof(path1), "%s/%s", queue->roots[0], c->rel);
+		snprintf(path2, sizeof(path2), "%s/%s", queue->roots[1], c->rel);
+		int same = same_contents(path1, path2, buf);
+		c->kind = same == 1 ? '=' : '!';
+		c->error = same == -1 ? errno : 0;
+	}
+	free(buf);
+	return NULL;
+}
+
+/**
+ * Read the candidate pairs with up to jobs threads, the calling thread
+ * being one of them
+ * @param queue [description]
+ * @param jobs  [description]
+ */
+static void compare_pending(struct compare_queue *queue, int jobs) {
+	int started = 0;
+
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if ((size_t)jobs > queue->npending)
+		jobs = queue->npending;
+
+	pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+	if (!threads) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+
+	bytecmp_engine(); // chosen once, before the threads race for it
+	for (; started < jobs - 1; started++) {
+		if (pthread_create(&threads[started], NULL, compare_worker, queue) != 0)
+			break;
+	}
+	compare_worker(queue);
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/**
+ * Match two sorted trees entry by entry. A directory found on one side
+ * only, or facing a non-directory, is reported once without its contents.
+ * @param t1          [description]
+ * @param t2          [description]
+ * @param trust_mtime [description]
+ * @param changes     [description]
+ * @param nchanges    [description]
+ * @return            pairs found identical without reading them
+ */
+static size_t match_trees(struct tree *t1, struct tree *t2, bool trust_mtime,
+						  struct tree_change **changes, size_t *nchanges) {
+	const char *skip1 = NULL, *skip2 = NULL;
+	size_t i = 0, j = 0, cap = 0, identical = 0;
+
+	*changes = NULL;
+	*nchanges = 0;
+	while (i < t1->n || j < t2->n) {
+		struct tree_entry *a = i < t1->n ? &t1->entries[i] : NULL;
+		struct tree_entry *b = j < t2->n ? &t2->entries[j] : NULL;
+
+		if (a && skip1 && below(a->rel, skip1)) {
+			i++;
+			continue;
+		}
+		if (b && skip2 && below(b->rel, skip2)) {
+			j++;
+			continue;
+		}
+
+		int cmp = !a ? 1 : !b ? -1 : path_cmp(a->rel, b->rel);
+		if (cmp < 0) {
+			add_change(changes, nchanges, &cap, a->rel, '-', S_ISDIR(a->mode));
+			if (S_ISDIR(a->mode))
+				skip1 = a->rel;
+			i++;
+			continue;
+		}
+		if (cmp > 0) {
+			add_change(changes, nchanges, &cap, b->rel, '+', S_ISDIR(b->mode));
+			if (S_ISDIR(b->mode))
+				skip2 = b->rel;
+			j++;
+			continue;
+		}
+
+		if ((a->mode & S_IFMT) != (b->mode & S_IFMT)) {
+			add_change(changes, nchanges, &cap, a->rel, '!', false);
+			if (S_ISDIR(a->mode))
+				skip1 = a->rel;
+			if (S_ISDIR(b->mode))
+				skip2 = b->rel;
+		} else if (S_ISREG(a->mode)) {
+			if (a->size != b->size)
+				add_change(changes, nchanges, &cap, a->rel, '!', false);
+			else if (trust_mtime && a->mtime.tv_sec == b->mtime.tv_sec &&
+					 a->mtime.tv_nsec == b->mtime.tv_nsec)
+				identical++;
+			else
+				add_change(changes, nchanges, &cap, a->rel, '?', false);
+		} else if (S_ISLNK(a->mode)) {
+			if (same_link(t1->root, t2->root, a->rel))
+				identical++;
+			else
+				add_change(changes, nchanges, &cap, a->rel, '!', false);
+		} else if (!S_ISDIR(a->mode)) {
+			identical++; // fifos, sockets and devices: the type is all
+		}
+		i++;
+		j++;
+	}
+	return identical;
+}
+
+// runs on a thread of its own for the second tree
+static void *walk(void *arg) {
+	struct tree *tree = arg;
+	struct pwalker walker = {
+		.need_stat = true,
+		.visit = collect_entry,
+		.error = walk_failed,
+		.arg = tree,
+	};
+
+	pwalk_tree(&walker, tree->root);
+	qsort(tree->entries, tree->n, sizeof(*tree->entries), entry_cmp);
+	free(tree->dirs);
+	free(tree->lens);
+	return NULL;
+}
+
+void treediff(const char *dir1, const char *dir2, bool trust_mtime, int jobs) {
+	struct tree t1 = {.root = dir1}, t2 = {.root = dir2};
+	const char *roots[2] = {dir1, dir2};
+	struct tree_change *changes;
+	size_t nchanges, counts[4] = {0};
+
+	for (int k = 0; k < 2; k++) {
+		struct stat st;
+		if (stat(roots[k], &st) == -1) {
+			printf("-%s: hdiff: %s: %s\n", sysname, roots[k], strerror(errno));
+			return;
+		}
+		if (!S_ISDIR(st.st_mode)) {
+			printf("-%s: hdiff: %s: %s\n", sysname, roots[k],
+				   strerror(ENOTDIR));
+			return;
+		}
+	}
+
+	arena_init(&t1.arena, TREE_ARENA_SIZE);
+	arena_init(&t2.arena, TREE_ARENA_SIZE);
+	pthread_t other;
+	bool threaded = pthread_create(&other, NULL, walk, &t2) == 0;
+	walk(&t1);
+	if (threaded)
+		pthread_join(other, NULL);
+	else
+		walk(&t2);
+	size_t identical = match_trees(&t1, &t2, trust_mtime, &changes, &nchanges);
+
+	struct compare_queue queue = {.roots = {dir1, dir2}, .changes = changes};
+	queue.pending = malloc((nchanges ? nchanges : 1) * sizeof(size_t));
+	if (!queue.pending) {
+		perror("hdiff");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t k = 0; k < nchanges; k++) {
+		if (changes[k].kind == '?')
+			queue.pending[queue.npending++] = k;
+	}
+	if (queue.npending > 0)
+		compare_pending(&queue, jobs);
+
+	for (size_t k = 0; k < nchanges; k++) {
+		struct tree_change *c = &changes[k];
+
+		if (c->error) {
+			printf("-%s: hdiff: %s: %s\n", sysname, c->rel,
+				   strerror(c->error));
+			counts[3]++;
+		} else if (c->kind == '-') {
+			printf("Removed: %s%s\n", c->rel, c->dir ? "/" : "");
+			counts[0]++;
+		} else if (c->kind == '+') {
+			printf("Added: %s%s\n", c->rel, c->dir ? "/" : "");
+			counts[1]++;
+		} else if (c->kind == '!') {
+			printf("Changed: %s\n", c->rel);
+			counts[2]++;
+		} else {
+			identical++;
+		}
+	}
+
+	if (counts[0] + counts[1] + counts[2] + counts[3] == 0)
+		printf("The two directories are identical\n");
+	else
+		printf("%zu added, %zu removed, %zu changed, %zu identical\n",
+			   counts[1], counts[0], counts[2], identical);
+
+	free(queue.pending);
+	free(changes);
+	free(t1.entries);
+	free(t2.entries);
+	arena_destroy(&t1.arena);
+	arena_destroy(&t2.arena);
+}
@@ -0,0 +1,17 @@
+#ifndef TREEDIFF_H
+#define TREEDIFF_H
+
+#include <stdbool.h>
+
+/*
+ * hdiff -r: compare two directory trees. Both are walked with pwalk.h, as
+ * mindmap walks them, at once, and their entries matched by path
+ * below the root. Pairs whose type, size or symlink target differ are
+ * changed without reading them, and with trust_mtime pairs of equal size
+ * and mtime count as identical. Only the remaining pairs of regular files
+ * are read, by jobs threads (0 for one per CPU), each pair stopping at its
+ * first differing byte.
+ */
+void treediff(const char *dir1, const char *dir2, bool trust_mtime, int jobs);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "treeout.h"
+#include "util.h"
+
+#define BINARY_MAGIC "MINDMAP\1"
+
+// the indentation of 32 levels, copied from in pieces
+static const char indent[] = "|   |   |   |   |   |   |   |   "
+							 "|   |   |   |   |   |   |   |   "
+							 "|   |   |   |   |   |   |   |   "
+							 "|   |   |   |   |   |   |   |   ";
+
+bool treeout_parse_format(const char *name, enum treeout_format *format) {
+	if (strcmp(name, "tree") == 0)
+		*format = TREEOUT_TREE;
+	else if (strcmp(name, "ndjson") == 0)
+		*format = TREEOUT_NDJSON;
+	else if (strcmp(name, "binary") == 0)
+		*format = TREEOUT_BINARY;
+	else
+		return false;
+	return true;
+}
+
+/**
+ * Copy a string the way it goes between JSON quotes
+ * @param  dst room for 6 bytes per byte of src
+ * @param  src [description]
+ * @param  len [description]
+ * @return     the bytes written
+ */
+static size_t json_escape(char *dst, const char *src, size_t len) {
+	static const char hex[] = "0123456789abcdef";
+	size_t n = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = src[i];
+
+		if (c == '"' || c == '\\') {
+			dst[n++] = '\\';
+			dst[n++] = c;
+		} else if (c < 0x20) {
+			memcpy(dst + n, "\\u00", 4);
+			dst[n + 4] = hex[c >> 4];
+			dst[n + 5] = hex[c & 0xf];
+			n += 6;
+		} else {
+			dst[n++] = c;
+		}
+	}
+	return n;
+}
+
+/**
+ * Start writing a walk of root
+ * @param tree   [description]
+ * @param format [description]
+ * @param fd     where to write
+ * @param root   [description]
+ */
+void treeout_init(struct treeout *tree, enum treeout_format format, int fd,
+				  const char *root) {
+	size_t len = strlen(root);
+
+	*tree = (struct treeout){.format = format};
+	out_buffer_init(&tree->out, fd, OUT_BUFFER_SIZE);
+
+	if (format == TREEOUT_BINARY) {
+		char *p = out_buffer_reserve(&tree->out,
+									 sizeof(BINARY_MAGIC) + VARINT_MAX + len);
+		size_t n = sizeof(BINARY_MAGIC) - 1;
+
+		memcpy(p, BINARY_MAGIC, n);
+		n += put_varint(p + n, len);
+		memcpy(p + n, root, len);
+		tree->out.len += n + len;
+	} else if (format == TREEOUT_NDJSON) {
+		// paths are kept escaped, so that only names need escaping
+		tree->path_cap = 6 * len + 256;
+		tree->path = xrealloc(NULL, tree->path_cap);
+		tree->lens_cap = 16;
+		tree->lens = xrealloc(NULL, tree->lens_cap * sizeof(*tree->lens));
+		tree->lens[0] = json_escape(tree->path, root, len);
+		if (len > 1 && root[len - 1] == '/')
+			tree->lens[0]--;
+	}
+}
+
+static void tree_entry(struct treeout *tree, const struct pwalk_entry *entry,
+					   size_t name_len) {
+	size_t width = 4 * entry->level;
+	size_t most = width + name_len + sizeof("|--  (Directory)\n");
+	char *p = out_buffer_reserve(&tree->out, most);
+	char *start = p;
+
+	for (size_t left = width; left > 0;) {
+		size_t n = left < sizeof(indent) - 1 ? left : sizeof(indent) - 1;
+		memcpy(p, indent, n);
+		p += n;
+		left -= n;
+	}
+	memcpy(p, "|-- ", 4);
+	memcpy(p + 4, entry->name, name_len);
+	p += 4 + name_len;
+	if (entry->dir) {
+		memcpy(p, " (Directory)", 12);
+		p += 12;
+	}
+	*p++ = '\n';
+	tree->out.len += p - start;
+}
+
+static void ndjson_entry(struct treeout *tree, const struct pwalk_entry *entry,
+						 size_t name_len) {
+	size_t dir_len = tree->lens[entry->level];
+	bool slash = dir_len == 0 || tree->path[dir_len - 1] != '/';
+	char *p = out_buffer_reserve(&tree->out, dir_len + 6 * name_len + 64);
+	char *start = p;
+
+	p += sprintf(p, "{\"level\":%d,\"type\":\"%s\",\"path\":\"",
+				 entry->level, entry->dir ? "dir" : "file");
+	memcpy(p, tree->path, dir_len);
+	p += dir_len;
+	if (slash)
+		*p++ = '/';
+	char *name = p;
+	size_t escaped = json_escape(name, entry->name, name_len);
+	p += escaped;
+	memcpy(p, "\"}\n", 3);
+	tree->out.len += p + 3 - start;
+
+	if (!entry->dir)
+		return;
+
+	// its contents come next
+	size_t len = dir_len + slash + escaped;
+	if (entry->level + 2 > tree->lens_cap) {
+		tree->lens_cap *= 2;
+		tree->lens =
+			xrealloc(tree->lens, tree->lens_cap * sizeof(*tree->lens));
+	}
+	if (len > tree->path_cap) {
+		tree->path_cap = 2 * len;
+		tree->path = xrealloc(tree->path, tree->path_cap);
+	}
+	if (slash)
+		tree->path[dir_len] = '/';
+	memcpy(tree->path + dir_len + slash, name, escaped);
+	tree->lens[entry->level + 1] = len;
+}
+
+static void binary_entry(struct treeout *tree, const struct pwalk_entry *entry,
+						 size_t name_len) {
+	char *p = out_buffer_reserve(&tree->out, 2 * VARINT_MAX + name_len);
+	size_t n = put_varint(p, (uint64_t)entry->level * 2 + entry->dir);
+
+	n += put_varint(p + n, name_len);
+	memcpy(p + n, entry->name, name_len);
+	tree->out.len += n + name_len;
+}
+
+static void write_entry(struct treeout *tree,
+						const struct pwalk_entry *entry) {
+	size_t name_len = strlen(entry->name);
+
+	switch (tree->format) {
+	case TREEOUT_TREE:
+		tree_entry(tree, entry, name_len);
+		break;
+	case TREEOUT_NDJSON:
+		ndjson_entry(tree, entry, name_len);
+		break;
+	case TREEOUT_BINARY:
+		binary_entry(tree, entry, name_len);
+		break;
+	}
+}
+
+// deferred directories that aren't above entry anymore are dropped
+static void drop_pending(struct treeout *tree,
+						 const struct pwalk_entry *entry) {
+	while (tree->npending > 0 &&
+		   tree->pending[tree->npending - 1].level >= entry->level) {
+		tree->npending--;
+		tree->names_len = tree->pending[tree->npending].name;
+	}
+}
+
+void treeout_entry(struct treeout *tree, const struct pwalk_entry *entry) {
+	if (tree->npending > 0) {
+		drop_pending(tree, entry);
+		for (int i = 0; i < tree->npending; i++) {
+			struct pwalk_entry dir = {
+				tree->names + tree->pending[i].name,
+				tree->pending[i].level,
+				true,
+				NULL,
+			};
+			write_entry(tree, &dir);
+		}
+		tree->npending = 0;
+		tree->names_len = 0;
+	}
+	write_entry(tree, entry);
+}
+
+/**
+ * Hold a directory back, to be written only if an entry below it is
+ * @param tree  [description]
+ * @param entry [description]
+ */
+void treeout_defer(struct treeout *tree, const struct pwalk_entry *entry) {
+	size_t len = strlen(entry->name) + 1;
+
+	drop_pending(tree, entry);
+	if (tree->npending == tree->pending_cap) {
+		tree->pending_cap = tree->pending_cap ? 2 * tree->pending_cap : 16;
+		tree->pending = xrealloc(tree->pending,
+								 tree->pending_cap * sizeof(*tree->pending));
+	}
+	if (tree->names_len + len > tree->names_cap) {
+		tree->names_cap = 2 * (tree->names_len + len);
+		tree->names = xrealloc(tree->names, tree->names_cap);
+	}
+	memcpy(tree->names + tree->names_len, entry->name, len);
+	tree->pending[tree->npending++] =
+		(struct treeout_pending){tree->names_len, entry->level};
+	tree->names_len += len;
+}
+
+/**
+ * Write out what's left and free the rest
+ * @param  tree [description]
+ * @return      0, or -1 with errno set if writing failed
+ */
+int treeout_finish(struct treeout *tree) {
+	int r = out_buffer_flush(&tree->out);
+
+	out_buffer_destroy(&tree->out);
+	free(tree->path);
+	free(tree->lens);
+	free(tree->pending);
+	free(tree->names);
+	return r;
+}
@@ -0,0 +1,59 @@
+#ifndef TREEOUT_H
+#define TREEOUT_H
+
+#include <stdbool.h>
+#include "outbuf.h"
+#include "pwalk.h"
+
+/*
+ * How mindmap writes the entries it's handed, through outbuf.h in large
+ * blocks:
+ *
+ * TREEOUT_TREE    the drawing, "|   " per level then "|-- name", with
+ *                 " (Directory)" after directories
+ * TREEOUT_NDJSON  a JSON object per line, {"level":L,"type":"dir"|"file",
+ *                 "path":"root/.../name"}; bytes that aren't ASCII are
+ *                 passed through as they are in the name
+ * TREEOUT_BINARY  the 8 bytes "MINDMAP\1", then the root as a varint length
+ *                 and its bytes, then per entry a varint of level * 2 + 1
+ *                 for a directory (+ 0 otherwise), and its name as a varint
+ *                 length and its bytes. Varints are LEB128: 7 bits a byte,
+ *                 low bits first, the top bit set on all but the last.
+ *
+ * Entries come in walk order, each directory right before its contents.
+ * A directory can be deferred, and is then written only once an entry
+ * below it is, so that filtered output keeps the directories leading to
+ * what's shown.
+ */
+enum treeout_format {
+	TREEOUT_TREE,
+	TREEOUT_NDJSON,
+	TREEOUT_BINARY,
+};
+
+struct treeout_pending {
+	size_t name; // offset in names
+	int level;
+};
+
+struct treeout {
+	enum treeout_format format;
+	struct out_buffer out;
+	char *path; // of the directory entries are in, for TREEOUT_NDJSON
+	size_t path_cap;
+	size_t *lens; // by level, the length of its directory's path
+	int lens_cap;
+	struct treeout_pending *pending; // deferred directories, outermost first
+	int npending, pending_cap;
+	char *names; // of the pending directories
+	size_t names_len, names_cap;
+};
+
+bool treeout_parse_format(const char *name, enum treeout_format *format);
+void treeout_init(struct treeout *tree, enum treeout_format format, int fd,
+				  const char *root);
+void treeout_entry(struct treeout *tree, const struct pwalk_entry *entry);
+void treeout_defer(struct treeout *tree, const struct pwalk_entry *entry);
+int treeout_finish(struct treeout *tree);
+
+#endif
@@ -0,0 +1,111 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "uring.h"
+
+int uring_init(struct uring *ring, unsigned entries) {
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd == -1)
+		return -1;
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size =
+		p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	// older kernels map the two rings separately
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+	ring->sq_ring =
+		mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->sq_ring;
+	if (ring->sq_ring != MAP_FAILED && ring->cq_ring_size)
+		ring->cq_ring =
+			mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = ring->cq_ring == MAP_FAILED
+					 ? MAP_FAILED
+					 : mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_POPULATE, ring->fd,
+							IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		int saved = errno;
+		if (ring->cq_ring != MAP_FAILED && ring->cq_ring_size)
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		if (ring->sq_ring != MAP_FAILED)
+			munmap(ring->sq_ring, ring->sq_ring_size);
+		close(ring->fd);
+		errno = saved;
+		return -1;
+	}
+
+	char *sq = ring->sq_ring, *cq = ring->cq_ring;
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+void uring_free(struct uring *ring) {
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring_size)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+struct io_uring_sqe *uring_sqe(struct uring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *ring->sq_tail + ring->queued;
+
+	if (tail - head > *ring->sq_mask)
+		return NULL;
+
+	unsigned index = tail & *ring->sq_mask;
+	ring->sq_array[index] = index;
+	ring->queued++;
+	memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+	return &ring->sqes[index];
+}
+
+int uring_submit(struct uring *ring, unsigned wait) {
+	unsigned submit = ring->queued;
+
+	// the kernel sees the new entries once the tail moves past them
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE);
+	ring->queued = 0;
+
+	for (;;) {
+		int n = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+						wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (n >= 0 || errno != EINTR)
+			return n;
+	}
+}
+
+struct io_uring_cqe *uring_cqe(struct uring *ring) {
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_seen(struct uring *ring) {
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
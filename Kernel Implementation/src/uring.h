@@ -0,0 +1,55 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+/*
+ * Just enough io_uring, on the raw system calls, to hand the kernel a batch
+ * of requests with one io_uring_enter instead of one system call each. Each
+ * ring belongs to one thread.
+ */
+struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	unsigned queued; // sqes filled in but not yet submitted
+};
+
+/**
+ * Set up a ring
+ * @param  ring    [description]
+ * @param  entries submission queue size, a power of two
+ * @return         0, or -1 with errno set when io_uring isn't available
+ */
+int uring_init(struct uring *ring, unsigned entries);
+void uring_free(struct uring *ring);
+
+/**
+ * Take the next free submission entry, cleared
+ * @param  ring [description]
+ * @return      the entry, or NULL while the submission queue is full
+ */
+struct io_uring_sqe *uring_sqe(struct uring *ring);
+
+/**
+ * Submit the queued entries and wait for at least wait completions
+ * @param  ring [description]
+ * @param  wait [description]
+ * @return      the number of entries submitted, or -1 with errno set
+ */
+int uring_submit(struct uring *ring, unsigned wait);
+
+/**
+ * The oldest completion, to be released with uring_seen
+ * @param  ring [description]
+ * @return      the completion, or NULL when there is none yet
+ */
+struct io_uring_cqe *uring_cqe(struct uring *ring);
+void uring_seen(struct uring *ring);
+
+#endif
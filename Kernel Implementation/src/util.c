@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "util.h"
+
+/**
+ * Order paths so that a directory's contents follow it directly: '/'
+ * sorts below every other byte. This is the order of hdiff -r's entries
+ * and of pathindex.h's files.
+ * @param  a [description]
+ * @param  b [description]
+ * @return   [description]
+ */
+int path_cmp(const char *a, const char *b) {
+	for (;; a++, b++) {
+		int ca = *a == '/' ? 1 : *a ? (unsigned char)*a + 1 : 0;
+		int cb = *b == '/' ? 1 : *b ? (unsigned char)*b + 1 : 0;
+
+		if (ca != cb || ca == 0)
+			return ca - cb;
+	}
+}
+
+/**
+ * Read a file's first size bytes, whatever the file offset
+ * @param  fd   [description]
+ * @param  buf  [description]
+ * @param  size [description]
+ * @return      false on an error or if the file is shorter
+ */
+bool read_full(int fd, unsigned char *buf, size_t size) {
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t n = pread(fd, buf + done, size - done, done);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+// realloc that exits the shell when memory runs out; size 0 still gets a
+// block of its own rather than freeing ptr
+void *xrealloc(void *ptr, size_t size) {
+	ptr = realloc(ptr, size ? size : 1);
+	if (!ptr) {
+		perror("mishell");
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+// calloc that exits the shell when memory runs out
+void *xcalloc(size_t n, size_t size) {
+	void *p = calloc(n ? n : 1, size);
+	if (!p) {
+		perror("mishell");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/**
+ * Write a value as a LEB128 varint: seven bits a byte, low ones first, the
+ * top bit set on every byte but the last
+ * @param  dst   room for VARINT_MAX bytes
+ * @param  value [description]
+ * @return       the bytes written
+ */
+size_t put_varint(void *dst, uint64_t value) {
+	unsigned char *p = dst;
+	size_t n = 0;
+
+	for (; value >= 0x80; value >>= 7)
+		p[n++] = (unsigned char)(value | 0x80);
+	p[n++] = (unsigned char)value;
+	return n;
+}
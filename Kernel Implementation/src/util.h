@@ -0,0 +1,23 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Small helpers the builtins share instead of each keeping a copy.
+ */
+
+#define VARINT_MAX 10 // bytes of a 64-bit varint
+
+// files up to this size are read into a buffer, mapping them costs more
+#define SMALL_FILE (128UL << 10)
+
+int path_cmp(const char *a, const char *b);
+bool read_full(int fd, unsigned char *buf, size_t size);
+void *xrealloc(void *ptr, size_t size);
+void *xcalloc(size_t n, size_t size);
+size_t put_varint(void *dst, uint64_t value);
+
+#endif